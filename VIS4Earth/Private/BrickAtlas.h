@@ -0,0 +1,159 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <algorithm>
+
+#include "CoreMinimal.h"
+#include "RHICommandList.h"
+#include "RHIResources.h"
+
+#include "Util.h"
+
+#include "BrickResidency.h"
+#include "Data.h"
+
+/*
+ * Class: FBrickAtlas
+ * Function:
+ * -- Virtual texture of a volume bigger than the VRAM or the maximum 3D texture size. Bricks of
+ *    BrickSize^3 voxels are streamed into a fixed-size atlas of SlotNumPerAxis^3 slots, as
+ *    decided by FBrickResidency, and located by a page table.
+ * -- Each slot holds its brick with an apron of 1 voxel on every side, i.e. voxels
+ *    [b * BrickSize - 1, (b + 1) * BrickSize] clamped to the volume, so that samples anywhere
+ *    in the brick are filtered by the hardware without reading other slots.
+ * -- The page table is a R32_UINT 3D texture of one texel per brick, which is 0 if the brick
+ *    is not resident, or ResidentBit | SlotX | SlotY << 10 | SlotZ << 20 otherwise.
+ * -- Only accessed in the render thread.
+ */
+class VIS4EARTH_API FBrickAtlas {
+  public:
+    static constexpr int32 Apron = 1;
+    static constexpr uint32 ResidentBit = 1u << 31;
+
+    struct Parameters {
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, BrickSize, 32)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, SlotNumPerAxis, 8)
+        // Bricks uploaded per Update() at most
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, MaxLoadNum, 16)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(ESupportedVoxelType, VoxelType,
+                                         ESupportedVoxelType::UInt8)
+        FIntVector Dimension = FIntVector::ZeroValue;
+    };
+
+    FBrickAtlas(const Parameters &Params)
+        : brickSz(std::max(Params.BrickSize, 1)),
+          slotNumPerAxis(FMath::Clamp(Params.SlotNumPerAxis, 1, 1023)),
+          voxTy(Params.VoxelType), dim(Params.Dimension) {
+        brickNum = FIntVector(FMath::DivideAndRoundUp(dim.X, brickSz),
+                              FMath::DivideAndRoundUp(dim.Y, brickSz),
+                              FMath::DivideAndRoundUp(dim.Z, brickSz));
+        residency = FBrickResidency({.BrickNumber = brickNum,
+                                     .SlotNum = slotNumPerAxis * slotNumPerAxis * slotNumPerAxis,
+                                     .MaxLoadNum = Params.MaxLoadNum});
+
+        auto slotSz = brickSz + 2 * Apron;
+        atlasTex = RHICreateTexture(
+            FRHITextureCreateDesc::Create3D(TEXT("VIS4Earth Brick Atlas"), slotSz * slotNumPerAxis,
+                                            slotSz * slotNumPerAxis, slotSz * slotNumPerAxis,
+                                            VolumeData::GetVoxelPixelFormat(voxTy))
+                .SetFlags(ETextureCreateFlags::ShaderResource)
+                .SetInitialState(ERHIAccess::SRVMask));
+        pageTableTex = RHICreateTexture(
+            FRHITextureCreateDesc::Create3D(TEXT("VIS4Earth Brick Page Table"), brickNum.X,
+                                            brickNum.Y, brickNum.Z, PF_R32_UINT)
+                .SetFlags(ETextureCreateFlags::ShaderResource)
+                .SetInitialState(ERHIAccess::SRVMask));
+        pageTable.Init(0, static_cast<int64>(brickNum.X) * brickNum.Y * brickNum.Z);
+        isPageTableDirty = true;
+    }
+
+    FBrickAtlas(const FBrickAtlas &) = delete;
+    FBrickAtlas &operator=(const FBrickAtlas &) = delete;
+
+    // Streams in the requested bricks chosen by the residency from VolDat of Dimension voxels.
+    // Returns the number of uploaded bricks.
+    int32 Update(FRHICommandListImmediate &RHICmdList,
+                 TConstArrayView<FBrickResidency::Request> Requests, const uint8 *VolDat) {
+        auto loads = residency.Update(Requests);
+
+        auto voxSz = static_cast<int64>(VolumeData::GetVoxelSize(voxTy));
+        auto slotSz = brickSz + 2 * Apron;
+        TArray<uint8> brickDat;
+        brickDat.SetNumUninitialized(static_cast<int64>(slotSz) * slotSz * slotSz * voxSz);
+        for (auto &load : loads) {
+            FIntVector brick(load.Brick % brickNum.X, load.Brick / brickNum.X % brickNum.Y,
+                             load.Brick / (brickNum.X * brickNum.Y));
+            auto start = brick * brickSz - FIntVector(Apron);
+            auto dst = brickDat.GetData();
+            for (int32 z = 0; z < slotSz; ++z) {
+                auto vz = FMath::Clamp(start.Z + z, 0, dim.Z - 1);
+                for (int32 y = 0; y < slotSz; ++y) {
+                    auto vy = FMath::Clamp(start.Y + y, 0, dim.Y - 1);
+                    auto row = VolDat + (static_cast<int64>(vz) * dim.Y + vy) * dim.X * voxSz;
+                    for (int32 x = 0; x < slotSz; ++x) {
+                        auto vx = FMath::Clamp(start.X + x, 0, dim.X - 1);
+                        FMemory::Memcpy(dst, row + vx * voxSz, voxSz);
+                        dst += voxSz;
+                    }
+                }
+            }
+
+            auto slot = getSlotCoordinate(load.Slot);
+            RHICmdList.UpdateTexture3D(
+                atlasTex, 0,
+                FUpdateTextureRegion3D(slot * slotSz, FIntVector::ZeroValue, FIntVector(slotSz)),
+                slotSz * voxSz, slotSz * slotSz * voxSz, brickDat.GetData());
+        }
+
+        // Evicted bricks are among the entries changed by the loads
+        if (!loads.IsEmpty())
+            for (int64 b = 0; b < pageTable.Num(); ++b) {
+                auto s = residency.GetSlot(static_cast<int32>(b));
+                uint32 entry = 0;
+                if (s != FBrickResidency::InvalidSlot) {
+                    auto slot = getSlotCoordinate(s);
+                    entry = ResidentBit | slot.X | slot.Y << 10 | slot.Z << 20;
+                }
+                isPageTableDirty |= pageTable[b] != entry;
+                pageTable[b] = entry;
+            }
+        if (isPageTableDirty) {
+            RHICmdList.UpdateTexture3D(
+                pageTableTex, 0,
+                FUpdateTextureRegion3D(FIntVector::ZeroValue, FIntVector::ZeroValue, brickNum),
+                brickNum.X * sizeof(uint32), brickNum.X * brickNum.Y * sizeof(uint32),
+                reinterpret_cast<const uint8 *>(pageTable.GetData()));
+            isPageTableDirty = false;
+        }
+
+        return loads.Num();
+    }
+
+    int32 GetBrickSize() const { return brickSz; }
+    int32 GetSlotNumPerAxis() const { return slotNumPerAxis; }
+    const FIntVector &GetBrickNumber() const { return brickNum; }
+    const FIntVector &GetDimension() const { return dim; }
+    ESupportedVoxelType GetVoxelType() const { return voxTy; }
+    const FBrickResidency &GetResidency() const { return residency; }
+    const FTextureRHIRef &GetAtlasTexture() const { return atlasTex; }
+    const FTextureRHIRef &GetPageTableTexture() const { return pageTableTex; }
+
+  private:
+    int32 brickSz;
+    int32 slotNumPerAxis;
+    ESupportedVoxelType voxTy;
+    FIntVector dim;
+    FIntVector brickNum;
+    bool isPageTableDirty = false;
+
+    FBrickResidency residency;
+    TArray<uint32> pageTable;
+    FTextureRHIRef atlasTex;
+    FTextureRHIRef pageTableTex;
+
+    FIntVector getSlotCoordinate(int32 Slot) const {
+        return FIntVector(Slot % slotNumPerAxis, Slot / slotNumPerAxis % slotNumPerAxis,
+                          Slot / (slotNumPerAxis * slotNumPerAxis));
+    }
+};
@@ -0,0 +1,196 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <algorithm>
+
+#include "CoreMinimal.h"
+
+#include "Util.h"
+
+/*
+ * Class: FBrickResidency
+ * Function:
+ * -- Decides which bricks of a volume reside in the SlotNum slots of a brick pool, keeping a
+ *    page table from bricks to slots. Knows nothing about the GPU, which only applies the
+ *    returned loads.
+ * -- Each Update() takes the bricks requested by a frame with their priorities, e.g. screen
+ *    coverage x opacity. Requested resident bricks are kept, and at most MaxLoadNum of the
+ *    other requested bricks are loaded, in descending order of priority.
+ * -- A load takes a free slot, or evicts the least recently requested brick. Bricks requested
+ *    by the current frame are only evicted by a brick of higher priority, in ascending order
+ *    of priority.
+ */
+class VIS4EARTH_API FBrickResidency {
+  public:
+    static constexpr int32 InvalidSlot = -1;
+
+    struct Parameters {
+        FIntVector BrickNumber = FIntVector::ZeroValue;
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, SlotNum, 512)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, MaxLoadNum, 16)
+    };
+
+    struct Request {
+        int32 Brick;
+        float Priority;
+    };
+
+    struct Load {
+        int32 Brick;
+        int32 Slot;
+    };
+
+    FBrickResidency() = default;
+    FBrickResidency(const Parameters &Params)
+        : brickNum(Params.BrickNumber), maxLoadNum(std::max(Params.MaxLoadNum, 1)) {
+        pageTable.Init(InvalidSlot, static_cast<int64>(brickNum.X) * brickNum.Y * brickNum.Z);
+
+        auto slotNum = std::max(Params.SlotNum, 1);
+        slots.SetNum(slotNum);
+        freeSlots.Reserve(slotNum);
+        for (int32 s = slotNum - 1; s >= 0; --s)
+            freeSlots.Emplace(s);
+    }
+
+    // Returns the loads, whose bricks are to be written into their slots before the page
+    // table is used
+    TArray<Load> Update(TConstArrayView<Request> Requests) {
+        ++frame;
+
+        TArray<Request> misses;
+        for (auto &req : Requests) {
+            if (req.Brick < 0 || req.Brick >= pageTable.Num())
+                continue;
+            auto s = pageTable[req.Brick];
+            if (s == InvalidSlot) {
+                misses.Emplace(req);
+                continue;
+            }
+            auto &slot = slots[s];
+            slot.Priority = slot.LastFrame == frame ? std::max(slot.Priority, req.Priority)
+                                                    : req.Priority;
+            slot.LastFrame = frame;
+            unlink(s);
+            linkBack(s);
+        }
+
+        TArray<Load> ret;
+        if (misses.IsEmpty())
+            return ret;
+        misses.Sort([](const Request &A, const Request &B) { return A.Priority > B.Priority; });
+
+        // Bricks of the current frame in ascending order of priority, evicted at last
+        TArray<int32> currSlots;
+        int32 currIdx = 0;
+        auto isCurrCollected = false;
+
+        for (auto &miss : misses) {
+            if (ret.Num() >= maxLoadNum)
+                break;
+            if (pageTable[miss.Brick] != InvalidSlot)
+                continue; // requested twice
+
+            int32 s = InvalidSlot;
+            if (!freeSlots.IsEmpty())
+                s = freeSlots.Pop();
+            else if (lruHead != InvalidSlot && slots[lruHead].LastFrame != frame)
+                s = lruHead;
+            else {
+                if (!isCurrCollected) {
+                    for (int32 c = lruHead; c != InvalidSlot; c = slots[c].Next)
+                        currSlots.Emplace(c);
+                    currSlots.Sort([&](int32 A, int32 B) {
+                        return slots[A].Priority < slots[B].Priority;
+                    });
+                    isCurrCollected = true;
+                }
+                // Skips slots loaded by this update
+                while (currIdx < currSlots.Num() && slots[currSlots[currIdx]].LastFrame == frame &&
+                       slots[currSlots[currIdx]].IsLoadedNow)
+                    ++currIdx;
+                if (currIdx == currSlots.Num() ||
+                    slots[currSlots[currIdx]].Priority >= miss.Priority)
+                    break;
+                s = currSlots[currIdx++];
+            }
+
+            auto &slot = slots[s];
+            if (slot.Brick != InvalidSlot) {
+                pageTable[slot.Brick] = InvalidSlot;
+                unlink(s);
+                ++evictedNum;
+            }
+            slot.Brick = miss.Brick;
+            slot.Priority = miss.Priority;
+            slot.LastFrame = frame;
+            slot.IsLoadedNow = true;
+            pageTable[miss.Brick] = s;
+            linkBack(s);
+            ret.Emplace(Load{miss.Brick, s});
+        }
+
+        for (auto &load : ret)
+            slots[load.Slot].IsLoadedNow = false;
+        loadedNum += ret.Num();
+        return ret;
+    }
+
+    // Empties all slots, e.g. when the volume changes
+    void Reset() {
+        for (int32 s = lruHead; s != InvalidSlot;) {
+            auto next = slots[s].Next;
+            pageTable[slots[s].Brick] = InvalidSlot;
+            slots[s] = {};
+            freeSlots.Emplace(s);
+            s = next;
+        }
+        lruHead = lruTail = InvalidSlot;
+    }
+
+    bool IsValid() const { return !slots.IsEmpty(); }
+    const FIntVector &GetBrickNumber() const { return brickNum; }
+    int32 GetSlotNumber() const { return slots.Num(); }
+    int32 GetResidentNumber() const { return slots.Num() - freeSlots.Num(); }
+    int64 GetLoadedNumber() const { return loadedNum; }
+    int64 GetEvictedNumber() const { return evictedNum; }
+    int32 GetSlot(int32 Brick) const { return pageTable[Brick]; }
+    // Slot of each brick, or InvalidSlot if not resident
+    const TArray<int32> &GetPageTable() const { return pageTable; }
+
+  private:
+    struct Slot {
+        int32 Brick = InvalidSlot;
+        float Priority = 0.f;
+        uint64 LastFrame = 0;
+        bool IsLoadedNow = false;
+        // Neighbors in the list from the least to the most recently requested
+        int32 Prev = InvalidSlot;
+        int32 Next = InvalidSlot;
+    };
+
+    FIntVector brickNum = FIntVector::ZeroValue;
+    int32 maxLoadNum = 1;
+    uint64 frame = 0;
+    int64 loadedNum = 0;
+    int64 evictedNum = 0;
+    TArray<int32> pageTable;
+    TArray<Slot> slots;
+    TArray<int32> freeSlots;
+    int32 lruHead = InvalidSlot;
+    int32 lruTail = InvalidSlot;
+
+    void unlink(int32 S) {
+        auto &slot = slots[S];
+        (slot.Prev == InvalidSlot ? lruHead : slots[slot.Prev].Next) = slot.Next;
+        (slot.Next == InvalidSlot ? lruTail : slots[slot.Next].Prev) = slot.Prev;
+        slot.Prev = slot.Next = InvalidSlot;
+    }
+    void linkBack(int32 S) {
+        auto &slot = slots[S];
+        slot.Prev = lruTail;
+        slot.Next = InvalidSlot;
+        (lruTail == InvalidSlot ? lruHead : slots[lruTail].Next) = S;
+        lruTail = S;
+    }
+};
@@ -0,0 +1,224 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <cstdio>
+
+#include "Async/ParallelFor.h"
+#include "CoreMinimal.h"
+#include "HAL/FileManager.h"
+
+#include "Util.h"
+
+#include "MCSRenderer.h"
+
+/*
+ * Class: FContourExporter
+ * Function:
+ * -- Streams stitched contours of FMCSRenderer into a GeoJSON or a compact binary file.
+ * -- Heights are extracted in parallel batches of BatchSize, written in ascending order and
+ *    released right after. Memory is bounded by one batch plus the write buffer, no matter how
+ *    many heights and levels are exported.
+ * -- Vertices are transformed from [0,1]^3 into (longitude, latitude, height in meters) while
+ *    being written.
+ * -- GeoJSON is a FeatureCollection with one MultiLineString Feature per height and level,
+ *    whose properties are level, isoValue and height (index of the slice, -1 for a section).
+ * -- Binary is little-endian:
+ *    Header: "V4EC", uint32 Version, uint32 LevelNum, float IsoValues[LevelNum]
+ *    Then until EOF, per height and level:
+ *      int32 Height, uint32 Level, uint32 PolylineNum,
+ *      { uint32 VertNum, float (Longitude, Latitude, Height)[VertNum] }[PolylineNum]
+ *    Closed polylines repeat their first vertex at the end.
+ */
+class VIS4EARTH_API FContourExporter {
+  public:
+    static constexpr uint32 BinaryVersion = 1;
+
+    struct Parameters {
+        FString FilePath;
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(EMCSExportFormat, Format, EMCSExportFormat::GeoJSON)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, BatchSize, 8)
+        // Bytes buffered before being written into the file
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, BufferSize, 1 << 20)
+        const FMCSRenderer::MCSParameters &MCSParams;
+        const FGeoRenderer::GeoParameters &GeoParams;
+    };
+
+    static TOptional<FString> Exec(const Parameters &Params) {
+        auto &mcsParams = Params.MCSParams;
+        if (!mcsParams.VolumeComponent.IsValid() || !mcsParams.VolumeComponent->VolumeTexture)
+            return FString("Invalid VolumeComponent.");
+
+        TUniquePtr<FArchive> ar(IFileManager::Get().CreateFileWriter(*Params.FilePath));
+        if (!ar)
+            return FString::Format(TEXT("Invalid FilePath {0}."), {Params.FilePath});
+        Writer writer(std::move(ar), Params.BufferSize);
+
+        auto isoValues = mcsParams.GetIsoValues();
+        auto isGeoJSON = Params.Format == EMCSExportFormat::GeoJSON;
+        if (isGeoJSON)
+            writer.Print("{\"type\":\"FeatureCollection\",\"features\":[");
+        else {
+            writer.Write("V4EC", 4);
+            writer.Write(BinaryVersion);
+            writer.Write(static_cast<uint32>(isoValues.Num()));
+            writer.Write(isoValues.GetData(), sizeof(float) * isoValues.Num());
+        }
+
+        auto &geoParams = Params.GeoParams;
+        auto lonExt = geoParams.LongtitudeRange[1] - geoParams.LongtitudeRange[0];
+        auto latExt = geoParams.LatitudeRange[1] - geoParams.LatitudeRange[0];
+        auto hExt = geoParams.HeightRange[1] - geoParams.HeightRange[0];
+        auto toGeo = [&](const FVector3f &pos) {
+            return FVector(geoParams.LongtitudeRange[0] + pos.X * lonExt,
+                           geoParams.LatitudeRange[0] + pos.Y * latExt,
+                           geoParams.HeightRange[0] + pos.Z * hExt);
+        };
+
+        auto isFirstFeature = true;
+        // Polylines of a level, each as [start, end) of SliceContour::Vertices, and 1 if closed
+        TArray<TArray<FIntVector>> lvlPolylines;
+        lvlPolylines.SetNum(isoValues.Num());
+        auto writeSlice = [&](int32 height, const FMCSRenderer::SliceContour &slice) {
+            for (auto &polylines : lvlPolylines)
+                polylines.Reset();
+            // A line not starting at the end of the previous one starts a new polyline, and a
+            // line going back to its start closes it
+            FIntVector *polyline = nullptr;
+            for (int32 i = 0; i < slice.Indices.Num(); i += 2) {
+                int32 start = slice.Indices[i];
+                int32 end = slice.Indices[i + 1];
+                if (polyline && polyline->Y == start + 1 && end == polyline->X) {
+                    polyline->Z = 1;
+                    continue;
+                }
+                if (!polyline || polyline->Y != start + 1)
+                    polyline = &lvlPolylines[static_cast<int32>(slice.Vertices[start].Level)]
+                                    .Emplace_GetRef(start, start + 1, 0);
+                polyline->Y = end + 1;
+            }
+            // Closed polylines are written with their first vertex repeated at the end
+            auto getVertex = [&](const FIntVector &polyline, int32 i) -> const auto & {
+                return slice.Vertices[polyline.X + i % (polyline.Y - polyline.X)];
+            };
+            auto getVertexNum = [&](const FIntVector &polyline) {
+                return polyline.Y - polyline.X + polyline.Z;
+            };
+
+            for (int32 lvl = 0; lvl < isoValues.Num(); ++lvl) {
+                auto &polylines = lvlPolylines[lvl];
+                if (polylines.IsEmpty())
+                    continue;
+
+                if (isGeoJSON) {
+                    writer.Print(isFirstFeature ? "\n" : ",\n");
+                    writer.Print("{\"type\":\"Feature\",\"properties\":{\"level\":%d,"
+                                 "\"isoValue\":%.9g,\"height\":%d},\"geometry\":{\"type\":"
+                                 "\"MultiLineString\",\"coordinates\":[",
+                                 lvl, isoValues[lvl], height);
+                    for (int32 pl = 0; pl < polylines.Num(); ++pl) {
+                        writer.Print(pl == 0 ? "[" : ",[");
+                        for (int32 v = 0; v < getVertexNum(polylines[pl]); ++v) {
+                            auto geo = toGeo(getVertex(polylines[pl], v).Position);
+                            writer.Print(v == 0 ? "[%.7f,%.7f,%.3f]" : ",[%.7f,%.7f,%.3f]",
+                                         geo.X, geo.Y, geo.Z);
+                        }
+                        writer.Print("]");
+                    }
+                    writer.Print("]}}");
+                } else {
+                    writer.Write(height);
+                    writer.Write(static_cast<uint32>(lvl));
+                    writer.Write(static_cast<uint32>(polylines.Num()));
+                    for (auto &polyline : polylines) {
+                        writer.Write(static_cast<uint32>(getVertexNum(polyline)));
+                        for (int32 v = 0; v < getVertexNum(polyline); ++v) {
+                            auto geo = FVector3f(toGeo(getVertex(polyline, v).Position));
+                            writer.Write(geo.X);
+                            writer.Write(geo.Y);
+                            writer.Write(geo.Z);
+                        }
+                    }
+                }
+                isFirstFeature = false;
+            }
+        };
+
+        TArray<int32> heights;
+        if (!mcsParams.SectionPath.IsEmpty())
+            heights.Emplace(-1);
+        else
+            for (int32 z = mcsParams.HeightRange[0]; z <= mcsParams.HeightRange[1]; ++z)
+                heights.Emplace(z);
+
+        auto batchSize = std::max(Params.BatchSize, 1);
+        TArray<FMCSRenderer::SliceContour> batch;
+        for (int32 b = 0; b < heights.Num(); b += batchSize) {
+            batch.SetNum(std::min(batchSize, heights.Num() - b));
+            ParallelFor(batch.Num(), [&](int32 i) {
+                batch[i] = FMCSRenderer::ExtractSliceContour(mcsParams, heights[b + i]);
+            });
+            for (int32 i = 0; i < batch.Num(); ++i) {
+                writeSlice(heights[b + i], batch[i]);
+                batch[i] = {};
+            }
+        }
+
+        if (isGeoJSON)
+            writer.Print("\n]}\n");
+        if (!writer.Close())
+            return FString::Format(TEXT("Failed to write FilePath {0}."), {Params.FilePath});
+        return {};
+    }
+
+  private:
+    // Buffers small writes and hands them to the archive in chunks of BufferSize
+    class Writer {
+      public:
+        Writer(TUniquePtr<FArchive> Ar, int32 BufferSize)
+            : ar(std::move(Ar)), bufSz(std::max(BufferSize, 4096)) {
+            buf.Reserve(bufSz);
+        }
+        ~Writer() { Close(); }
+
+        void Write(const void *Dat, int64 Size) {
+            if (buf.Num() + Size > bufSz)
+                flush();
+            if (Size > bufSz)
+                ar->Serialize(const_cast<void *>(Dat), Size);
+            else
+                buf.Append(static_cast<const uint8 *>(Dat), Size);
+        }
+        template <typename T> void Write(T Val) {
+            static_assert(std::is_arithmetic_v<T>);
+            Write(&Val, sizeof(T));
+        }
+        template <typename... ArgTys> void Print(const ANSICHAR *Fmt, ArgTys... Args) {
+            ANSICHAR str[256];
+            auto len = std::snprintf(str, sizeof(str), Fmt, Args...);
+            Write(str, std::min(len, static_cast<int>(sizeof(str)) - 1));
+        }
+
+        // Returns whether everything is written
+        bool Close() {
+            if (!ar)
+                return true;
+            flush();
+            auto succeeded = ar->Close() && !ar->IsError();
+            ar.Reset();
+            return succeeded;
+        }
+
+      private:
+        TUniquePtr<FArchive> ar;
+        TArray<uint8> buf;
+        int64 bufSz;
+
+        void flush() {
+            if (buf.IsEmpty())
+                return;
+            ar->Serialize(buf.GetData(), buf.Num());
+            buf.Reset();
+        }
+    };
+};
@@ -0,0 +1,185 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <limits>
+
+#include "CoreMinimal.h"
+
+#include "Util.h"
+
+#include "MCSRenderer.h"
+
+/*
+ * Class: FContourStitcher
+ * Function:
+ * -- Assembles the line segments of one marching-square level into polylines.
+ * -- Every vertex lies on a cell edge shared by at most 2 cells, thus has at most 2 neighbours.
+ *    Open polylines start from vertices with only 1 neighbour, and the remaining vertices form
+ *    closed polylines. Vertices of closed polylines are not repeated, so their closing line
+ *    runs from the last vertex back to the first.
+ * -- Simplifies each polyline with Douglas-Peucker when SimplifyTolerance > 0.
+ * -- Fills ArcLength of each vertex with the distance along its polyline in voxels.
+ */
+class VIS4EARTH_API FContourStitcher {
+  public:
+    using VertexAttr = FMCSRenderer::VertexAttr;
+
+    struct Parameters {
+        // Maximum deviation in voxels of a simplified polyline from the original one
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, SimplifyTolerance, 0.f)
+        FIntVector Dimension = FIntVector::ZeroValue;
+    };
+
+    struct Polylines {
+        TArray<VertexAttr> Vertices;
+        // Polyline i spans Vertices[Starts[i], Starts[i + 1])
+        TArray<int32> Starts;
+        TArray<bool> ClosedFlags;
+
+        int32 GetPolylineNum() const { return Starts.IsEmpty() ? 0 : Starts.Num() - 1; }
+        bool IsClosed(int32 Idx) const { return ClosedFlags[Idx]; }
+        // Lines drawing all polylines, i.e. N - 1 per open and N per closed polyline of N
+        // vertices
+        int32 GetLineNum() const {
+            int32 num = 0;
+            for (int32 pl = 0; pl < GetPolylineNum(); ++pl)
+                num += Starts[pl + 1] - Starts[pl] - (ClosedFlags[pl] ? 0 : 1);
+            return num;
+        }
+    };
+
+    // Vertices in [0,1]^3 and SegIndices with 2 indices per line segment as generated by
+    // FMCSRenderer::marchingSquare.
+    static Polylines Exec(const Parameters &Params, const TArray<VertexAttr> &Vertices,
+                          const TArray<uint32> &SegIndices) {
+        constexpr auto none = std::numeric_limits<uint32>::max();
+
+        TArray<FUintVector2> nbrs;
+        nbrs.Init(FUintVector2(none, none), Vertices.Num());
+        auto link = [&](uint32 v, uint32 nbr) {
+            auto &n = nbrs[v];
+            if (n.X == none)
+                n.X = nbr;
+            else if (n.Y == none)
+                n.Y = nbr;
+        };
+        for (int32 i = 0; i + 1 < SegIndices.Num(); i += 2) {
+            if (SegIndices[i] == SegIndices[i + 1])
+                continue;
+            link(SegIndices[i], SegIndices[i + 1]);
+            link(SegIndices[i + 1], SegIndices[i]);
+        }
+
+        FVector3f voxPerVol(Params.Dimension);
+        auto toVoxel = [&](const VertexAttr &vert) { return vert.Position * voxPerVol; };
+
+        Polylines ret;
+        ret.Vertices.Reserve(Vertices.Num());
+        ret.Starts.Emplace(0);
+
+        TArray<bool> visited;
+        visited.Init(false, Vertices.Num());
+        TArray<uint32> chain;
+        auto walk = [&](uint32 start) {
+            chain.Reset();
+            auto prev = none;
+            auto curr = start;
+            while (curr != none && !visited[curr]) {
+                visited[curr] = true;
+                chain.Emplace(curr);
+
+                auto next = nbrs[curr].X != prev ? nbrs[curr].X : nbrs[curr].Y;
+                prev = curr;
+                curr = next;
+            }
+            auto isClosed = curr == start && chain.Num() > 2;
+            if (chain.Num() < 2)
+                return;
+
+            // Closed polylines are simplified with both ends at the start, which is then welded
+            // back. Those simplified below a triangle are within tolerance of a point.
+            if (isClosed)
+                chain.Emplace(start);
+            simplify(Params.SimplifyTolerance, chain, Vertices, toVoxel);
+            if (isClosed) {
+                if (chain.Num() < 4)
+                    return;
+                chain.Pop();
+            }
+
+            float arcLen = 0.f;
+            for (int32 i = 0; i < chain.Num(); ++i) {
+                auto &vert = ret.Vertices.Emplace_GetRef(Vertices[chain[i]]);
+                if (i != 0)
+                    arcLen += FVector3f::Distance(toVoxel(Vertices[chain[i - 1]]), toVoxel(vert));
+                vert.ArcLength = arcLen;
+            }
+            ret.Starts.Emplace(ret.Vertices.Num());
+            ret.ClosedFlags.Emplace(isClosed);
+        };
+
+        for (int32 v = 0; v < Vertices.Num(); ++v)
+            if (!visited[v] && (nbrs[v].X == none) != (nbrs[v].Y == none))
+                walk(v);
+        for (int32 v = 0; v < Vertices.Num(); ++v)
+            if (!visited[v] && nbrs[v].X != none)
+                walk(v);
+
+        if (ret.Starts.Num() == 1)
+            ret.Starts.Empty();
+        return ret;
+    }
+
+  private:
+    // Douglas-Peucker on Chain in place, keeping both ends. Uses an explicit stack, since
+    // contours of large slices can be too long for recursion.
+    template <typename ToVoxelFuncTy>
+    static void simplify(float Tolerance, TArray<uint32> &Chain, const TArray<VertexAttr> &Vertices,
+                         const ToVoxelFuncTy &ToVoxel) {
+        if (Tolerance <= 0.f || Chain.Num() <= 2)
+            return;
+
+        auto tolSqr = Tolerance * Tolerance;
+        auto distSqrToSeg = [&](const FVector3f &p, const FVector3f &a, const FVector3f &b) {
+            auto ab = b - a;
+            auto lenSqr = ab.SizeSquared();
+            auto t = lenSqr == 0.f ? 0.f : FMath::Clamp((p - a).Dot(ab) / lenSqr, 0.f, 1.f);
+            return (a + t * ab - p).SizeSquared();
+        };
+
+        TArray<bool> keeps;
+        keeps.Init(false, Chain.Num());
+        keeps[0] = keeps.Last() = true;
+
+        TArray<FIntPoint> stk;
+        stk.Emplace(0, Chain.Num() - 1);
+        while (!stk.IsEmpty()) {
+            auto seg = stk.Pop();
+            auto lo = seg.X, hi = seg.Y;
+            auto a = ToVoxel(Vertices[Chain[lo]]);
+            auto b = ToVoxel(Vertices[Chain[hi]]);
+
+            auto maxDistSqr = 0.f;
+            auto maxIdx = -1;
+            for (int32 i = lo + 1; i < hi; ++i)
+                if (auto distSqr = distSqrToSeg(ToVoxel(Vertices[Chain[i]]), a, b);
+                    distSqr > maxDistSqr) {
+                    maxDistSqr = distSqr;
+                    maxIdx = i;
+                }
+            if (maxIdx == -1 || maxDistSqr <= tolSqr)
+                continue;
+
+            keeps[maxIdx] = true;
+            stk.Emplace(lo, maxIdx);
+            stk.Emplace(maxIdx, hi);
+        }
+
+        int32 num = 0;
+        for (int32 i = 0; i < Chain.Num(); ++i)
+            if (keeps[i])
+                Chain[num++] = Chain[i];
+        Chain.SetNum(num);
+    }
+};
@@ -5,11 +5,13 @@
 #include "Components/CheckBox.h"
 #include "Components/EditableText.h"
 #include "Components/NamedSlot.h"
+#include "DesktopPlatformModule.h"
 #include "EngineModule.h"
 #include "ShaderParameterStruct.h"
 
 #include "Runtime/Renderer/Private/SceneRendering.h"
 
+#include "DVRRayCasterCPU.h"
 #include "TFPreIntegrator.h"
 #include "Util.h"
 
@@ -18,11 +20,14 @@ ADVRActor::ADVRActor() {
     RootComponent = GeoComponent;
 
     VolumeComponent = CreateDefaultSubobject<UVolumeDataComponent>(TEXT("VolumeData"));
+    // Read by the CPU ray caster
+    VolumeComponent->SetKeepVolumeInCPU(true);
 
     UIComponent = CreateDefaultSubobject<UWidgetComponent>(TEXT("UI"));
     UIComponent->AttachToComponent(RootComponent, FAttachmentTransformRules::KeepRelativeTransform);
 
     generatePreIntegratedTF();
+    generateTF2D();
     setupRenderer();
     setupSignalsSlots();
 }
@@ -63,14 +68,28 @@ void ADVRActor::BeginPlay() {
 
 void ADVRActor::setupSignalsSlots() {
     GeoComponent->OnGeographicsChanged.AddLambda([this](UGeoComponent *) { setupRenderer(); });
-    VolumeComponent->OnVolumeDataChanged.AddLambda(
-        [this](UVolumeDataComponent *) { setupRenderer(); });
+    VolumeComponent->OnVolumeDataChanged.AddLambda([this](UVolumeDataComponent *) {
+        if (renderer.IsValid())
+            renderer->InvalidateVolumeOccupancy();
+        updateJointHistogramTexture();
+        setupRenderer();
+    });
     VolumeComponent->OnTransferFunctionDataChanged.AddLambda([this](UVolumeDataComponent *) {
         generatePreIntegratedTF();
         setupRenderer();
     });
 }
 
+void ADVRActor::setupVariableSignalsSlots(UVolumeDataComponent *VolComp) {
+    VolComp->OnVolumeDataChanged.AddLambda([this](UVolumeDataComponent *) {
+        if (renderer.IsValid())
+            renderer->InvalidateVolumeOccupancy();
+        setupRenderer();
+    });
+    VolComp->OnTransferFunctionDataChanged.AddLambda(
+        [this](UVolumeDataComponent *) { setupRenderer(); });
+}
+
 void ADVRActor::setupRenderer() {
     if (!renderer.IsValid()) {
         renderer = MakeShared<FDVRRenderer>();
@@ -81,16 +100,95 @@ void ADVRActor::setupRenderer() {
                                          .LatitudeRange = GeoComponent->LatitudeRange,
                                          .HeightRange = GeoComponent->HeightRange,
                                          .GeoRef = GeoComponent->GeoRef.Get()});
+    if (CPUDownsample < 1)
+        CPUDownsample = 1;
+    if (ShadingShininess < 1.f)
+        ShadingShininess = 1.f;
+    if (OccupancyBrickSize < 1)
+        OccupancyBrickSize = 1;
+    if (MaxStepScale < 1)
+        MaxStepScale = 1;
+    if (MotionDownsample < 1)
+        MotionDownsample = 1;
+    if (MotionStepScale < 1.f)
+        MotionStepScale = 1.f;
+    if (RefinementFrameNum < 1)
+        RefinementFrameNum = 1;
+    if (PoolBrickSize < 1)
+        PoolBrickSize = 1;
+    if (PoolSlotNumPerAxis < 1)
+        PoolSlotNumPerAxis = 1;
+    if (MaxBrickLoadNum < 1)
+        MaxBrickLoadNum = 1;
+    if (IsoBisectionNum < 0)
+        IsoBisectionNum = 0;
+
+    auto usePreIntTF = isPreIntegratedTFUsed();
+    auto tfTex = usePreIntTF ? PreIntegratedTF.Get()
+                 : VolumeComponent->TransferFunctionTexture
+                     ? VolumeComponent->TransferFunctionTexture.Get()
+                     : VolumeComponent->DefaultTransferFunctionTexture.Get();
+    TSharedPtr<const TArray<FLinearColor>> tfCPUDat;
+    auto use2DTF = Use2DTF && tf2DCPUData.IsValid();
+    if (use2DTF)
+        tfCPUDat = tf2DCPUData;
+    else if (UseCPU || UseBrickPool)
+        tfCPUDat =
+            MakeShared<TArray<FLinearColor>>(FDVRRayCasterCPU::ReadTransferFunction(tfTex));
+
+    // Transfer functions of extra variables are 1D, and pre-integrated along with the volume's
+    TArray<FDVRRenderer::VariableParameters> extraVars;
+    if (UseCPU)
+        for (auto &volComp : ExtraVolumeComponents) {
+            if (!volComp)
+                continue;
+            auto varTF = FDVRRayCasterCPU::ReadTransferFunction(
+                volComp->TransferFunctionTexture ? volComp->TransferFunctionTexture.Get()
+                                                 : volComp->DefaultTransferFunctionTexture.Get());
+            extraVars.Emplace(FDVRRenderer::VariableParameters{
+                .VolumeCPUData = volComp->GetVolumeCPUDataSnapshot(),
+                .Dimension = volComp->GetVoxelPerVolume(),
+                .VoxelType = volComp->GetVolumeVoxelType(),
+                .TransferFunctionCPUData = MakeShared<TArray<FLinearColor>>(
+                    usePreIntTF ? FTFPreIntegrator::ExecRows(varTF) : std::move(varTF))});
+        }
+
     renderer->SetRenderParameters(
-        {.UsePreIntegratedTF = UsePreIntegratedTF,
+        {.UsePreIntegratedTF = usePreIntTF,
+         .Use2DTF = use2DTF,
          .MaxStepCount = MaxStepCount,
          .Step = Step,
          .RelativeLightness = RelativeLightness,
+         .EarlyTerminationAlpha = EarlyTerminationAlpha,
+         .UseIsosurface = UseIsosurface,
+         .IsoValue = IsoValue,
+         .IsoBisectionNum = IsoBisectionNum,
+         .UseShading = UseShading,
+         .ShadingAmbient = ShadingAmbient,
+         .ShadingDiffuse = ShadingDiffuse,
+         .ShadingSpecular = ShadingSpecular,
+         .ShadingShininess = ShadingShininess,
+         .UseCPU = UseCPU,
+         .CPUDownsample = CPUDownsample,
+         .OccupancyBrickSize = OccupancyBrickSize,
+         .MaxStepScale = MaxStepScale,
+         .AdaptiveStepTolerance = AdaptiveStepTolerance,
+         .UseProgressive = UseProgressive,
+         .MotionDownsample = MotionDownsample,
+         .MotionStepScale = MotionStepScale,
+         .RefinementFrameNum = RefinementFrameNum,
+         .UseBrickPool = UseBrickPool,
+         .PoolBrickSize = PoolBrickSize,
+         .PoolSlotNumPerAxis = PoolSlotNumPerAxis,
+         .MaxBrickLoadNum = MaxBrickLoadNum,
          .VolumeTexture = VolumeComponent->VolumeTexture.Get(),
-         .TransferFunctionTexture = UsePreIntegratedTF ? PreIntegratedTF.Get()
-                                    : VolumeComponent->TransferFunctionTexture
-                                        ? VolumeComponent->TransferFunctionTexture.Get()
-                                        : VolumeComponent->DefaultTransferFunctionTexture.Get()});
+         .TransferFunctionTexture = tfTex,
+         .VolumeCPUData = VolumeComponent->GetVolumeCPUDataSnapshot(),
+         .Gradients = VolumeComponent->GetGradientVolumeSnapshot(),
+         .Dimension = VolumeComponent->GetVoxelPerVolume(),
+         .VoxelType = VolumeComponent->GetVolumeVoxelType(),
+         .TransferFunctionCPUData = tfCPUDat,
+         .ExtraVariables = extraVars});
 }
 
 void ADVRActor::destroyRenderer() {
@@ -134,3 +232,108 @@ void ADVRActor::generatePreIntegratedTF() {
 
     setupRenderer();
 }
+
+void ADVRActor::generateTF2D() {
+    if (!Use2DTF) {
+        TransferFunction2DTexture = nullptr;
+        tf2DCPUData.Reset();
+        setupRenderer();
+        return;
+    }
+
+    auto tfDat = TransferFunction2DData::Rasterize(makeTF2DWidgets());
+    TransferFunction2DTexture = TransferFunction2DData::FromFlatArrayToTexture(tfDat);
+    tf2DCPUData = MakeShared<TArray<FLinearColor>>(
+        isPreIntegratedTFUsed() ? FTFPreIntegrator::ExecRows(tfDat) : std::move(tfDat));
+
+    setupRenderer();
+}
+
+TArray<TransferFunction2DData::Widget> ADVRActor::makeTF2DWidgets() const {
+    TArray<TransferFunction2DData::Widget> ret;
+    ret.Reserve(TransferFunction2DWidgets.Num());
+    for (auto &widget : TransferFunction2DWidgets)
+        ret.Emplace(TransferFunction2DData::Widget{.Type = widget.Type,
+                                                   .Center = widget.Center,
+                                                   .Extent = widget.Extent,
+                                                   .Color = widget.Color});
+    return ret;
+}
+
+void ADVRActor::updateJointHistogramTexture() {
+    JointHistogramTexture = Use2DTF ? VolumeComponent->GetJointHistogram().ToTexture() : nullptr;
+}
+
+void ADVRActor::LoadTF2D() {
+    FJsonSerializableArray files;
+    FDesktopPlatformModule::Get()->OpenFileDialog(
+        FSlateApplication::Get().FindBestParentWindowHandleForDialogs(nullptr),
+        TEXT("Select a 2D Transfer Function file"), FPaths::GetProjectFilePath(), TEXT(""),
+        TEXT("TF|*.txt"), EFileDialogFlags::None, files);
+    if (files.IsEmpty())
+        return;
+
+    auto widgets = TransferFunction2DData::LoadFromFile({.FilePath = files[0]});
+    if (widgets.IsType<FString>()) {
+        UVolumeDataComponent::ProcessError(widgets.Get<FString>());
+        return;
+    }
+
+    TransferFunction2DWidgets.Empty();
+    for (auto &widget : widgets.Get<TArray<TransferFunction2DData::Widget>>()) {
+        auto &dst = TransferFunction2DWidgets.Emplace_GetRef();
+        dst.Type = widget.Type;
+        dst.Center = widget.Center;
+        dst.Extent = widget.Extent;
+        dst.Color = widget.Color;
+    }
+    generateTF2D();
+}
+
+void ADVRActor::SaveTF2D() {
+    FJsonSerializableArray files;
+    FDesktopPlatformModule::Get()->SaveFileDialog(
+        FSlateApplication::Get().FindBestParentWindowHandleForDialogs(nullptr),
+        TEXT("Save the 2D Transfer Function"), FPaths::GetProjectFilePath(), TEXT("xx_tf2d.txt"),
+        TEXT("TF|*.txt"), EFileDialogFlags::None, files);
+    if (files.IsEmpty())
+        return;
+
+    auto errMsg = TransferFunction2DData::SaveToFile(makeTF2DWidgets(), FFilePath(files[0]));
+    if (errMsg.IsSet())
+        UVolumeDataComponent::ProcessError(errMsg.GetValue());
+}
+
+void ADVRActor::AddVariable() {
+    if (ExtraVolumeComponents.Num() >= FDVRRayCasterCPU::MaxExtraVariableNum) {
+        UVolumeDataComponent::ProcessError(
+            FString::Format(TEXT("At most {0} extra variables are supported."),
+                            {FDVRRayCasterCPU::MaxExtraVariableNum}));
+        return;
+    }
+
+    auto volComp = NewObject<UVolumeDataComponent>(
+        this, MakeUniqueObjectName(this, UVolumeDataComponent::StaticClass(),
+                                   TEXT("ExtraVolumeData")));
+    // Read by the CPU ray caster
+    volComp->SetKeepVolumeInCPU(true);
+    AddInstanceComponent(volComp);
+    volComp->RegisterComponent();
+    ExtraVolumeComponents.Emplace(volComp);
+    setupVariableSignalsSlots(volComp);
+
+    setupRenderer();
+}
+
+void ADVRActor::RemoveVariable() {
+    if (ExtraVolumeComponents.IsEmpty())
+        return;
+
+    auto volComp = ExtraVolumeComponents.Pop();
+    if (volComp) {
+        RemoveInstanceComponent(volComp);
+        volComp->DestroyComponent();
+    }
+
+    setupRenderer();
+}
@@ -0,0 +1,816 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <algorithm>
+
+#include "Async/ParallelFor.h"
+#include "CoreMinimal.h"
+
+#include "Util.h"
+
+#include "BrickResidency.h"
+#include "DVRRenderer.h"
+#include "Data.h"
+#include "ShellSectorIntersector.h"
+#include "VolumeOccupancy.h"
+
+/*
+ * Class: FDVRRayCasterCPU
+ * Function:
+ * -- Reference Direct Volume Rendering on the CPU, as a fallback of FDVRRenderer and for
+ *    rendering images headlessly.
+ * -- The volume fills the spherical shell sector spanned by the longitude, latitude and height
+ *    ranges of a spherical Earth. X, Y and Z of the volume go along longitude, latitude and
+ *    height respectively, and are sampled as a texture with clamped addressing.
+ * -- Each ray is intersected exactly with the sector and occluded by the Earth in double, then
+ *    marched in float from its first entry to its last exit, leaping over the gaps between.
+ * -- The image is split into tiles of TileSize rendered in parallel. Rays of a tile are
+ *    marched in packets of 2x2, whose positions are advanced and transformed into
+ *    (longitude, latitude, height) in SIMD registers. The rest, i.e. fetches of voxels,
+ *    gradients and transfer functions, leaps and compositing, runs per lane in scalar code.
+ * -- With an Occupancy, a sample in an empty brick leaps over all the following samples
+ *    closer to it than the brick's faces, which are spheres, cones and planes in the Earth.
+ *    In other bricks, the step is scaled up to MaxStepScale by powers of 2 as long as
+ *    StepScale x min(max opacity, opacity variation) of the brick stays under
+ *    AdaptiveStepTolerance, without leaving the brick, and opacities are corrected for it.
+ *    Samples always stay on the lattice of Step, so that coarse and fine rays agree.
+ *    Opacities are corrected from slabs of OpacityReferenceStep to the distance actually
+ *    marched, so that a Step coarsened while the camera moves keeps the same extinction.
+ *    Rays stop once their opacity reaches EarlyTerminationAlpha.
+ * -- With ResidentBricks, only the bricks resident in a brick pool are marched, as the shader
+ *    path would see them while they stream in.
+ * -- With UseShading and Gradients, colors of samples are lit by Blinn-Phong under a headlight.
+ *    Gradients are interpolated in voxels, then scaled into meters along the east, north and
+ *    up directions of the sample, and lit from both sides.
+ * -- With Use2DTF, the transfer function is also indexed by the gradient magnitude of samples
+ *    relative to GradientVolume::MaxMagnitude, and interpolated between its rows.
+ * -- ExtraVariables are co-registered volumes marched along with the volume in the same pass.
+ *    Each sample classifies every variable by its own transfer function, and blends them into
+ *    the average color weighted by opacities and an opacity of 1 - prod(1 - alpha_i), before
+ *    compositing once. Bricks are empty if empty in all variables, and their opacity error
+ *    estimates add up. Shading and 2D transfer functions apply to the volume only.
+ * -- With UseIsosurface, each ray stops at the first pair of consecutive samples on opposite
+ *    sides of IsoValue. The crossing between them is refined by IsoBisectionNum bisections
+ *    and a final linear interpolation, then colored opaquely by the transfer function at
+ *    IsoValue and lit by Gradients if any. Bricks whose scalars all lie on one side are leapt
+ *    over, keeping that side for the next sample. ExtraVariables are ignored.
+ */
+class VIS4EARTH_API FDVRRayCasterCPU {
+  public:
+    static constexpr double EarthRadius = FShellSectorIntersector::EarthRadius;
+    static constexpr int32 MaxExtraVariableNum = 3;
+
+    // A volume co-registered with the rendered one, i.e. of the same Dimension and voxel type
+    struct Variable {
+        const uint8 *VolumeData = nullptr;
+        // Laid out as Parameters::TransferFunction without the rows of Use2DTF
+        const TArray<FLinearColor> *TransferFunction = nullptr;
+        // Built from VolumeData and updated with TransferFunction, or nullptr
+        const FVolumeOccupancy *Occupancy = nullptr;
+    };
+
+    struct Parameters {
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UsePreIntegratedTF, false)
+        // 2D transfer functions require Gradients
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, Use2DTF, false)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, MaxStepCount,
+                                         FDVRRenderer::RenderParameters::DefMaxStepCount)
+        // Distance between samples in meters
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, Step, FDVRRenderer::RenderParameters::DefStep)
+        // Distance for which opacities of the transfer function are defined, Step if not
+        // positive. Coarser steps than it are corrected to keep the same extinction.
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, OpacityReferenceStep, 0.f)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, RelativeLightness, 1.f)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, TileSize, 16)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, EarlyTerminationAlpha,
+                                         FDVRRenderer::RenderParameters::DefEarlyTerminationAlpha)
+        // Isosurfaces require a transfer function not pre-integrated. IsoValue is in voxel
+        // values.
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UseIsosurface, false)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, IsoValue,
+                                         FDVRRenderer::RenderParameters::DefIsoValue)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, IsoBisectionNum,
+                                         FDVRRenderer::RenderParameters::DefIsoBisectionNum)
+        // Adaptive stepping requires an Occupancy. 1 marches with the fixed Step.
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, MaxStepScale,
+                                         FDVRRenderer::RenderParameters::DefMaxStepScale)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, AdaptiveStepTolerance,
+                                         FDVRRenderer::RenderParameters::DefAdaptiveStepTolerance)
+        // Fills Image::StepCounts
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, RecordStepCounts, false)
+        // Fills Image::Depths with UseIsosurface
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, RecordDepths, false)
+        // Shading requires Gradients
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UseShading, false)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, Ambient,
+                                         FDVRRenderer::RenderParameters::DefShadingAmbient)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, Diffuse,
+                                         FDVRRenderer::RenderParameters::DefShadingDiffuse)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, Specular,
+                                         FDVRRenderer::RenderParameters::DefShadingSpecular)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, Shininess,
+                                         FDVRRenderer::RenderParameters::DefShadingShininess)
+        FIntPoint RenderSize = FIntPoint::ZeroValue;
+        // Offsets of rays in pixels and of first samples in steps, jittered for accumulation
+        FVector2f PixelJitter = FVector2f::ZeroVector;
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, StepJitter, 0.f)
+        FVector2d LongtitudeRange = FGeoRenderer::GeoParameters::DefLongtitudeRange;
+        FVector2d LatitudeRange = FGeoRenderer::GeoParameters::DefLatitudeRange;
+        FVector2d HeightRange = FGeoRenderer::GeoParameters::DefHeightRange;
+        // Rows 0, 1 and 2 are the X, Y and Z axes of the eye and the origin is the eye, all in
+        // Earth-Centered Earth-Fixed meters
+        FMatrix EyeToEarth = FMatrix::Identity;
+        FMatrix InvProjection = FMatrix::Identity;
+        FIntVector Dimension = FIntVector::ZeroValue;
+        // Resolution entries, or Resolution x Resolution entries indexed by
+        // [ScalarFront * Resolution + ScalarBack] if UsePreIntegratedTF. If Use2DTF, there are
+        // TransferFunction2DData::GradientResolution rows of them, one after another.
+        const TArray<FLinearColor> &TransferFunction;
+        // Built from the same volume and updated with the same transfer function, or nullptr
+        const FVolumeOccupancy *Occupancy = nullptr;
+        // Slot of each brick of Occupancy as FBrickResidency::GetPageTable(), or nullptr.
+        // Bricks not resident are leapt over as empty ones. Ignored without Occupancy.
+        const TArray<int32> *ResidentBricks = nullptr;
+        // Of the same Dimension, or nullptr
+        const GradientVolume *Gradients = nullptr;
+        // At most MaxExtraVariableNum. Occupancy is used only if every variable has one of
+        // the same bricks.
+        TConstArrayView<Variable> ExtraVariables;
+    };
+
+    struct Image {
+        FIntPoint Size = FIntPoint::ZeroValue;
+        // Premultiplied RGBA, row by row from the top
+        TArray<FLinearColor> Pixels;
+        // Iterations, i.e. samples and leaps, marched by each pixel if RecordStepCounts
+        TArray<int32> StepCounts;
+        // Distances in meters from the eye to the isosurface along each pixel's ray, or -1
+        // where missed, if RecordDepths
+        TArray<double> Depths;
+    };
+
+    template <SupportedVoxelType T> static Image Exec(const Parameters &Params, const T *VolDat) {
+        Image ret;
+        auto &dim = Params.Dimension;
+        auto tfRes = TransferFunctionData::Resolution;
+        if (Params.RenderSize.X <= 0 || Params.RenderSize.Y <= 0 || dim.X <= 0 || dim.Y <= 0 ||
+            dim.Z <= 0 || Params.Step <= 0.f ||
+            Params.TransferFunction.Num() !=
+                (Params.UsePreIntegratedTF ? tfRes * tfRes : tfRes) *
+                    (Params.Use2DTF ? TransferFunction2DData::GradientResolution : 1))
+            return ret;
+        if (Params.Use2DTF && !(Params.Gradients && Params.Gradients->IsValid() &&
+                                Params.Gradients->Dimension == dim))
+            return ret;
+        if (Params.UseIsosurface && Params.UsePreIntegratedTF)
+            return ret;
+        if (Params.ExtraVariables.Num() > MaxExtraVariableNum)
+            return ret;
+        for (auto &var : Params.ExtraVariables)
+            if (!var.VolumeData || !var.TransferFunction ||
+                var.TransferFunction->Num() != (Params.UsePreIntegratedTF ? tfRes * tfRes : tfRes))
+                return ret;
+
+        ret.Size = Params.RenderSize;
+        ret.Pixels.Init(FLinearColor::Transparent, static_cast<int64>(ret.Size.X) * ret.Size.Y);
+        if (Params.RecordStepCounts)
+            ret.StepCounts.Init(0, ret.Pixels.Num());
+        if (Params.RecordDepths && Params.UseIsosurface)
+            ret.Depths.Init(-1., ret.Pixels.Num());
+
+        auto [vxMin, vxMax, vxExt] =
+            VolumeData::GetVoxelMinMaxExtent(VolumeData::GetVoxelType<T>());
+        TArray<VolumeSampler<T>, TInlineAllocator<MaxExtraVariableNum + 1>> samplers;
+        samplers.Emplace(dim, VolDat, Params.TransferFunction,
+                         Params.Use2DTF ? TransferFunction2DData::GradientResolution : 1, vxMin,
+                         vxExt);
+        auto params = Params;
+        if (params.UseIsosurface)
+            params.ExtraVariables = {};
+        for (auto &var : params.ExtraVariables)
+            samplers.Emplace(dim, reinterpret_cast<const T *>(var.VolumeData),
+                             *var.TransferFunction, 1, vxMin, vxExt);
+
+        // Empty bricks of one variable may be occupied in another
+        if (params.Occupancy)
+            for (auto &var : params.ExtraVariables)
+                if (!var.Occupancy ||
+                    var.Occupancy->GetBrickSize() != params.Occupancy->GetBrickSize() ||
+                    var.Occupancy->GetDimension() != params.Occupancy->GetDimension()) {
+                    params.Occupancy = nullptr;
+                    break;
+                }
+        if (params.ResidentBricks) {
+            auto brickNum =
+                params.Occupancy ? params.Occupancy->GetBrickNumber() : FIntVector::ZeroValue;
+            if (params.ResidentBricks->Num() !=
+                static_cast<int64>(brickNum.X) * brickNum.Y * brickNum.Z)
+                params.ResidentBricks = nullptr;
+        }
+
+        auto tileSz = std::max(Params.TileSize, 2) & ~1;
+        FIntPoint tileNum(FMath::DivideAndRoundUp(ret.Size.X, tileSz),
+                          FMath::DivideAndRoundUp(ret.Size.Y, tileSz));
+        ParallelFor(tileNum.X * tileNum.Y, [&](int32 tileIdx) {
+            FIntPoint tileStart(tileIdx % tileNum.X * tileSz, tileIdx / tileNum.X * tileSz);
+            FIntPoint tileEnd(std::min(tileStart.X + tileSz, ret.Size.X),
+                              std::min(tileStart.Y + tileSz, ret.Size.Y));
+            for (int32 y = tileStart.Y; y < tileEnd.Y; y += 2)
+                for (int32 x = tileStart.X; x < tileEnd.X; x += 2)
+                    marchPacket<T>(params, samplers, FIntPoint(x, y), ret);
+        });
+
+        return ret;
+    }
+
+    // Reads the RGBA16F texels of a (pre-integrated) transfer function texture created by
+    // TransferFunctionData or FTFPreIntegrator. Called in the game thread.
+    static TArray<FLinearColor> ReadTransferFunction(UTexture2D *Texture) {
+        TArray<FLinearColor> ret;
+        if (!Texture || !Texture->GetPlatformData() || Texture->GetPlatformData()->Mips.IsEmpty())
+            return ret;
+
+        auto &mip = Texture->GetPlatformData()->Mips[0];
+        auto texelNum = static_cast<int64>(mip.SizeX) * mip.SizeY;
+        auto texDat = reinterpret_cast<const FFloat16 *>(
+            mip.BulkData.Lock(EBulkDataLockFlags::LOCK_READ_ONLY));
+        if (texDat) {
+            ret.SetNumUninitialized(texelNum);
+            for (int64 i = 0; i < texelNum; ++i)
+                ret[i] = FLinearColor(texDat[4 * i + 0], texDat[4 * i + 1], texDat[4 * i + 2],
+                                      texDat[4 * i + 3]);
+        }
+        mip.BulkData.Unlock();
+
+        return ret;
+    }
+
+  private:
+    static constexpr int32 LaneNum = 4;
+
+    // Samples the volume and transfer function at positions in [0,1]^3
+    template <SupportedVoxelType T> class VolumeSampler {
+      public:
+        VolumeSampler(const FIntVector &Dimension, const T *VolDat, const TArray<FLinearColor> &TF,
+                      int32 TFRowNum, float VxMin, float VxExt)
+            : volDat(VolDat), dim(Dimension), tf(TF), tfRowNum(TFRowNum), vxMin(VxMin),
+              vxExt(VxExt) {
+            voxPerVolYxX = static_cast<int64>(dim.Y) * dim.X;
+        }
+
+        // Returns the scalar in [0, 1]
+        float SampleVolume(float U, float V, float W) const {
+            auto toVoxel = [](float coord, int32 n, int32 &i0, int32 &i1) {
+                auto x = FMath::Clamp(coord * n - .5f, 0.f, n - 1.f);
+                i0 = std::min(static_cast<int32>(x), n - 1);
+                i1 = std::min(i0 + 1, n - 1);
+                return x - i0;
+            };
+            int32 x0, x1, y0, y1, z0, z1;
+            auto fx = toVoxel(U, dim.X, x0, x1);
+            auto fy = toVoxel(V, dim.Y, y0, y1);
+            auto fz = toVoxel(W, dim.Z, z0, z1);
+
+            auto at = [&](int32 x, int32 y, int32 z) {
+                return static_cast<float>(
+                    volDat[z * voxPerVolYxX + static_cast<int64>(y) * dim.X + x]);
+            };
+            auto v00 = FMath::Lerp(at(x0, y0, z0), at(x1, y0, z0), fx);
+            auto v10 = FMath::Lerp(at(x0, y1, z0), at(x1, y1, z0), fx);
+            auto v01 = FMath::Lerp(at(x0, y0, z1), at(x1, y0, z1), fx);
+            auto v11 = FMath::Lerp(at(x0, y1, z1), at(x1, y1, z1), fx);
+            auto v = FMath::Lerp(FMath::Lerp(v00, v10, fy), FMath::Lerp(v01, v11, fy), fz);
+            return Normalize(v);
+        }
+
+        // Returns the voxel value as a scalar in [0, 1]
+        float Normalize(float Value) const {
+            return FMath::Clamp((Value - vxMin) / vxExt, 0.f, 1.f);
+        }
+
+        // Gradient is the magnitude in [0, 1], read by 2D transfer functions only
+        FLinearColor SampleTF(float Scalar, float Gradient = 0.f) const {
+            return sampleRows(Gradient, [&](const FLinearColor *row) {
+                auto x = Scalar * (TransferFunctionData::Resolution - 1);
+                auto i0 = std::min(static_cast<int32>(x), TransferFunctionData::Resolution - 1);
+                auto i1 = std::min(i0 + 1, TransferFunctionData::Resolution - 1);
+                return FMath::Lerp(row[i0], row[i1], x - i0);
+            });
+        }
+
+        FLinearColor SamplePreIntegratedTF(float ScalarFront, float ScalarBack,
+                                           float Gradient = 0.f) const {
+            return sampleRows(Gradient, [&](const FLinearColor *row) {
+                constexpr auto res = TransferFunctionData::Resolution;
+                auto xf = ScalarFront * (res - 1);
+                auto xb = ScalarBack * (res - 1);
+                auto f0 = std::min(static_cast<int32>(xf), res - 1);
+                auto b0 = std::min(static_cast<int32>(xb), res - 1);
+                auto f1 = std::min(f0 + 1, res - 1);
+                auto b1 = std::min(b0 + 1, res - 1);
+                return FMath::Lerp(FMath::Lerp(row[f0 * res + b0], row[f0 * res + b1], xb - b0),
+                                   FMath::Lerp(row[f1 * res + b0], row[f1 * res + b1], xb - b0),
+                                   xf - f0);
+            });
+        }
+
+      private:
+        const T *volDat;
+        FIntVector dim;
+        int64 voxPerVolYxX;
+        const TArray<FLinearColor> &tf;
+        int32 tfRowNum;
+        float vxMin, vxExt;
+
+        template <typename SampleRowTy>
+        FLinearColor sampleRows(float Gradient, SampleRowTy &&SampleRow) const {
+            if (tfRowNum == 1)
+                return SampleRow(tf.GetData());
+            auto rowSz = tf.Num() / tfRowNum;
+            auto y = FMath::Clamp(Gradient, 0.f, 1.f) * (tfRowNum - 1);
+            auto r0 = std::min(static_cast<int32>(y), tfRowNum - 1);
+            auto r1 = std::min(r0 + 1, tfRowNum - 1);
+            return FMath::Lerp(SampleRow(tf.GetData() + r0 * rowSz),
+                               SampleRow(tf.GetData() + r1 * rowSz), y - r0);
+        }
+    };
+
+    // Returns segments of the ray inside the sector and in front of the Earth
+    static FShellSectorIntersector::Segments intersectSector(const Parameters &Params,
+                                                             const FVector &Origin,
+                                                             const FVector &Dir) {
+        auto ret = FShellSectorIntersector::Exec({.LongtitudeRange = Params.LongtitudeRange,
+                                                  .LatitudeRange = Params.LatitudeRange,
+                                                  .HeightRange = Params.HeightRange},
+                                                 Origin, Dir);
+
+        auto b = Origin.Dot(Dir);
+        auto disc = b * b - (Origin.SizeSquared() - EarthRadius * EarthRadius);
+        if (disc < 0.)
+            return ret;
+        auto tEarth = -b - FMath::Sqrt(disc);
+        if (tEarth <= 0.)
+            return ret;
+        while (ret.Num != 0 && ret.Ranges[ret.Num - 1][0] >= tEarth)
+            --ret.Num;
+        if (ret.Num != 0)
+            ret.Ranges[ret.Num - 1][1] = std::min(ret.Ranges[ret.Num - 1][1], tEarth);
+        return ret;
+    }
+
+    // Returns the number of steps from the sample at (U, V, W) to the next one. IsEmpty is set
+    // if the sample is in an empty brick, which is leapt over with all but the last step. For
+    // isosurfaces, bricks are empty if their scalars exclude IsoScalar in [0, 1]. Bricks not
+    // in ResidentBricks are empty.
+    static int32 getStepCount(const Parameters &Params, float U, float V, float W,
+                              float IsoScalar, bool &IsEmpty) {
+        auto &occupancy = *Params.Occupancy;
+        auto brickSz = occupancy.GetBrickSize();
+        auto &dim = Params.Dimension;
+
+        // Samples in [Lo, Hi) of a coordinate are interpolated from voxels of the same brick
+        double coords[3] = {U, V, W};
+        FIntVector brick;
+        FVector2d rngs[3];
+        for (int32 i = 0; i < 3; ++i) {
+            auto x = FMath::Clamp(coords[i] * dim[i] - .5, 0., dim[i] - 1.);
+            brick[i] = std::min(static_cast<int32>(x), dim[i] - 1) / brickSz;
+            rngs[i][0] = brick[i] == 0 ? 0. : (brick[i] * brickSz + .5) / dim[i];
+            rngs[i][1] = std::min(((brick[i] + 1) * brickSz + .5) / dim[i], 1.);
+        }
+
+        // Blended opacities are no more than the sums of those of variables
+        auto maxAlpha = 0.f, err = 0.f;
+        auto accumulate = [&](const FVolumeOccupancy &occ) {
+            auto &alphaRng = occ.GetAlphaRange(brick);
+            maxAlpha = std::max(maxAlpha, alphaRng.Y);
+            err += std::min(alphaRng.Y, alphaRng.Y - alphaRng.X);
+        };
+        auto &brickNum = occupancy.GetBrickNumber();
+        if (Params.ResidentBricks &&
+            (*Params.ResidentBricks)[(brick.Z * brickNum.Y + brick.Y) * brickNum.X + brick.X] ==
+                FBrickResidency::InvalidSlot)
+            IsEmpty = true;
+        else if (Params.UseIsosurface) {
+            auto &entryRng = occupancy.GetEntryRange(brick);
+            auto isoEntry = IsoScalar * (TransferFunctionData::Resolution - 1);
+            IsEmpty = isoEntry < entryRng.X || isoEntry > entryRng.Y;
+            if (!IsEmpty)
+                return 1;
+        } else {
+            accumulate(occupancy);
+            for (auto &var : Params.ExtraVariables)
+                accumulate(*var.Occupancy);
+            IsEmpty = maxAlpha <= 0.f;
+        }
+        int32 scale = 1;
+        if (!IsEmpty) {
+            while (scale * 2 <= Params.MaxStepScale &&
+                   scale * 2 * err <= Params.AdaptiveStepTolerance)
+                scale *= 2;
+            if (scale == 1)
+                return 1;
+        }
+
+        // Distances to the planes of longitudes, the cones of latitudes and the spheres of
+        // heights bounding the brick, each no more than that to the brick's face
+        auto lonExt = FMath::DegreesToRadians(Params.LongtitudeRange[1] -
+                                              Params.LongtitudeRange[0]);
+        auto latExt =
+            FMath::DegreesToRadians(Params.LatitudeRange[1] - Params.LatitudeRange[0]);
+        auto hExt = Params.HeightRange[1] - Params.HeightRange[0];
+        auto r = EarthRadius + Params.HeightRange[0] + W * hExt;
+        auto lat = FMath::DegreesToRadians(Params.LatitudeRange[0]) + V * latExt;
+        auto distToAngle = [](double radius, double dAngle) {
+            return radius * FMath::Sin(std::min(dAngle, UE_DOUBLE_HALF_PI));
+        };
+        auto dist = std::min(
+            {distToAngle(r * FMath::Cos(lat), (U - rngs[0][0]) * lonExt),
+             distToAngle(r * FMath::Cos(lat), (rngs[0][1] - U) * lonExt),
+             distToAngle(r, (V - rngs[1][0]) * latExt), distToAngle(r, (rngs[1][1] - V) * latExt),
+             (W - rngs[2][0]) * hExt, (rngs[2][1] - W) * hExt});
+        // Samples in [0, dist] are in the brick
+        auto inBrickNum = static_cast<int32>(std::max(dist, 0.) / Params.Step) + 1;
+        return IsEmpty ? inBrickNum : std::min(scale, inBrickNum);
+    }
+
+    // Lights the color of a sample of gradient Grad in voxels, at Pos in the Earth seen along Dir
+    static void shade(const Parameters &Params, const FVector3f &Grad, const FVector3f &Pos,
+                      const FVector3f &Dir, bool IsPremultiplied, FLinearColor &Color) {
+        auto &dim = Params.Dimension;
+        auto r = Pos.Size();
+        auto rXY = FVector2f(Pos.X, Pos.Y).Size();
+        if (Grad.IsNearlyZero() || rXY <= UE_SMALL_NUMBER)
+            return;
+
+        // Scalar per voxel -> scalar per meter, where a voxel spans an arc of longitude on the
+        // parallel, an arc of latitude on the meridian and a section of height
+        auto lonExt = FMath::DegreesToRadians(
+            static_cast<float>(Params.LongtitudeRange[1] - Params.LongtitudeRange[0]));
+        auto latExt = FMath::DegreesToRadians(
+            static_cast<float>(Params.LatitudeRange[1] - Params.LatitudeRange[0]));
+        auto hExt = static_cast<float>(Params.HeightRange[1] - Params.HeightRange[0]);
+        auto up = Pos / r;
+        FVector3f east(-Pos.Y / rXY, Pos.X / rXY, 0.f);
+        auto north = up.Cross(east);
+        auto normal = (east * (Grad.X * dim.X / (lonExt * rXY)) +
+                       north * (Grad.Y * dim.Y / (latExt * r)) + up * (Grad.Z * dim.Z / hExt))
+                          .GetSafeNormal();
+        if (normal.IsZero())
+            return;
+
+        // The light is at the eye, so that the halfway vector is the light direction
+        auto cosTheta = FMath::Abs(normal.Dot(Dir));
+        auto diffuse = Params.Ambient + Params.Diffuse * cosTheta;
+        auto specular = Params.Specular * FMath::Pow(cosTheta, Params.Shininess) *
+                        (IsPremultiplied ? Color.A : 1.f);
+        Color.R = Color.R * diffuse + specular;
+        Color.G = Color.G * diffuse + specular;
+        Color.B = Color.B * diffuse + specular;
+    }
+
+    static bool hasGradients(const Parameters &Params) {
+        return Params.Gradients && Params.Gradients->IsValid() &&
+               Params.Gradients->Dimension == Params.Dimension;
+    }
+    // Normalizes gradient magnitudes for 2D transfer functions, or zeroes them otherwise
+    static float getInverseMaxGradientMagnitude(const Parameters &Params) {
+        return Params.Use2DTF && hasGradients(Params) && Params.Gradients->MaxMagnitude > 0.f
+                   ? 1.f / Params.Gradients->MaxMagnitude
+                   : 0.f;
+    }
+
+    // Scalar counterpart of the transformation in marchPacket(), from Pos in the Earth to
+    // [0,1]^3 of the volume
+    static FVector3f toVolume(const Parameters &Params, const FVector3f &Pos) {
+        auto r = Pos.Size();
+        return FVector3f(
+            (FMath::RadiansToDegrees(FMath::Atan2(Pos.Y, Pos.X)) -
+             static_cast<float>(Params.LongtitudeRange[0])) /
+                static_cast<float>(Params.LongtitudeRange[1] - Params.LongtitudeRange[0]),
+            (FMath::RadiansToDegrees(FMath::Asin(Pos.Z / r)) -
+             static_cast<float>(Params.LatitudeRange[0])) /
+                static_cast<float>(Params.LatitudeRange[1] - Params.LatitudeRange[0]),
+            (r - static_cast<float>(EarthRadius + Params.HeightRange[0])) /
+                static_cast<float>(Params.HeightRange[1] - Params.HeightRange[0]));
+    }
+
+    // Refines the crossing of IsoScalar between samples Lo and Hi of (t, scalar) along the ray
+    // from Origin along Dir into HitT, and returns its premultiplied color
+    template <SupportedVoxelType T>
+    static FLinearColor hitIsosurface(const Parameters &Params, const VolumeSampler<T> &Sampler,
+                                      const FVector3f &Origin, const FVector3f &Dir,
+                                      float IsoScalar, FVector2f Lo, FVector2f Hi, float &HitT) {
+        auto isLoAbove = Lo.Y >= IsoScalar;
+        for (int32 i = 0; i < Params.IsoBisectionNum; ++i) {
+            auto tMid = .5f * (Lo.X + Hi.X);
+            auto uvw = toVolume(Params, Origin + Dir * tMid);
+            auto scalar = Sampler.SampleVolume(uvw.X, uvw.Y, uvw.Z);
+            ((scalar >= IsoScalar) == isLoAbove ? Lo : Hi) = FVector2f(tMid, scalar);
+        }
+        auto t = Hi.Y == Lo.Y ? Hi.X
+                              : FMath::Lerp(Lo.X, Hi.X,
+                                            FMath::Clamp((IsoScalar - Lo.Y) / (Hi.Y - Lo.Y),
+                                                         0.f, 1.f));
+        HitT = t;
+
+        auto pos = Origin + Dir * t;
+        auto uvw = toVolume(Params, pos);
+        auto isLit = hasGradients(Params);
+        FVector3f grad = FVector3f::ZeroVector;
+        if (isLit) {
+            auto &dim = Params.Dimension;
+            grad = Params.Gradients->Sample(
+                FVector3f(uvw.X * dim.X - .5f, uvw.Y * dim.Y - .5f, uvw.Z * dim.Z - .5f));
+        }
+        auto color =
+            Sampler.SampleTF(IsoScalar, grad.Size() * getInverseMaxGradientMagnitude(Params));
+        if (isLit)
+            shade(Params, grad, pos, Dir, false, color);
+        return FLinearColor(color.R * Params.RelativeLightness,
+                            color.G * Params.RelativeLightness,
+                            color.B * Params.RelativeLightness, 1.f);
+    }
+
+    template <SupportedVoxelType T>
+    static void marchPacket(const Parameters &Params, TConstArrayView<VolumeSampler<T>> Samplers,
+                            const FIntPoint &Start, Image &Img) {
+        alignas(16) float origins[3][LaneNum], dirs[3][LaneNum], ts[LaneNum], tExits[LaneNum];
+        // Segments relative to the first entries, and the segments being marched
+        FShellSectorIntersector::Segments segs[LaneNum];
+        int32 segIdxs[LaneNum];
+        FLinearColor colors[LaneNum];
+        // Of each variable
+        float prevScalars[MaxExtraVariableNum + 1][LaneNum];
+        auto varNum = Samplers.Num();
+        auto resetPrevScalars = [&](int32 lane) {
+            for (int32 var = 0; var < varNum; ++var)
+                prevScalars[var][lane] = -1.f;
+        };
+        auto isShaded = Params.UseShading && hasGradients(Params);
+        auto invMaxGradMag = getInverseMaxGradientMagnitude(Params);
+        auto isoScalar = Samplers[0].Normalize(Params.IsoValue);
+        auto opacityScale =
+            Params.OpacityReferenceStep > 0.f ? Params.Step / Params.OpacityReferenceStep : 1.f;
+        // Of the previous samples of isosurfaces, and of the hits relative to the entries
+        float prevTs[LaneNum], hitTs[LaneNum];
+        double tEntries[LaneNum];
+        int32 prevStepNums[LaneNum], stepCounts[LaneNum];
+        bool actives[LaneNum];
+
+        auto eye = Params.EyeToEarth.GetOrigin();
+        for (int32 lane = 0; lane < LaneNum; ++lane) {
+            FIntPoint pix(Start.X + (lane & 0b1), Start.Y + (lane >> 1));
+            colors[lane] = FLinearColor::Transparent;
+            resetPrevScalars(lane);
+            prevStepNums[lane] = 1;
+            stepCounts[lane] = 0;
+            hitTs[lane] = -1.f;
+
+            FVector dir = FVector::ZeroVector;
+            segs[lane] = {};
+            segIdxs[lane] = 0;
+            if (pix.X < Img.Size.X && pix.Y < Img.Size.Y) {
+                FVector4 ndc(2. * (pix.X + .5 + Params.PixelJitter.X) / Img.Size.X - 1.,
+                             1. - 2. * (pix.Y + .5 + Params.PixelJitter.Y) / Img.Size.Y, 1., 1.);
+                auto eyePos = Params.InvProjection.TransformFVector4(ndc);
+                dir = Params.EyeToEarth.TransformVector(FVector(eyePos) / eyePos.W);
+                dir.Normalize();
+                segs[lane] = intersectSector(Params, eye, dir);
+            }
+            actives[lane] = !segs[lane].IsEmpty();
+            auto tRng = segs[lane].GetHull();
+            for (int32 i = 0; i < segs[lane].Num; ++i)
+                segs[lane].Ranges[i] -= FVector2d(tRng[0], tRng[0]);
+
+            // Origins are moved to the entries so that t stays small in float. Positions are
+            // still float in the Earth, thus about 0.5 m apart at its radius, which is far
+            // below a voxel of sectors spanning degrees.
+            auto origin = eye + tRng[0] * dir;
+            tEntries[lane] = tRng[0];
+            for (int32 i = 0; i < 3; ++i) {
+                origins[i][lane] = origin[i];
+                dirs[i][lane] = dir[i];
+            }
+            ts[lane] = Params.StepJitter * Params.Step;
+            tExits[lane] = tRng[1] - tRng[0];
+        }
+        if (!(actives[0] || actives[1] || actives[2] || actives[3]))
+            return;
+
+        auto ox = VectorLoadAligned(origins[0]), oy = VectorLoadAligned(origins[1]),
+             oz = VectorLoadAligned(origins[2]);
+        auto dx = VectorLoadAligned(dirs[0]), dy = VectorLoadAligned(dirs[1]),
+             dz = VectorLoadAligned(dirs[2]);
+        auto tExit = VectorLoadAligned(tExits);
+        auto toVector = [](double val) { return VectorSetFloat1(static_cast<float>(val)); };
+        auto lonMin = toVector(Params.LongtitudeRange[0]);
+        auto latMin = toVector(Params.LatitudeRange[0]);
+        auto hMin = toVector(EarthRadius + Params.HeightRange[0]);
+        auto invLonExt = toVector(1. / (Params.LongtitudeRange[1] - Params.LongtitudeRange[0]));
+        auto invLatExt = toVector(1. / (Params.LatitudeRange[1] - Params.LatitudeRange[0]));
+        auto invHExt = toVector(1. / (Params.HeightRange[1] - Params.HeightRange[0]));
+        auto radToDeg = toVector(180. / UE_DOUBLE_PI);
+        auto zero = VectorZeroFloat();
+        auto one = VectorOneFloat();
+
+        for (int32 stepIdx = 0; stepIdx < Params.MaxStepCount; ++stepIdx) {
+            // Rays advance separately since they leap over empty bricks separately
+            auto t = VectorLoadAligned(ts);
+            auto inRay = VectorMaskBits(VectorCompareLE(t, tExit));
+            auto px = VectorMultiplyAdd(dx, t, ox);
+            auto py = VectorMultiplyAdd(dy, t, oy);
+            auto pz = VectorMultiplyAdd(dz, t, oz);
+
+            // (x, y, z) -> (lon, lat, h) -> [0,1]^3. VectorATan2(Y, X) computes atan(Y / X).
+            auto r = VectorSqrt(
+                VectorMultiplyAdd(px, px, VectorMultiplyAdd(py, py, VectorMultiply(pz, pz))));
+            auto u = VectorMultiply(
+                VectorSubtract(VectorMultiply(VectorATan2(py, px), radToDeg), lonMin), invLonExt);
+            auto v = VectorMultiply(
+                VectorSubtract(VectorMultiply(VectorASin(VectorDivide(pz, r)), radToDeg), latMin),
+                invLatExt);
+            auto w = VectorMultiply(VectorSubtract(r, hMin), invHExt);
+            auto inSector = VectorMaskBits(VectorBitwiseAnd(
+                VectorBitwiseAnd(
+                    VectorBitwiseAnd(VectorCompareGE(u, zero), VectorCompareLE(u, one)),
+                    VectorBitwiseAnd(VectorCompareGE(v, zero), VectorCompareLE(v, one))),
+                VectorBitwiseAnd(VectorCompareGE(w, zero), VectorCompareLE(w, one))));
+
+            alignas(16) float us[LaneNum], vs[LaneNum], ws[LaneNum], ps[3][LaneNum];
+            VectorStoreAligned(u, us);
+            VectorStoreAligned(v, vs);
+            VectorStoreAligned(w, ws);
+            if (isShaded) {
+                VectorStoreAligned(px, ps[0]);
+                VectorStoreAligned(py, ps[1]);
+                VectorStoreAligned(pz, ps[2]);
+            }
+
+            auto anyActive = false;
+            for (int32 lane = 0; lane < LaneNum; ++lane) {
+                if (!actives[lane])
+                    continue;
+                if (((inRay >> lane) & 0b1) == 0) {
+                    actives[lane] = false;
+                    continue;
+                }
+                anyActive = true;
+                ++stepCounts[lane];
+                if (((inSector >> lane) & 0b1) == 0) {
+                    resetPrevScalars(lane);
+                    prevStepNums[lane] = 1;
+                    // Leaps to the first sample of the next segment once this one is passed
+                    auto &seg = segs[lane];
+                    auto &segIdx = segIdxs[lane];
+                    while (segIdx + 1 < seg.Num && ts[lane] > seg.Ranges[segIdx][1])
+                        ++segIdx;
+                    auto gap = seg.Ranges[segIdx][0] - ts[lane];
+                    ts[lane] += gap > 0. ? FMath::CeilToDouble(gap / Params.Step) * Params.Step
+                                         : Params.Step;
+                    continue;
+                }
+                auto stepNum = 1;
+                if (Params.Occupancy) {
+                    auto isEmpty = false;
+                    stepNum =
+                        getStepCount(Params, us[lane], vs[lane], ws[lane], isoScalar, isEmpty);
+                    if (isEmpty) {
+                        resetPrevScalars(lane);
+                        prevStepNums[lane] = 1;
+                        if (Params.UseIsosurface) {
+                            // The last leapt sample brackets any crossing after the brick
+                            prevTs[lane] = ts[lane] + (stepNum - 1) * Params.Step;
+                            auto uvw = toVolume(
+                                Params,
+                                FVector3f(origins[0][lane], origins[1][lane], origins[2][lane]) +
+                                    FVector3f(dirs[0][lane], dirs[1][lane], dirs[2][lane]) *
+                                        prevTs[lane]);
+                            prevScalars[0][lane] = Samplers[0].SampleVolume(uvw.X, uvw.Y, uvw.Z);
+                        }
+                        ts[lane] += stepNum * Params.Step;
+                        continue;
+                    }
+                }
+                auto t = ts[lane];
+                ts[lane] += stepNum * Params.Step;
+
+                if (Params.UseIsosurface) {
+                    auto scalar = Samplers[0].SampleVolume(us[lane], vs[lane], ws[lane]);
+                    auto prevScalar = prevScalars[0][lane];
+                    auto prevT = prevTs[lane];
+                    prevScalars[0][lane] = scalar;
+                    prevTs[lane] = t;
+                    if (prevScalar < 0.f || (prevScalar >= isoScalar) == (scalar >= isoScalar))
+                        continue;
+
+                    colors[lane] = hitIsosurface(
+                        Params, Samplers[0],
+                        FVector3f(origins[0][lane], origins[1][lane], origins[2][lane]),
+                        FVector3f(dirs[0][lane], dirs[1][lane], dirs[2][lane]), isoScalar,
+                        FVector2f(prevT, prevScalar), FVector2f(t, scalar), hitTs[lane]);
+                    actives[lane] = false;
+                    continue;
+                }
+
+                // Opacities of the transfer function are for slabs of OpacityReferenceStep.
+                // Colors are only rescaled where they are premultiplied.
+                auto correct = [&](FLinearColor &tfCol, int32 stepNum, bool isPremultiplied) {
+                    auto scale = stepNum * opacityScale;
+                    if (scale == 1.f || tfCol.A <= 0.f)
+                        return;
+                    auto alpha = 1.f - FMath::Pow(1.f - std::min(tfCol.A, 1.f), scale);
+                    if (isPremultiplied) {
+                        auto ratio = alpha / tfCol.A;
+                        tfCol.R *= ratio;
+                        tfCol.G *= ratio;
+                        tfCol.B *= ratio;
+                    }
+                    tfCol.A = alpha;
+                };
+                FVector3f grad = FVector3f::ZeroVector;
+                if (isShaded || Params.Use2DTF) {
+                    auto &dim = Params.Dimension;
+                    grad = Params.Gradients->Sample(FVector3f(
+                        us[lane] * dim.X - .5f, vs[lane] * dim.Y - .5f, ws[lane] * dim.Z - .5f));
+                }
+                auto gradMag = grad.Size() * invMaxGradMag;
+                auto &color = colors[lane];
+                auto classify = [&](int32 var) {
+                    auto &sampler = Samplers[var];
+                    auto scalar = sampler.SampleVolume(us[lane], vs[lane], ws[lane]);
+                    auto varGradMag = var == 0 ? gradMag : 0.f;
+                    FLinearColor tfCol;
+                    if (Params.UsePreIntegratedTF) {
+                        // Slab from the previous sample, a slab of zero length at the first
+                        // sample
+                        auto &prevScalar = prevScalars[var][lane];
+                        tfCol = sampler.SamplePreIntegratedTF(
+                            prevScalar < 0.f ? scalar : prevScalar, scalar, varGradMag);
+                        prevScalar = scalar;
+                    } else
+                        tfCol = sampler.SampleTF(scalar, varGradMag);
+                    if (var == 0 && isShaded && tfCol.A > 0.f)
+                        shade(Params, grad, FVector3f(ps[0][lane], ps[1][lane], ps[2][lane]),
+                              FVector3f(dirs[0][lane], dirs[1][lane], dirs[2][lane]),
+                              Params.UsePreIntegratedTF, tfCol);
+                    return tfCol;
+                };
+                auto tfCol = classify(0);
+                if (varNum > 1) {
+                    // Premultiplied colors are already weighted by their opacities
+                    auto weigh = [&](const FLinearColor &col) {
+                        auto a = Params.UsePreIntegratedTF ? 1.f : col.A;
+                        return FLinearColor(a * col.R, a * col.G, a * col.B, col.A);
+                    };
+                    auto sum = weigh(tfCol);
+                    auto transparency = 1.f - std::min(tfCol.A, 1.f);
+                    for (int32 var = 1; var < varNum; ++var) {
+                        auto varCol = classify(var);
+                        sum += weigh(varCol);
+                        transparency *= 1.f - std::min(varCol.A, 1.f);
+                    }
+                    tfCol.A = 1.f - transparency;
+                    auto scale =
+                        sum.A <= 0.f ? 0.f : (Params.UsePreIntegratedTF ? tfCol.A : 1.f) / sum.A;
+                    tfCol.R = sum.R * scale;
+                    tfCol.G = sum.G * scale;
+                    tfCol.B = sum.B * scale;
+                }
+                if (Params.UsePreIntegratedTF) {
+                    correct(tfCol, prevStepNums[lane], true);
+                    prevStepNums[lane] = stepNum;
+                    auto transparency = 1.f - color.A;
+                    color.R += transparency * tfCol.R * Params.RelativeLightness;
+                    color.G += transparency * tfCol.G * Params.RelativeLightness;
+                    color.B += transparency * tfCol.B * Params.RelativeLightness;
+                    color.A += transparency * tfCol.A;
+                } else {
+                    correct(tfCol, stepNum, false);
+                    auto transparency = (1.f - color.A) * tfCol.A;
+                    color.R += transparency * tfCol.R * Params.RelativeLightness;
+                    color.G += transparency * tfCol.G * Params.RelativeLightness;
+                    color.B += transparency * tfCol.B * Params.RelativeLightness;
+                    color.A += transparency;
+                }
+                if (color.A >= Params.EarlyTerminationAlpha)
+                    actives[lane] = false;
+            }
+            if (!anyActive)
+                break;
+        }
+
+        for (int32 lane = 0; lane < LaneNum; ++lane) {
+            FIntPoint pix(Start.X + (lane & 0b1), Start.Y + (lane >> 1));
+            if (pix.X >= Img.Size.X || pix.Y >= Img.Size.Y)
+                continue;
+            auto pixIdx = static_cast<int64>(pix.Y) * Img.Size.X + pix.X;
+            Img.Pixels[pixIdx] = colors[lane];
+            if (!Img.StepCounts.IsEmpty())
+                Img.StepCounts[pixIdx] = stepCounts[lane];
+            if (!Img.Depths.IsEmpty() && hitTs[lane] >= 0.f)
+                Img.Depths[pixIdx] = tEntries[lane] + hitTs[lane];
+        }
+    }
+};
@@ -10,7 +10,10 @@
 #include "ShaderParameterStruct.h"
 
 #include "Runtime/Renderer/Private/SceneRendering.h"
+#include "ScreenPass.h"
 
+#include "BrickAtlas.h"
+#include "DVRRayCasterCPU.h"
 #include "Util.h"
 
 //class VIS4EARTH_API FDVRShader : public FGlobalShader {
@@ -109,23 +112,394 @@ void FDVRRenderer::Unregister() {
 }
 
 void FDVRRenderer::render(FPostOpaqueRenderParameters &PostQpqRndrParams) {
-    //if (!rndrParams.VolumeTexture.IsValid() || !rndrParams.TransferFunctionTexture.IsValid() ||
-    //    !geoParams.GeoRef.IsValid())
-    //    return;
-    //if (!rndrParams.VolumeTexture->GetResource() ||
-    //    !rndrParams.TransferFunctionTexture->GetResource())
-    //    return;
-
-    //if (rndrParams.UsePreIntegratedTF)
-    //    render<FPreIntDVRShader>(PostQpqRndrParams);
-    //else
-    //    render<FDVRShader>(PostQpqRndrParams);
+    auto isRndrChanged = rndrState.Acquire();
+    auto isGeoChanged = geoState.Acquire();
+    if (isRndrChanged || isGeoChanged)
+        isRefinementDirty = true;
+
+    // The CPU path marches the bricks resident in the pool, which streams in either path
+    if (rndrState.Get().UseBrickPool)
+        updateBrickPool(PostQpqRndrParams);
+    if (rndrState.Get().UseCPU)
+        renderCPU(PostQpqRndrParams);
+}
+
+void FDVRRenderer::InvalidateVolumeOccupancy() {
+    ENQUEUE_RENDER_COMMAND(DVRRendererInvalidateVolumeOccupancy)
+    ([renderer = SharedThis(this)](FRHICommandListImmediate &RHICmdList) {
+        renderer->occupancyCache = {};
+        renderer->brickOccupancyCache = {};
+        renderer->extraOccupancyCaches.Empty();
+        renderer->brickAtlas.Reset();
+        renderer->isRefinementDirty = true;
+    });
+}
+
+BEGIN_SHADER_PARAMETER_STRUCT(FDVRCPUImageUploadParameters, )
+RDG_TEXTURE_ACCESS(Texture, ERHIAccess::CopyDest)
+END_SHADER_PARAMETER_STRUCT()
+
+void FDVRRenderer::renderCPU(FPostOpaqueRenderParameters &PostQpqRndrParams) {
+    auto &rndrParams = rndrState.Get();
+    auto &geoParams = geoState.Get();
+    if (!rndrParams.VolumeCPUData.IsValid() || !rndrParams.TransferFunctionCPUData.IsValid() ||
+        !geoParams.GeoRef.IsValid())
+        return;
+
+    auto &voxPerVol = rndrParams.Dimension;
+    auto &volDat = *rndrParams.VolumeCPUData;
+
+    // The caster's Earth is a sphere, while Cesium places the volume and MCS contours on the
+    // WGS84 ellipsoid, up to kilometers apart. The eye is placed on the sphere at its geodetic
+    // coordinates instead, whose east-north-up frame is the same, so that the volume registers
+    // around the eye and drifts only with the difference of curvatures away from it.
+    auto &view = *PostQpqRndrParams.View;
+    auto eyeToWorld = view.ViewMatrices.GetInvViewMatrix();
+    auto eyeToEarth = FMatrix::Identity;
+    eyeToEarth.SetOrigin(FShellSectorIntersector::ToEarth(
+        geoParams.GeoRef->TransformUnrealPositionToLongitudeLatitudeHeight(
+            eyeToWorld.GetOrigin())));
+    for (int32 i = 0; i < 3; ++i)
+        eyeToEarth.SetAxis(i, geoParams.GeoRef->TransformUnrealDirectionToEarthCenteredEarthFixed(
+                                  eyeToWorld.GetScaledAxis(i == 0   ? EAxis::X
+                                                           : i == 1 ? EAxis::Y
+                                                                    : EAxis::Z)));
+
+    auto volSz = static_cast<int64>(VolumeData::GetVoxelSize(rndrParams.VoxelType)) *
+                 voxPerVol.X * voxPerVol.Y * voxPerVol.Z;
+    if (volSz == 0 || volDat.Num() < volSz)
+        return;
+
+    // With the brick pool, occupancies share its bricks, so that only resident ones are marched
+    auto usePool = rndrParams.UseBrickPool && brickAtlas.IsValid() &&
+                   brickAtlas->GetDimension() == voxPerVol &&
+                   brickAtlas->GetBrickSize() == std::max(rndrParams.PoolBrickSize, 1);
+    auto &mainCache = usePool ? brickOccupancyCache : occupancyCache;
+    auto occupancyBrickSz =
+        usePool ? brickAtlas->GetBrickSize() : std::max(rndrParams.OccupancyBrickSize, 1);
+    if (!syncOccupancy(mainCache, occupancyBrickSz, rndrParams.VolumeCPUData, voxPerVol,
+                       rndrParams.VoxelType, rndrParams.TransferFunctionCPUData,
+                       rndrParams.Use2DTF ? TransferFunction2DData::GradientResolution : 1))
+        return;
+
+    // Co-registered volumes are marched along in the same pass
+    TArray<FDVRRayCasterCPU::Variable, TInlineAllocator<FDVRRayCasterCPU::MaxExtraVariableNum>>
+        vars;
+    extraOccupancyCaches.SetNum(rndrParams.ExtraVariables.Num());
+    for (int32 i = 0; i < rndrParams.ExtraVariables.Num(); ++i) {
+        auto &var = rndrParams.ExtraVariables[i];
+        if (vars.Num() == FDVRRayCasterCPU::MaxExtraVariableNum || !var.VolumeCPUData.IsValid() ||
+            !var.TransferFunctionCPUData.IsValid())
+            continue;
+        if (var.Dimension != voxPerVol || var.VoxelType != rndrParams.VoxelType ||
+            var.VolumeCPUData->Num() < volSz)
+            continue;
+
+        auto &cache = extraOccupancyCaches[i];
+        auto isOccupancyValid =
+            syncOccupancy(cache, occupancyBrickSz, var.VolumeCPUData, var.Dimension,
+                          var.VoxelType, var.TransferFunctionCPUData);
+        vars.Emplace(FDVRRayCasterCPU::Variable{
+            .VolumeData = var.VolumeCPUData->GetData(),
+            .TransferFunction = var.TransferFunctionCPUData.Get(),
+            .Occupancy = isOccupancyValid ? cache.Occupancy.Get() : nullptr});
+    }
+
+    // The camera moves if the view differs from that of the previous frame. Temporal AA
+    // jitters the projection every frame, so that only the unjittered one tells motion.
+    auto invProj = view.ViewMatrices.GetInvProjectionMatrix();
+    auto invProjNoAA = view.ViewMatrices.GetInvProjectionNoAAMatrix();
+    FIntPoint viewportSz(PostQpqRndrParams.ViewportRect.Width(),
+                         PostQpqRndrParams.ViewportRect.Height());
+    auto isMoving = !eyeToEarth.Equals(prevEyeToEarth) ||
+                    !invProjNoAA.Equals(prevInvProjection) || viewportSz != prevViewportSize;
+    prevEyeToEarth = eyeToEarth;
+    prevInvProjection = invProjNoAA;
+    prevViewportSize = viewportSz;
+    if (isMoving || isRefinementDirty || !rndrParams.UseProgressive)
+        refinedFrameNum = 0;
+    isRefinementDirty = false;
+    auto isCoarse = rndrParams.UseProgressive && isMoving;
+
+    auto downsample = std::max(rndrParams.CPUDownsample, 1);
+    auto step = rndrParams.Step;
+    if (isCoarse) {
+        downsample *= std::max(rndrParams.MotionDownsample, 1);
+        step *= std::max(rndrParams.MotionStepScale, 1.f);
+    }
+    FIntPoint rndrSz(FMath::DivideAndRoundUp(viewportSz.X, downsample),
+                     FMath::DivideAndRoundUp(viewportSz.Y, downsample));
+
+    // Jitters of the refining frames follow the Halton sequences of bases 2, 3 and 5, where
+    // the first one is not jittered
+    auto halton = [](int32 idx, int32 base) {
+        float ret = 0.f, frac = 1.f;
+        while (idx > 0) {
+            frac /= base;
+            ret += frac * (idx % base);
+            idx /= base;
+        }
+        return ret;
+    };
+    auto isRefining = rndrParams.UseProgressive && !isCoarse;
+    FVector2f pixJitter = FVector2f::ZeroVector;
+    auto stepJitter = 0.f;
+    if (isRefining && refinedFrameNum != 0) {
+        pixJitter = FVector2f(halton(refinedFrameNum, 2) - .5f, halton(refinedFrameNum, 3) - .5f);
+        stepJitter = halton(refinedFrameNum, 5);
+    }
+
+    // Opacity ranges of bricks bound a 2D transfer function from above only
+    auto maxStepScale = rndrParams.Use2DTF ? 1 : rndrParams.MaxStepScale;
+
+    FDVRRayCasterCPU::Parameters params{.UsePreIntegratedTF = rndrParams.UsePreIntegratedTF,
+                                        .Use2DTF = rndrParams.Use2DTF,
+                                        .MaxStepCount = rndrParams.MaxStepCount,
+                                        .Step = step,
+                                        .OpacityReferenceStep = rndrParams.Step,
+                                        .RelativeLightness = rndrParams.RelativeLightness,
+                                        .EarlyTerminationAlpha = rndrParams.EarlyTerminationAlpha,
+                                        .UseIsosurface = rndrParams.UseIsosurface,
+                                        .IsoValue = rndrParams.IsoValue,
+                                        .IsoBisectionNum = rndrParams.IsoBisectionNum,
+                                        .MaxStepScale = maxStepScale,
+                                        .AdaptiveStepTolerance = rndrParams.AdaptiveStepTolerance,
+                                        .UseShading = rndrParams.UseShading,
+                                        .Ambient = rndrParams.ShadingAmbient,
+                                        .Diffuse = rndrParams.ShadingDiffuse,
+                                        .Specular = rndrParams.ShadingSpecular,
+                                        .Shininess = rndrParams.ShadingShininess,
+                                        .RenderSize = rndrSz,
+                                        .PixelJitter = pixJitter,
+                                        .StepJitter = stepJitter,
+                                        .LongtitudeRange = geoParams.LongtitudeRange,
+                                        .LatitudeRange = geoParams.LatitudeRange,
+                                        .HeightRange = geoParams.HeightRange,
+                                        .EyeToEarth = eyeToEarth,
+                                        .InvProjection = invProj,
+                                        .Dimension = voxPerVol,
+                                        .TransferFunction = *rndrParams.TransferFunctionCPUData,
+                                        .Occupancy = mainCache.Occupancy.Get(),
+                                        .ResidentBricks =
+                                            usePool ? &brickAtlas->GetResidency().GetPageTable()
+                                                    : nullptr,
+                                        .Gradients = rndrParams.Gradients.Get(),
+                                        .ExtraVariables = vars};
+    // Extra variables share the voxel type, and are reinterpreted along by the caster
+    auto exec = [&]() {
+        switch (rndrParams.VoxelType) {
+        case ESupportedVoxelType::UInt8:
+            return FDVRRayCasterCPU::Exec(params, volDat.GetData());
+        case ESupportedVoxelType::UInt16:
+            return FDVRRayCasterCPU::Exec(params,
+                                          reinterpret_cast<const uint16 *>(volDat.GetData()));
+        case ESupportedVoxelType::Float32:
+            return FDVRRayCasterCPU::Exec(params,
+                                          reinterpret_cast<const float *>(volDat.GetData()));
+        default:
+            return FDVRRayCasterCPU::Image{};
+        }
+    };
+    FDVRRayCasterCPU::Image image;
+    if (!isRefining)
+        image = exec();
+    else {
+        // Averages the refining frames. Refined images are kept until the view changes.
+        if (refinedFrameNum < std::max(rndrParams.RefinementFrameNum, 1)) {
+            image = exec();
+            if (refinedFrameNum == 0 || refinedSize != image.Size) {
+                refinedSize = image.Size;
+                refinedPixels = image.Pixels;
+                refinedFrameNum = 1;
+            } else {
+                auto weight = 1.f / (refinedFrameNum + 1);
+                for (int64 i = 0; i < refinedPixels.Num(); ++i)
+                    refinedPixels[i] += (image.Pixels[i] - refinedPixels[i]) * weight;
+                ++refinedFrameNum;
+            }
+        }
+        image.Size = refinedSize;
+        image.Pixels = refinedPixels;
+    }
+    if (image.Pixels.IsEmpty())
+        return;
+
+    auto &grphBldr = *PostQpqRndrParams.GraphBuilder;
+    auto imageTex = grphBldr.CreateTexture(
+        FRDGTextureDesc::Create2D(image.Size, PF_A32B32G32R32F, FClearValueBinding::None,
+                                  TexCreate_ShaderResource),
+        TEXT("CPU DVR Image"));
+
+    auto uploadParams = grphBldr.AllocParameters<FDVRCPUImageUploadParameters>();
+    uploadParams->Texture = imageTex;
+    grphBldr.AddPass(RDG_EVENT_NAME("Upload CPU DVR Image"), uploadParams, ERDGPassFlags::Copy,
+                     [imageTex, image = MoveTemp(image)](FRHICommandListImmediate &RHICmdList) {
+                         RHICmdList.UpdateTexture2D(
+                             imageTex->GetRHI(), 0,
+                             FUpdateTextureRegion2D(0, 0, 0, 0, image.Size.X, image.Size.Y),
+                             sizeof(FLinearColor) * image.Size.X,
+                             reinterpret_cast<const uint8 *>(image.Pixels.GetData()));
+                     });
+
+    // Premultiplied image is blended over the scene color and stretched to the viewport
+    auto copyParams = grphBldr.AllocParameters<FCopyRectPS::FParameters>();
+    copyParams->InputTexture = imageTex;
+    copyParams->InputSampler = TStaticSamplerState<SF_Bilinear>::GetRHI();
+    copyParams->RenderTargets[0] =
+        FRenderTargetBinding(PostQpqRndrParams.ColorTexture, ERenderTargetLoadAction::ELoad);
+    AddDrawScreenPass(
+        grphBldr, RDG_EVENT_NAME("CPU Direct Volume Rendering"), view,
+        FScreenPassTextureViewport(PostQpqRndrParams.ColorTexture, PostQpqRndrParams.ViewportRect),
+        FScreenPassTextureViewport(imageTex), TShaderMapRef<FScreenPassVS>(view.ShaderMap),
+        TShaderMapRef<FCopyRectPS>(view.ShaderMap),
+        TStaticBlendState<CW_RGBA, BO_Add, BF_One, BF_InverseSourceAlpha, BO_Add, BF_Zero,
+                          BF_InverseSourceAlpha>::GetRHI(),
+        copyParams);
+}
+
+bool FDVRRenderer::syncOccupancy(OccupancyCache &Cache, int32 BrickSize,
+                                 const TSharedPtr<const TArray<uint8>> &VolDat,
+                                 const FIntVector &Dimension, ESupportedVoxelType VoxTy,
+                                 const TSharedPtr<const TArray<FLinearColor>> &TF,
+                                 int32 TFRowNum) {
+    auto &rndrParams = rndrState.Get();
+    if (!VolDat.IsValid() || !TF.IsValid() ||
+        static_cast<int64>(Dimension.X) * Dimension.Y * Dimension.Z *
+                VolumeData::GetVoxelSize(VoxTy) >
+            VolDat->Num())
+        return false;
+
+    auto &occupancy = Cache.Occupancy;
+    if (!occupancy || Cache.VolumeData != VolDat || occupancy->GetDimension() != Dimension ||
+        occupancy->GetBrickSize() != BrickSize) {
+        Cache.VolumeData = VolDat;
+        FVolumeOccupancy::Parameters params{.BrickSize = BrickSize, .Dimension = Dimension};
+        switch (VoxTy) {
+        case ESupportedVoxelType::UInt8:
+            occupancy = MakeShared<FVolumeOccupancy>(params, VolDat->GetData());
+            break;
+        case ESupportedVoxelType::UInt16:
+            occupancy = MakeShared<FVolumeOccupancy>(
+                params, reinterpret_cast<const uint16 *>(VolDat->GetData()));
+            break;
+        case ESupportedVoxelType::Float32:
+            occupancy = MakeShared<FVolumeOccupancy>(
+                params, reinterpret_cast<const float *>(VolDat->GetData()));
+            break;
+        default:
+            occupancy.Reset();
+            return false;
+        }
+        Cache.TransferFunction.Reset();
+    }
+    if (Cache.TransferFunction != TF) {
+        Cache.TransferFunction = TF;
+
+        // Opacities of single scalars lie on the diagonal of a pre-integrated transfer function.
+        // A 2D one is bounded by the maximum over its rows of gradient magnitudes.
+        constexpr auto tfRes = TransferFunctionData::Resolution;
+        auto &tf = *Cache.TransferFunction;
+        auto rowSz = rndrParams.UsePreIntegratedTF ? tfRes * tfRes : tfRes;
+        TArray<float> alphas;
+        if (tf.Num() == rowSz * TFRowNum) {
+            alphas.Init(0.f, tfRes);
+            for (int32 r = 0; r < TFRowNum; ++r)
+                for (int32 i = 0; i < tfRes; ++i)
+                    alphas[i] = std::max(
+                        alphas[i],
+                        tf[r * rowSz + (rndrParams.UsePreIntegratedTF ? i * tfRes + i : i)].A);
+        }
+        occupancy->UpdateTransferFunction(alphas);
+    }
+    return true;
+}
+
+void FDVRRenderer::updateBrickPool(FPostOpaqueRenderParameters &PostQpqRndrParams) {
+    auto &rndrParams = rndrState.Get();
+    auto &geoParams = geoState.Get();
+    if (!rndrParams.VolumeCPUData.IsValid() || !rndrParams.TransferFunctionCPUData.IsValid() ||
+        !geoParams.GeoRef.IsValid())
+        return;
+
+    auto &voxPerVol = rndrParams.Dimension;
+    auto voxTy = rndrParams.VoxelType;
+    auto brickSz = std::max(rndrParams.PoolBrickSize, 1);
+    if (!syncOccupancy(brickOccupancyCache, brickSz, rndrParams.VolumeCPUData, voxPerVol, voxTy,
+                       rndrParams.TransferFunctionCPUData,
+                       rndrParams.Use2DTF ? TransferFunction2DData::GradientResolution : 1))
+        return;
+    auto &occupancy = *brickOccupancyCache.Occupancy;
+
+    auto slotNumPerAxis = std::max(rndrParams.PoolSlotNumPerAxis, 1);
+    if (!brickAtlas || brickAtlas->GetDimension() != voxPerVol ||
+        brickAtlas->GetBrickSize() != brickSz || brickAtlas->GetVoxelType() != voxTy ||
+        brickAtlas->GetSlotNumPerAxis() != slotNumPerAxis)
+        brickAtlas = MakeShared<FBrickAtlas>(
+            FBrickAtlas::Parameters{.BrickSize = brickSz,
+                                    .SlotNumPerAxis = slotNumPerAxis,
+                                    .MaxLoadNum = rndrParams.MaxBrickLoadNum,
+                                    .VoxelType = voxTy,
+                                    .Dimension = voxPerVol});
+
+    // Bricks of non-zero opacity in the view frustum are requested, whose priorities are the
+    // fractions of the screen covered by their bounding spheres times their max opacities
+    auto &view = *PostQpqRndrParams.View;
+    auto viewProj = view.ViewMatrices.GetViewProjectionMatrix();
+    auto projScale = view.ViewMatrices.GetProjectionMatrix().M[0][0];
+    auto toUnreal = [&](const FVector &Coord) {
+        return geoParams.GeoRef->TransformLongitudeLatitudeHeightToUnreal(
+            FVector(FMath::Lerp(geoParams.LongtitudeRange[0], geoParams.LongtitudeRange[1],
+                                FMath::Min(Coord.X, 1.)),
+                    FMath::Lerp(geoParams.LatitudeRange[0], geoParams.LatitudeRange[1],
+                                FMath::Min(Coord.Y, 1.)),
+                    FMath::Lerp(geoParams.HeightRange[0], geoParams.HeightRange[1],
+                                FMath::Min(Coord.Z, 1.))));
+    };
+    auto &brickNum = occupancy.GetBrickNumber();
+    auto invDim = FVector(1.) / FVector(voxPerVol);
+    TArray<FBrickResidency::Request> requests;
+    FIntVector brick;
+    for (brick.Z = 0; brick.Z < brickNum.Z; ++brick.Z)
+        for (brick.Y = 0; brick.Y < brickNum.Y; ++brick.Y)
+            for (brick.X = 0; brick.X < brickNum.X; ++brick.X) {
+                auto maxAlpha = occupancy.GetAlphaRange(brick).Y;
+                if (maxAlpha <= 0.f)
+                    continue;
+
+                auto minPos = toUnreal(FVector(brick * brickSz) * invDim);
+                auto maxPos = toUnreal(FVector((brick + FIntVector(1)) * brickSz) * invDim);
+                auto center = toUnreal((FVector(brick) + .5) * brickSz * invDim);
+                auto radius = .5 * FVector::Dist(minPos, maxPos);
+
+                auto clipPos = viewProj.TransformFVector4(FVector4(center, 1.));
+                auto coverage = 1.;
+                if (clipPos.W > radius) {
+                    auto ndcRadius = radius * projScale / clipPos.W;
+                    if (FMath::Abs(clipPos.X / clipPos.W) - ndcRadius > 1. ||
+                        FMath::Abs(clipPos.Y / clipPos.W) - ndcRadius > 1.)
+                        continue;
+                    coverage = FMath::Min(UE_DOUBLE_PI * ndcRadius * ndcRadius * .25, 1.);
+                } else if (clipPos.W < -radius)
+                    continue;
+
+                requests.Emplace(FBrickResidency::Request{
+                    (brick.Z * brickNum.Y + brick.Y) * brickNum.X + brick.X,
+                    static_cast<float>(coverage * maxAlpha)});
+            }
+
+    // Images refined from fewer resident bricks are stale
+    if (brickAtlas->Update(PostQpqRndrParams.GraphBuilder->RHICmdList, requests,
+                           rndrParams.VolumeCPUData->GetData()) != 0)
+        isRefinementDirty = true;
 }
 
 template <typename ShaderTy>
 void FDVRRenderer::render(FPostOpaqueRenderParameters &PostQpqRndrParams) {
  /*   using ShaderParamsType = ShaderTy::FParameters;
 
+    auto &rndrParams = rndrState.Get();
+    auto &geoParams = geoState.Get();
+
     auto &grphBldr = *PostQpqRndrParams.GraphBuilder;
 
     auto rndrSz = FIntVector2(PostQpqRndrParams.ViewportRect.Width(),
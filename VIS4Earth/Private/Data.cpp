@@ -6,6 +6,10 @@
 #include <map>
 #include <algorithm>
 
+#include "Async/ParallelFor.h"
+
+#include "VolumeSmootherCPU.h"
+
 TVariant<UVolumeTexture *, FString>
 VolumeData::LoadFromFile(const LoadFromFileDesc &Desc,
                          TOptional<std::reference_wrapper<TArray<uint8>>> VolumeOut) {
@@ -93,12 +97,15 @@ VolumeData::LoadFromFile(const LoadFromFileDesc &Desc,
         #endif
         //tex->AddressMode = TextureAddress::TA_Clamp;
 
-        auto platformData = *tex->GetRunningPlatformData();
-        auto *texDat = platformData->Mips[0].BulkData.Lock(EBulkDataLockFlags::LOCK_READ_WRITE);
-        FMemory::Memcpy(texDat, dat, volSz);
-        platformData->Mips[0].BulkData.Unlock();
+        if (Desc.UploadToGPU) {
+            auto platformData = *tex->GetRunningPlatformData();
+            auto *texDat =
+                platformData->Mips[0].BulkData.Lock(EBulkDataLockFlags::LOCK_READ_WRITE);
+            FMemory::Memcpy(texDat, dat, volSz);
+            platformData->Mips[0].BulkData.Unlock();
 
-        tex->UpdateResource();
+            tex->UpdateResource();
+        }
 
         if (VolumeOut.IsSet())
             VolumeOut->get() = std::move(buf);
@@ -123,67 +130,40 @@ VolumeData::SmoothFromFlatArray(const SmoothFromFlatArrayDesc &Desc,
                                 TOptional<std::reference_wrapper<TArray<uint8>>> SmoothedVolOut) {
     using RetType = TVariant<UVolumeTexture *, FString>;
 
-    auto voxPerVolYxX = static_cast<uint64>(Desc.Dimension.Y) * Desc.Dimension.X;
+    if (Desc.Dimension.X <= 0 || Desc.Dimension.Y <= 0 || Desc.Dimension.Z <= 0)
+        return RetType(TInPlaceType<FString>(), FString::Format(TEXT("Invalid Desc.Dimension {0}."),
+                                                                {Desc.Dimension.ToString()}));
 
     TArray<uint8> buf;
     buf.SetNum(Desc.VolDat.Num());
 
-    auto smoothKernelMax = [&]<SupportedVoxelType T>(const T *dat, const FIntVector &pos) -> T {
-        auto scalar = std::numeric_limits<T>::min();
-        FIntVector dPos(pos.X == 0 ? 0 : -1, pos.Y == 0 ? 0 : -1,
-                         Desc.SmoothDim == EVolumeSmoothDimension::XY || pos.Z == 0 ? 0 : -1);
-        for (; dPos.Z <
-               (Desc.SmoothDim == EVolumeSmoothDimension::XY || pos.Z == Desc.Dimension.Z - 1 ? 1
-                                                                                              : 2);
-             ++dPos.Z)
-            for (; dPos.Y < (pos.Y == Desc.Dimension.Y - 1 ? 1 : 2); ++dPos.Y)
-                for (; dPos.X < (pos.X == Desc.Dimension.X - 1 ? 1 : 2); ++dPos.X) {
-                    auto newPos = pos + dPos;
-                    scalar = std::max(
-                        scalar,
-                        dat[newPos.Z * voxPerVolYxX + newPos.Y * Desc.Dimension.X + newPos.X]);
-                }
-        return scalar;
-    };
-    auto smoothKernelAvg = [&]<SupportedVoxelType T>(const T *dat, const FIntVector &pos) -> T {
-        float scalar = 0.f;
-        int32 num = 0.f;
-        FIntVector dPos(pos.X == 0 ? 0 : -1, pos.Y == 0 ? 0 : -1,
-                         Desc.SmoothDim != EVolumeSmoothDimension::XY || pos.Z == 0 ? 0 : -1);
-        for (; dPos.Z <
-               (Desc.SmoothDim != EVolumeSmoothDimension::XY || pos.Z == Desc.Dimension.Z - 1 ? 1
-                                                                                              : 2);
-             ++dPos.Z)
-            for (; dPos.Y < (pos.Y == Desc.Dimension.Y - 1 ? 1 : 2); ++dPos.Y)
-                for (; dPos.X < (pos.X == Desc.Dimension.X - 1 ? 1 : 2); ++dPos.X) {
-                    auto newPos = pos + dPos;
-                    scalar += dat[newPos.Z * voxPerVolYxX + newPos.Y * Desc.Dimension.X + newPos.X];
-                    ++num;
-                }
-        if constexpr (std::is_floating_point_v<T>)
-            return scalar / num;
-        else
-            return static_cast<T>(std::roundf(scalar / num));
-    };
     auto smooth = [&]<SupportedVoxelType T>(T *newDat, const T *oldDat) -> RetType {
-        int32 idx = 0;
-        FIntVector pos;
-        for (pos.Z = 0; pos.Z < Desc.Dimension.Z; ++pos.Z)
-            for (pos.Y = 0; pos.Y < Desc.Dimension.Y; ++pos.Y)
-                for (pos.X = 0; pos.X < Desc.Dimension.X; ++pos.X) {
-                    newDat[idx] = Desc.SmoothTy == EVolumeSmoothType::Avg
-                                      ? smoothKernelAvg(oldDat, pos)
-                                      : smoothKernelMax(oldDat, pos);
-                    ++idx;
-                }
-
-        auto volSz = sizeof(T) * Desc.Dimension.X * Desc.Dimension.Y * Desc.Dimension.Z;
+        auto voxNum = static_cast<int64>(Desc.Dimension.X) * Desc.Dimension.Y * Desc.Dimension.Z;
+        auto volSz = sizeof(T) * voxNum;
         if (Desc.VolDat.Num() != volSz)
             return RetType(
                 TInPlaceType<FString>(),
                 FString::Format(
                     TEXT("Size of Desc.VolDat {0} is not the same as Desc.Dimension {1}."),
                     {Desc.VolDat.Num(), Desc.Dimension.ToString()}));
+
+        auto smoothed = FVolumeSmootherCPU::Exec({.SmoothType = Desc.SmoothTy,
+                                                  .SmoothDimension = Desc.SmoothDim,
+                                                  .Radius = Desc.Radius,
+                                                  .Sigma = Desc.Sigma,
+                                                  .Dimension = Desc.Dimension},
+                                                 oldDat);
+        ParallelFor(Desc.Dimension.Z, [&](int32 z) {
+            auto voxPerVolYxX = static_cast<int64>(Desc.Dimension.Y) * Desc.Dimension.X;
+            for (int64 i = z * voxPerVolYxX; i < (z + 1) * voxPerVolYxX; ++i)
+                if constexpr (std::is_floating_point_v<T>)
+                    newDat[i] = smoothed[i];
+                else
+                    newDat[i] = static_cast<T>(std::clamp(
+                        std::roundf(smoothed[i]), 0.f,
+                        static_cast<float>(std::numeric_limits<T>::max())));
+        });
+
         UVolumeTexture *VolumeTexturet = NewObject<UVolumeTexture>(UVolumeTexture::StaticClass());
         VolumeTexturet->PlatformData = new FTexturePlatformData();
         VolumeTexturet->PlatformData->SizeX = Desc.Dimension.X;
@@ -215,11 +195,356 @@ VolumeData::SmoothFromFlatArray(const SmoothFromFlatArrayDesc &Desc,
     case ESupportedVoxelType::UInt8:
         return smooth(reinterpret_cast<uint8 *>(buf.GetData()),
                       reinterpret_cast<const uint8 *>(Desc.VolDat.GetData()));
+    case ESupportedVoxelType::UInt16:
+        return smooth(reinterpret_cast<uint16 *>(buf.GetData()),
+                      reinterpret_cast<const uint16 *>(Desc.VolDat.GetData()));
+    case ESupportedVoxelType::Float32:
+        return smooth(reinterpret_cast<float *>(buf.GetData()),
+                      reinterpret_cast<const float *>(Desc.VolDat.GetData()));
+    default:
+        return RetType(TInPlaceType<FString>(), TEXT("Invalid Desc.VoxTy."));
+    }
+}
+
+TVariant<VolumeStatistics, FString>
+VolumeStatistics::FromFlatArray(const FromFlatArrayDesc &Desc) {
+    using RetType = TVariant<VolumeStatistics, FString>;
+
+    if (Desc.Dimension.X <= 0 || Desc.Dimension.Y <= 0 || Desc.Dimension.Z <= 0)
+        return RetType(TInPlaceType<FString>(), FString::Format(TEXT("Invalid Desc.Dimension {0}."),
+                                                                {Desc.Dimension.ToString()}));
+
+    auto stat = [&]<SupportedVoxelType T>(const T *dat) -> RetType {
+        auto voxPerVolYxX = static_cast<int64>(Desc.Dimension.Y) * Desc.Dimension.X;
+        if (Desc.VolDat.Num() != sizeof(T) * voxPerVolYxX * Desc.Dimension.Z)
+            return RetType(
+                TInPlaceType<FString>(),
+                FString::Format(
+                    TEXT("Size of Desc.VolDat {0} is not the same as Desc.Dimension {1}."),
+                    {Desc.VolDat.Num(), Desc.Dimension.ToString()}));
+
+        VolumeStatistics stats;
+        stats.VoxTy = Desc.VoxTy;
+        stats.PerHeight.SetNum(Desc.Dimension.Z);
+
+        auto binNum = GetHistogramResolution(Desc.VoxTy);
+
+        // One pass per height level, then levels are merged into the volume
+        TArray<double> sqrSums;
+        sqrSums.SetNumZeroed(Desc.Dimension.Z);
+        ParallelFor(Desc.Dimension.Z, [&](int32 z) {
+            auto &lvl = stats.PerHeight[z];
+            lvl.VoxelNum = voxPerVolYxX;
+            lvl.Min = std::numeric_limits<float>::max();
+            lvl.Max = std::numeric_limits<float>::lowest();
+
+            double sum = 0., sqrSum = 0.;
+            auto lvlDat = dat + z * voxPerVolYxX;
+            for (int64 i = 0; i < voxPerVolYxX; ++i) {
+                auto scalar = static_cast<float>(lvlDat[i]);
+                lvl.Min = std::min(lvl.Min, scalar);
+                lvl.Max = std::max(lvl.Max, scalar);
+                sum += scalar;
+                sqrSum += static_cast<double>(scalar) * scalar;
+            }
+
+            lvl.Mean = sum / voxPerVolYxX;
+            lvl.Variance = std::max(sqrSum / voxPerVolYxX - lvl.Mean * lvl.Mean, 0.);
+            sqrSums[z] = sqrSum;
+        });
+
+        auto &vol = stats.Volume;
+        vol.Min = std::numeric_limits<float>::max();
+        vol.Max = std::numeric_limits<float>::lowest();
+        double sum = 0., sqrSum = 0.;
+        for (int32 z = 0; z < Desc.Dimension.Z; ++z) {
+            auto &lvl = stats.PerHeight[z];
+            vol.Min = std::min(vol.Min, lvl.Min);
+            vol.Max = std::max(vol.Max, lvl.Max);
+            vol.VoxelNum += lvl.VoxelNum;
+            sum += lvl.Mean * lvl.VoxelNum;
+            sqrSum += sqrSums[z];
+        }
+        vol.Mean = sum / vol.VoxelNum;
+        vol.Variance = std::max(sqrSum / vol.VoxelNum - vol.Mean * vol.Mean, 0.);
+
+        // Histograms take a second pass, since float ranges are only known after the first
+        if constexpr (std::is_same_v<T, float>)
+            stats.HistogramRange = FVector2f(vol.Min, vol.Max);
+        else {
+            auto [vxMin, vxMax, vxExt] = VolumeData::GetVoxelMinMaxExtent(Desc.VoxTy);
+            stats.HistogramRange = FVector2f(vxMin, vxMax);
+        }
+        ParallelFor(Desc.Dimension.Z, [&](int32 z) {
+            auto &lvl = stats.PerHeight[z];
+            lvl.Histogram.SetNumZeroed(binNum);
+            auto lvlDat = dat + z * voxPerVolYxX;
+            for (int64 i = 0; i < voxPerVolYxX; ++i)
+                ++lvl.Histogram[GetHistogramBin(static_cast<float>(lvlDat[i]),
+                                                stats.HistogramRange, binNum)];
+        });
+        vol.Histogram.SetNumZeroed(binNum);
+        for (auto &lvl : stats.PerHeight)
+            for (int32 b = 0; b < binNum; ++b)
+                vol.Histogram[b] += lvl.Histogram[b];
+
+        return RetType(TInPlaceType<VolumeStatistics>(), std::move(stats));
+    };
+
+    switch (Desc.VoxTy) {
+    case ESupportedVoxelType::UInt8:
+        return stat(reinterpret_cast<const uint8 *>(Desc.VolDat.GetData()));
+    case ESupportedVoxelType::UInt16:
+        return stat(reinterpret_cast<const uint16 *>(Desc.VolDat.GetData()));
+    case ESupportedVoxelType::Float32:
+        return stat(reinterpret_cast<const float *>(Desc.VolDat.GetData()));
+    default:
+        return RetType(TInPlaceType<FString>(), TEXT("Invalid Desc.VoxTy."));
+    }
+}
+
+TVariant<ContourSpectrum, FString>
+ContourSpectrum::FromFlatArray(const FromFlatArrayDesc &Desc) {
+    using RetType = TVariant<ContourSpectrum, FString>;
+
+    if (Desc.Dimension.X < 2 || Desc.Dimension.Y < 2 || Desc.Dimension.Z < 2)
+        return RetType(TInPlaceType<FString>(), FString::Format(TEXT("Invalid Desc.Dimension {0}."),
+                                                                {Desc.Dimension.ToString()}));
+    if (Desc.Resolution < 2)
+        return RetType(TInPlaceType<FString>(), FString::Format(TEXT("Invalid Desc.Resolution {0}."),
+                                                                {Desc.Resolution}));
+
+    auto spectrum = [&]<SupportedVoxelType T>(const T *dat) -> RetType {
+        auto voxPerVolYxX = static_cast<int64>(Desc.Dimension.Y) * Desc.Dimension.X;
+        if (Desc.VolDat.Num() != sizeof(T) * voxPerVolYxX * Desc.Dimension.Z)
+            return RetType(
+                TInPlaceType<FString>(),
+                FString::Format(
+                    TEXT("Size of Desc.VolDat {0} is not the same as Desc.Dimension {1}."),
+                    {Desc.VolDat.Num(), Desc.Dimension.ToString()}));
+
+        auto n = Desc.Resolution;
+        auto isoMin = static_cast<double>(Desc.IsoValueRange[0]);
+        auto isoDlt = std::max(static_cast<double>(Desc.IsoValueRange[1]) - isoMin,
+                               static_cast<double>(UE_SMALL_NUMBER)) /
+                      (n - 1);
+        auto isoValue = [&](int32 k) { return isoMin + k * isoDlt; };
+        // Index of the first isovalue strictly greater than Scalar
+        auto firstAbove = [&](double scalar) {
+            return static_cast<int32>(
+                std::clamp(std::floor((scalar - isoMin) / isoDlt) + 1., 0., static_cast<double>(n)));
+        };
+
+        // Each tetrahedron walks from corner 0 to corner 7 changing one axis per edge,
+        // where corner index is x | y << 1 | z << 2
+        static constexpr std::array<std::array<int32, 4>, 6> tets = {
+            std::array{0, 1, 3, 7}, std::array{0, 1, 5, 7}, std::array{0, 2, 3, 7},
+            std::array{0, 2, 6, 7}, std::array{0, 4, 5, 7}, std::array{0, 4, 6, 7}};
+        static constexpr auto tetVol = 1. / 6.;
+
+        // Accumulated per cell layer, then reduced in order to keep results deterministic
+        struct LayerAccumulator {
+            TArray<double> Area;
+            TArray<double> Volume;
+            TArray<double> VolumeDiff;
+            TArray<int64> ActiveCellNumDiff;
+        };
+        TArray<LayerAccumulator> layers;
+        layers.SetNum(Desc.Dimension.Z - 1);
+        ParallelFor(Desc.Dimension.Z - 1, [&](int32 z) {
+            auto &acc = layers[z];
+            acc.Area.SetNumZeroed(n);
+            acc.Volume.SetNumZeroed(n);
+            acc.VolumeDiff.SetNumZeroed(n + 1);
+            acc.ActiveCellNumDiff.SetNumZeroed(n + 1);
+
+            std::array<double, 8> scalars;
+            for (int32 y = 0; y < Desc.Dimension.Y - 1; ++y)
+                for (int32 x = 0; x < Desc.Dimension.X - 1; ++x) {
+                    for (int32 c = 0; c < 8; ++c)
+                        scalars[c] = dat[(z + (c >> 2)) * voxPerVolYxX +
+                                         (y + ((c >> 1) & 1)) * Desc.Dimension.X + x + (c & 1)];
+
+                    // A cell is active for isovalues in (min, max], same as scalar >= IsoValue
+                    // being inside in marching cubes
+                    auto [cMin, cMax] = std::minmax_element(scalars.begin(), scalars.end());
+                    if (auto kLo = firstAbove(*cMin), kHi = firstAbove(*cMax); kLo < kHi) {
+                        ++acc.ActiveCellNumDiff[kLo];
+                        --acc.ActiveCellNumDiff[kHi];
+                    }
+
+                    for (auto &tet : tets) {
+                        std::array<double, 4> knots;
+                        auto gradSqr = 0.;
+                        for (int32 i = 0; i < 4; ++i) {
+                            knots[i] = scalars[tet[i]];
+                            if (i != 0)
+                                gradSqr += FMath::Square(knots[i] - knots[i - 1]);
+                        }
+                        std::sort(knots.begin(), knots.end());
+
+                        // Isovalues not above the minimum see the whole tetrahedron enclosed
+                        auto k0 = firstAbove(knots[0]);
+                        auto k3 = firstAbove(knots[3]);
+                        acc.VolumeDiff[0] += tetVol;
+                        acc.VolumeDiff[k0] -= tetVol;
+                        if (k0 == k3)
+                            continue;
+
+                        // Separate coincident knots so that the truncated power form is defined
+                        auto minGap = 1e-4 * (knots[3] - knots[0]);
+                        for (int32 i = 1; i < 4; ++i)
+                            knots[i] = std::max(knots[i], knots[i - 1] + minGap);
+                        std::array<double, 4> denoms;
+                        for (int32 i = 0; i < 4; ++i) {
+                            denoms[i] = 1.;
+                            for (int32 j = 0; j < 4; ++j)
+                                if (j != i)
+                                    denoms[i] *= knots[i] - knots[j];
+                        }
+
+                        auto gradMag = std::sqrt(gradSqr);
+                        for (auto k = k0; k < k3; ++k) {
+                            auto w = isoValue(k);
+                            auto cdf = 1., pdf = 0.;
+                            for (int32 i = 0; i < 4; ++i) {
+                                auto d = std::max(knots[i] - w, 0.);
+                                cdf -= d * d * d / denoms[i];
+                                pdf += 3. * d * d / denoms[i];
+                            }
+                            acc.Volume[k] += tetVol * (1. - std::clamp(cdf, 0., 1.));
+                            acc.Area[k] += tetVol * gradMag * std::max(pdf, 0.);
+                        }
+                    }
+                }
+        });
+
+        ContourSpectrum ret;
+        ret.IsoValues.SetNum(n);
+        ret.Area.SetNumZeroed(n);
+        ret.EnclosedVolume.SetNumZeroed(n);
+        ret.ActiveCellNum.SetNumZeroed(n);
+        for (int32 k = 0; k < n; ++k)
+            ret.IsoValues[k] = static_cast<float>(isoValue(k));
+        for (auto &acc : layers) {
+            double volDiffSum = 0.;
+            int64 actCellNumDiffSum = 0;
+            for (int32 k = 0; k < n; ++k) {
+                volDiffSum += acc.VolumeDiff[k];
+                actCellNumDiffSum += acc.ActiveCellNumDiff[k];
+
+                ret.Area[k] += acc.Area[k];
+                ret.EnclosedVolume[k] += acc.Volume[k] + volDiffSum;
+                ret.ActiveCellNum[k] += actCellNumDiffSum;
+            }
+        }
+
+        return RetType(TInPlaceType<ContourSpectrum>(), std::move(ret));
+    };
+
+    switch (Desc.VoxTy) {
+    case ESupportedVoxelType::UInt8:
+        return spectrum(reinterpret_cast<const uint8 *>(Desc.VolDat.GetData()));
+    case ESupportedVoxelType::UInt16:
+        return spectrum(reinterpret_cast<const uint16 *>(Desc.VolDat.GetData()));
+    case ESupportedVoxelType::Float32:
+        return spectrum(reinterpret_cast<const float *>(Desc.VolDat.GetData()));
+    default:
+        return RetType(TInPlaceType<FString>(), TEXT("Invalid Desc.VoxTy."));
+    }
+}
+
+TVariant<GradientVolume, FString> GradientVolume::FromFlatArray(const FromFlatArrayDesc &Desc) {
+    using RetType = TVariant<GradientVolume, FString>;
+
+    if (Desc.Dimension.X <= 0 || Desc.Dimension.Y <= 0 || Desc.Dimension.Z <= 0)
+        return RetType(TInPlaceType<FString>(), FString::Format(TEXT("Invalid Desc.Dimension {0}."),
+                                                                {Desc.Dimension.ToString()}));
+
+    auto gradient = [&]<SupportedVoxelType T>(const T *dat) -> RetType {
+        auto voxPerVolYxX = static_cast<int64>(Desc.Dimension.Y) * Desc.Dimension.X;
+        if (Desc.VolDat.Num() != sizeof(T) * voxPerVolYxX * Desc.Dimension.Z)
+            return RetType(
+                TInPlaceType<FString>(),
+                FString::Format(
+                    TEXT("Size of Desc.VolDat {0} is not the same as Desc.Dimension {1}."),
+                    {Desc.VolDat.Num(), Desc.Dimension.ToString()}));
+
+        auto at = [&](const FIntVector &p) {
+            return static_cast<float>(
+                dat[p.Z * voxPerVolYxX + static_cast<int64>(p.Y) * Desc.Dimension.X + p.X]);
+        };
+        // Central difference inside, one-sided on the borders
+        auto gradAt = [&](const FIntVector &pos) {
+            FVector3f ret;
+            for (int32 axis = 0; axis < 3; ++axis) {
+                auto n = Desc.Dimension[axis];
+                if (n == 1) {
+                    ret[axis] = 0.f;
+                    continue;
+                }
+                auto p0 = pos, p1 = pos;
+                p0[axis] = std::max(pos[axis] - 1, 0);
+                p1[axis] = std::min(pos[axis] + 1, n - 1);
+                ret[axis] = (at(p1) - at(p0)) / (p1[axis] - p0[axis]);
+            }
+            return ret;
+        };
+
+        // Slices are differenced twice, once for the maximum magnitude and once to quantize
+        // them, instead of keeping gradients of the whole volume in float in between
+        TArray<float> maxMags;
+        maxMags.SetNumZeroed(Desc.Dimension.Z);
+        ParallelFor(Desc.Dimension.Z, [&](int32 z) {
+            FIntVector pos(0, 0, z);
+            for (pos.Y = 0; pos.Y < Desc.Dimension.Y; ++pos.Y)
+                for (pos.X = 0; pos.X < Desc.Dimension.X; ++pos.X)
+                    maxMags[z] = std::max(maxMags[z], gradAt(pos).Size());
+        });
+
+        GradientVolume ret;
+        ret.Dimension = Desc.Dimension;
+        for (auto mag : maxMags)
+            ret.MaxMagnitude = std::max(ret.MaxMagnitude, mag);
+        ret.Voxels.SetNumUninitialized(voxPerVolYxX * Desc.Dimension.Z);
+        ParallelFor(Desc.Dimension.Z, [&](int32 z) {
+            auto lvlVoxels = ret.Voxels.GetData() + z * voxPerVolYxX;
+            FIntVector pos(0, 0, z);
+            for (pos.Y = 0; pos.Y < Desc.Dimension.Y; ++pos.Y)
+                for (pos.X = 0; pos.X < Desc.Dimension.X; ++pos.X)
+                    lvlVoxels[static_cast<int64>(pos.Y) * Desc.Dimension.X + pos.X] =
+                        Encode(gradAt(pos), ret.MaxMagnitude);
+        });
+
+        return RetType(TInPlaceType<GradientVolume>(), std::move(ret));
+    };
+
+    switch (Desc.VoxTy) {
+    case ESupportedVoxelType::UInt8:
+        return gradient(reinterpret_cast<const uint8 *>(Desc.VolDat.GetData()));
+    case ESupportedVoxelType::UInt16:
+        return gradient(reinterpret_cast<const uint16 *>(Desc.VolDat.GetData()));
+    case ESupportedVoxelType::Float32:
+        return gradient(reinterpret_cast<const float *>(Desc.VolDat.GetData()));
     default:
         return RetType(TInPlaceType<FString>(), TEXT("Invalid Desc.VoxTy."));
     }
 }
 
+TArray<float> ContourSpectrum::FindInterestingIsoValues(int32 MaxNum) const {
+    TArray<int32> peaks;
+    for (int32 k = 0; k < Area.Num(); ++k)
+        if ((k == 0 || Area[k] > Area[k - 1]) && (k == Area.Num() - 1 || Area[k] >= Area[k + 1]) &&
+            Area[k] > 0.)
+            peaks.Emplace(k);
+    peaks.Sort([&](int32 K0, int32 K1) { return Area[K0] > Area[K1]; });
+
+    TArray<float> ret;
+    for (int32 i = 0; i < std::min(MaxNum, peaks.Num()); ++i)
+        ret.Emplace(IsoValues[peaks[i]]);
+    return ret;
+}
+
 TVariant<TTuple<UTexture2D *, UCurveLinearColor *>, FString>
 TransferFunctionData::LoadFromFile(const Desc &Desc) {
     using ValueType = TTuple<UTexture2D *, UCurveLinearColor *>;
@@ -359,3 +684,251 @@ TransferFunctionData::LerpFromPointsToFlatArray(const TMap<float, FVector4f> &Pn
 
     return dat;
 }
+
+TVariant<TArray<TransferFunction2DData::Widget>, FString>
+TransferFunction2DData::LoadFromFile(const Desc &Desc) {
+    using RetType = TVariant<TArray<Widget>, FString>;
+
+    FJsonSerializableArray buf;
+    if (!FFileHelper::LoadANSITextFileToStrings(*Desc.FilePath.FilePath, nullptr, buf))
+        return RetType(TInPlaceType<FString>(), FString::Format(TEXT("Invalid Desc.FilePath {0}."),
+                                                                {Desc.FilePath.FilePath}));
+
+    TArray<Widget> widgets;
+    for (int i = 0; i < buf.Num(); ++i) {
+        if (buf[i].IsEmpty())
+            continue;
+
+        float lnVars[9] = {0.f};
+        auto validCnt = sscanf_s(TCHAR_TO_ANSI(*buf[i]), "%f%f%f%f%f%f%f%f%f", &lnVars[0],
+                                 &lnVars[1], &lnVars[2], &lnVars[3], &lnVars[4], &lnVars[5],
+                                 &lnVars[6], &lnVars[7], &lnVars[8]);
+        if (validCnt != 9 || lnVars[0] != FMath::RoundToFloat(lnVars[0]) || lnVars[0] < 0.f ||
+            lnVars[0] > static_cast<float>(ETransferFunction2DWidgetType::Gaussian) || [&]() {
+                for (int v = 1; v < 9; ++v)
+                    if (lnVars[v] < 0.f || lnVars[v] >= 255.5f)
+                        return true;
+                return false;
+            }())
+            return RetType(
+                TInPlaceType<FString>(),
+                FString::Format(TEXT("Invalid contents at line {0} in Desc.FilePath {1}."),
+                                {i + 1, Desc.FilePath.FilePath}));
+
+        auto &wdgt = widgets.AddDefaulted_GetRef();
+        wdgt.Type = static_cast<ETransferFunction2DWidgetType>(lnVars[0]);
+        wdgt.Center = FVector2f(lnVars[1], lnVars[2]) / 255.f;
+        wdgt.Extent = FVector2f(lnVars[3], lnVars[4]) / 255.f;
+        wdgt.Color = FLinearColor(
+            std::min(lnVars[5] / 255.f, 1.f), std::min(lnVars[6] / 255.f, 1.f),
+            std::min(lnVars[7] / 255.f, 1.f), std::min(lnVars[8] / 255.f, 1.f));
+    }
+
+    return RetType(TInPlaceType<TArray<Widget>>(), std::move(widgets));
+}
+
+TOptional<FString> TransferFunction2DData::SaveToFile(TConstArrayView<Widget> Widgets,
+                                                      const FFilePath &FilePath) {
+    FJsonSerializableArray buf;
+    for (auto &wdgt : Widgets)
+        buf.Add(FString::Format(
+            TEXT("{0} {1} {2} {3} {4} {5} {6} {7} {8}"),
+            {static_cast<int32>(wdgt.Type), wdgt.Center.X * 255.f, wdgt.Center.Y * 255.f,
+             wdgt.Extent.X * 255.f, wdgt.Extent.Y * 255.f, wdgt.Color.R * 255.f,
+             wdgt.Color.G * 255.f, wdgt.Color.B * 255.f, wdgt.Color.A * 255.f}));
+
+    if (!FFileHelper::SaveStringArrayToFile(buf, *FilePath.FilePath,
+                                            FFileHelper::EEncodingOptions::ForceAnsi))
+        return FString::Format(TEXT("Invalid Desc.FilePath {0}."), {FilePath.FilePath});
+    return {};
+}
+
+TArray<FLinearColor> TransferFunction2DData::Rasterize(TConstArrayView<Widget> Widgets) {
+    TArray<FLinearColor> ret;
+    ret.Init(FLinearColor::Transparent, Resolution * GradientResolution);
+
+    // Each row only visits the entries covered by each widget in it
+    ParallelFor(GradientResolution, [&](int32 g) {
+        auto grad = static_cast<float>(g) / (GradientResolution - 1);
+        auto row = ret.GetData() + g * Resolution;
+        // Sums of a_i x c_i and a_i in row, and products of 1 - a_i in transparencies
+        std::array<float, Resolution> transparencies;
+        transparencies.fill(1.f);
+
+        for (auto &wdgt : Widgets) {
+            // Half width along scalar in this row
+            auto halfWidth = 0.f;
+            auto dGrad = grad - wdgt.Center.Y;
+            switch (wdgt.Type) {
+            case ETransferFunction2DWidgetType::Box:
+                if (FMath::Abs(dGrad) > wdgt.Extent.Y)
+                    continue;
+                halfWidth = wdgt.Extent.X;
+                break;
+            case ETransferFunction2DWidgetType::Triangle:
+                // Widens from the apex at the bottom to Extent.X at the top
+                if (wdgt.Extent.Y <= 0.f || FMath::Abs(dGrad) > wdgt.Extent.Y)
+                    continue;
+                halfWidth = wdgt.Extent.X * (dGrad + wdgt.Extent.Y) / (2.f * wdgt.Extent.Y);
+                break;
+            case ETransferFunction2DWidgetType::Gaussian:
+                // Cut off at 3 sigmas
+                if (wdgt.Extent.X <= 0.f || wdgt.Extent.Y <= 0.f ||
+                    FMath::Abs(dGrad) > 3.f * wdgt.Extent.Y)
+                    continue;
+                halfWidth = 3.f * wdgt.Extent.X;
+                break;
+            default:
+                continue;
+            }
+            auto gradWeight = wdgt.Type == ETransferFunction2DWidgetType::Gaussian
+                                  ? FMath::Exp(-.5f * FMath::Square(dGrad / wdgt.Extent.Y))
+                                  : 1.f;
+
+            constexpr auto maxEntry = Resolution - 1;
+            auto start = std::max(FMath::CeilToInt32((wdgt.Center.X - halfWidth) * maxEntry), 0);
+            auto end =
+                std::min(FMath::FloorToInt32((wdgt.Center.X + halfWidth) * maxEntry), maxEntry);
+            for (int32 s = start; s <= end; ++s) {
+                auto dScalar = static_cast<float>(s) / maxEntry - wdgt.Center.X;
+                auto weight = gradWeight;
+                if (wdgt.Type == ETransferFunction2DWidgetType::Triangle && halfWidth > 0.f)
+                    weight = 1.f - FMath::Abs(dScalar) / halfWidth;
+                else if (wdgt.Type == ETransferFunction2DWidgetType::Gaussian)
+                    weight *= FMath::Exp(-.5f * FMath::Square(dScalar / wdgt.Extent.X));
+                auto a = FMath::Clamp(weight * wdgt.Color.A, 0.f, 1.f);
+                row[s].R += a * wdgt.Color.R;
+                row[s].G += a * wdgt.Color.G;
+                row[s].B += a * wdgt.Color.B;
+                row[s].A += a;
+                transparencies[s] *= 1.f - a;
+            }
+        }
+
+        for (int32 s = 0; s < Resolution; ++s) {
+            if (row[s].A <= 0.f)
+                continue;
+            row[s].R /= row[s].A;
+            row[s].G /= row[s].A;
+            row[s].B /= row[s].A;
+            row[s].A = 1.f - transparencies[s];
+        }
+    });
+
+    return ret;
+}
+
+UTexture2D *TransferFunction2DData::FromFlatArrayToTexture(const TArray<FLinearColor> &Dat,
+                                                           const FName &Name) {
+    auto tex = UTexture2D::CreateTransient(Resolution, GradientResolution, PF_FloatRGBA, Name);
+
+    tex->Filter = TextureFilter::TF_Bilinear;
+#if WITH_EDITOR
+    tex->MipGenSettings = TextureMipGenSettings::TMGS_NoMipmaps;
+#endif
+    tex->AddressX = tex->AddressY = TextureAddress::TA_Clamp;
+
+    auto texDat = reinterpret_cast<FFloat16 *>(
+        tex->GetPlatformData()->Mips[0].BulkData.Lock(EBulkDataLockFlags::LOCK_READ_WRITE));
+    for (int32 i = 0; i < std::min(Dat.Num(), Resolution * GradientResolution); ++i) {
+        texDat[4 * i + 0] = Dat[i].R;
+        texDat[4 * i + 1] = Dat[i].G;
+        texDat[4 * i + 2] = Dat[i].B;
+        texDat[4 * i + 3] = Dat[i].A;
+    }
+    tex->GetPlatformData()->Mips[0].BulkData.Unlock();
+    tex->UpdateResource();
+
+    return tex;
+}
+
+UTexture2D *JointHistogram::ToTexture(const FName &Name) const {
+    if (!IsValid())
+        return nullptr;
+
+    auto tex = UTexture2D::CreateTransient(Resolution.X, Resolution.Y, PF_G8, Name);
+    tex->Filter = TextureFilter::TF_Nearest;
+#if WITH_EDITOR
+    tex->MipGenSettings = TextureMipGenSettings::TMGS_NoMipmaps;
+#endif
+    tex->AddressX = tex->AddressY = TextureAddress::TA_Clamp;
+
+    auto maxCnt = *std::max_element(Counts.begin(), Counts.end());
+    auto invLogMax = maxCnt == 0 ? 0. : 1. / std::log1p(static_cast<double>(maxCnt));
+    auto texDat = reinterpret_cast<uint8 *>(
+        tex->GetPlatformData()->Mips[0].BulkData.Lock(EBulkDataLockFlags::LOCK_READ_WRITE));
+    for (int64 i = 0; i < Counts.Num(); ++i)
+        texDat[i] = static_cast<uint8>(
+            std::round(std::log1p(static_cast<double>(Counts[i])) * invLogMax * 255.));
+    tex->GetPlatformData()->Mips[0].BulkData.Unlock();
+    tex->UpdateResource();
+
+    return tex;
+}
+
+TVariant<JointHistogram, FString> JointHistogram::FromFlatArray(const FromFlatArrayDesc &Desc) {
+    using RetType = TVariant<JointHistogram, FString>;
+
+    if (Desc.Dimension.X <= 0 || Desc.Dimension.Y <= 0 || Desc.Dimension.Z <= 0)
+        return RetType(TInPlaceType<FString>(), FString::Format(TEXT("Invalid Desc.Dimension {0}."),
+                                                                {Desc.Dimension.ToString()}));
+    if (Desc.Resolution.X <= 0 || Desc.Resolution.Y <= 0)
+        return RetType(TInPlaceType<FString>(), FString::Format(TEXT("Invalid Desc.Resolution {0}."),
+                                                                {Desc.Resolution.ToString()}));
+    if (Desc.Gradients.Dimension != Desc.Dimension || !Desc.Gradients.IsValid())
+        return RetType(
+            TInPlaceType<FString>(),
+            FString::Format(TEXT("Desc.Gradients is not of Desc.Dimension {0}."),
+                            {Desc.Dimension.ToString()}));
+
+    auto histogram = [&]<SupportedVoxelType T>(const T *dat) -> RetType {
+        auto voxPerVolYxX = static_cast<int64>(Desc.Dimension.Y) * Desc.Dimension.X;
+        if (Desc.VolDat.Num() != sizeof(T) * voxPerVolYxX * Desc.Dimension.Z)
+            return RetType(
+                TInPlaceType<FString>(),
+                FString::Format(
+                    TEXT("Size of Desc.VolDat {0} is not the same as Desc.Dimension {1}."),
+                    {Desc.VolDat.Num(), Desc.Dimension.ToString()}));
+
+        auto [vxMin, vxMax, vxExt] = VolumeData::GetVoxelMinMaxExtent(Desc.VoxTy);
+        auto binNum = static_cast<int64>(Desc.Resolution.X) * Desc.Resolution.Y;
+
+        // One histogram per height level, then levels are merged in order
+        TArray<TArray<uint32>> lvlCounts;
+        lvlCounts.SetNum(Desc.Dimension.Z);
+        ParallelFor(Desc.Dimension.Z, [&](int32 z) {
+            auto &cnts = lvlCounts[z];
+            cnts.SetNumZeroed(binNum);
+            for (int64 i = z * voxPerVolYxX; i < (z + 1) * voxPerVolYxX; ++i) {
+                auto sBin = std::clamp(
+                    static_cast<int32>((static_cast<float>(dat[i]) - vxMin) / vxExt *
+                                       Desc.Resolution.X),
+                    0, Desc.Resolution.X - 1);
+                auto gBin = std::min(Desc.Gradients.Voxels[i].Magnitude * Desc.Resolution.Y /
+                                         (std::numeric_limits<uint8>::max() + 1),
+                                     Desc.Resolution.Y - 1);
+                ++cnts[static_cast<int64>(gBin) * Desc.Resolution.X + sBin];
+            }
+        });
+
+        JointHistogram ret;
+        ret.Resolution = Desc.Resolution;
+        ret.Counts.SetNumZeroed(binNum);
+        for (auto &cnts : lvlCounts)
+            for (int64 b = 0; b < binNum; ++b)
+                ret.Counts[b] += cnts[b];
+
+        return RetType(TInPlaceType<JointHistogram>(), std::move(ret));
+    };
+
+    switch (Desc.VoxTy) {
+    case ESupportedVoxelType::UInt8:
+        return histogram(reinterpret_cast<const uint8 *>(Desc.VolDat.GetData()));
+    case ESupportedVoxelType::UInt16:
+        return histogram(reinterpret_cast<const uint16 *>(Desc.VolDat.GetData()));
+    case ESupportedVoxelType::Float32:
+        return histogram(reinterpret_cast<const float *>(Desc.VolDat.GetData()));
+    default:
+        return RetType(TInPlaceType<FString>(), TEXT("Invalid Desc.VoxTy."));
+    }
+}
@@ -29,6 +29,7 @@ AMCCActor::AMCCActor() {
     VolumeComponent = CreateDefaultSubobject<UVolumeDataComponent>(TEXT("VolumeData"));
     VolumeComponent->SetKeepVolumeInCPU(true);
     VolumeComponent->SetKeepSmoothedVolume(true);
+    VolumeComponent->SetKeepGradientVolume(UseGradientNormals);
 
     UIComponent = CreateDefaultSubobject<UWidgetComponent>(TEXT("UI"));
     UIComponent->AttachToComponent(RootComponent, FAttachmentTransformRules::KeepRelativeTransform);
@@ -105,12 +106,11 @@ void AMCCActor::checkAndCorrectParameters() {
         return;
 
     {
-        auto [vxMin, vxMax, vxExt] =
-            VolumeData::GetVoxelMinMaxExtent(VolumeComponent->GetVolumeVoxelType());
-        if (IsoValue < vxMin)
-            IsoValue = vxMin;
-        if (IsoValue > vxMax)
-            IsoValue = vxMax;
+        auto [valMin, valMax] = VolumeComponent->GetVolumeValueRange();
+        if (IsoValue < valMin)
+            IsoValue = valMin;
+        if (IsoValue > valMax)
+            IsoValue = valMax;
     }
 
     FIntVector voxPerVol(VolumeComponent->VolumeTexture->GetSizeX(),
@@ -155,6 +155,32 @@ void AMCCActor::marchingCube() {
         auto latExt = GeoComponent->LatitudeRange[1] - GeoComponent->LatitudeRange[0];
         auto hExt = GeoComponent->HeightRange[1] - GeoComponent->HeightRange[0];
 
+        // Gradients of the smoothed volume give smooth normals for either volume
+        auto &grads = VolumeComponent->GetGradientVolume();
+        auto useGradNorm = UseGradientNormals && grads.IsValid() && grads.Dimension == voxPerVol;
+        auto gradientNormal = [&](const FVector &voxPos, const FVector &lonLatH,
+                                  const FVector &pos) {
+            auto grad = FVector(grads.Sample(FVector3f(voxPos)));
+            if (grad.IsNearlyZero())
+                return FVector::Zero();
+
+            // Scalar per voxel -> scalar per meter along east, south and up, where the radius
+            // of the vertex is taken from the ellipsoid it is placed on
+            auto r = GeoComponent->GeoRef
+                         ->TransformLongitudeLatitudeHeightPositionToEarthCenteredEarthFixed(
+                             lonLatH)
+                         .Size();
+            auto cosLat = FMath::Cos(FMath::DegreesToRadians(lonLatH.Y));
+            FVector esu(grad.X * voxPerVol.X /
+                            std::max(FMath::DegreesToRadians(lonExt) * r * cosLat,
+                                     UE_DOUBLE_SMALL_NUMBER),
+                        -grad.Y * voxPerVol.Y / (FMath::DegreesToRadians(latExt) * r),
+                        grad.Z * voxPerVol.Z / hExt);
+            return GeoComponent->GeoRef->ComputeEastSouthUpToUnrealTransformation(pos)
+                .TransformVector(esu)
+                .GetSafeNormal();
+        };
+
         auto hashEdge = [](const FIntVector &edgeID) {
             size_t hash = edgeID.X;
             hash = (hash << 32) | edgeID.Y;
@@ -257,16 +283,14 @@ void AMCCActor::marchingCube() {
                                 startPos.Z + (ei >= 8   ? (UseLerp ? omegas[ei] : .5f)
                                               : ei >= 4 ? 1.f
                                                         : 0.f));
+                            auto voxPos = pos;
                             pos /= FVector(voxPerVol);
-                            pos = [&]() {
-                                auto lon = GeoComponent->LongtitudeRange[0] + pos.X * lonExt;
-                                auto lat = GeoComponent->LatitudeRange[0] + pos.Y * latExt;
-                                auto h = GeoComponent->HeightRange[0] + pos.Z * hExt;
-
-                                return GeoComponent->GeoRef
-                                    ->TransformLongitudeLatitudeHeightToUnreal(
-                                        FVector{lon, lat, h});
-                            }();
+                            FVector lonLatH(
+                                GeoComponent->LongtitudeRange[0] + pos.X * lonExt,
+                                GeoComponent->LatitudeRange[0] + pos.Y * latExt,
+                                GeoComponent->HeightRange[0] + pos.Z * hExt);
+                            pos = GeoComponent->GeoRef->TransformLongitudeLatitudeHeightToUnreal(
+                                lonLatH);
 
                             auto scalar = [&]() {
                                 switch (ei) {
@@ -295,8 +319,13 @@ void AMCCActor::marchingCube() {
 
                             auto id = meshDescBuilder.AppendVertex(pos);
                             indices.Emplace(id);
-                            vertAttrs.emplace(std::piecewise_construct, std::forward_as_tuple(id),
-                                              std::forward_as_tuple(pos, scalar));
+                            auto &vertAttr =
+                                vertAttrs
+                                    .emplace(std::piecewise_construct, std::forward_as_tuple(id),
+                                             std::forward_as_tuple(pos, scalar))
+                                    .first->second;
+                            if (useGradNorm)
+                                vertAttr.GradientNormal = gradientNormal(voxPos, lonLatH, pos);
                             edge2vertIDs[edge2vertIDIdx].emplace(edgeID, indices.Last());
                         }
 
@@ -327,8 +356,14 @@ void AMCCActor::marchingCube() {
                 }
         }
 
-        for (auto &[_, vertAttr] : vertAttrs)
+        for (auto &[_, vertAttr] : vertAttrs) {
             vertAttr.Normal.Normalize();
+            // Gradients point to higher scalars, which are flipped to the side of the faces
+            if (!vertAttr.GradientNormal.IsZero())
+                vertAttr.Normal = vertAttr.GradientNormal.Dot(vertAttr.Normal) < 0.
+                                      ? -vertAttr.GradientNormal
+                                      : vertAttr.GradientNormal;
+        }
     };
 
     switch (VolumeComponent->GetVolumeVoxelType()) {
@@ -4,8 +4,12 @@
 #include "Components/ComboBoxString.h"
 #include "Components/EditableText.h"
 #include "Components/NamedSlot.h"
+#include "DesktopPlatformModule.h"
 #include <Kismet/GameplayStatics.h>
 
+#include "ContourExporter.h"
+#include "VolumeSlicer.h"
+
 
 
 void AMCSActor::OnComboBoxString_LineStyleSelectionChanged(FString SelectedItem,
@@ -91,25 +95,38 @@ void AMCSActor::BeginPlay() {
 }
 
 void AMCSActor::setupSignalsSlots() {
-    GeoComponent->OnGeographicsChanged.AddLambda([this](UGeoComponent *) { setupRenderer(); });
+    // Section paths are mapped by the geographical range, thus are remarched with it
+    GeoComponent->OnGeographicsChanged.AddLambda(
+        [this](UGeoComponent *) { setupRenderer(SectionMode != EMCSSectionMode::None); });
     VolumeComponent->OnTransferFunctionDataChanged.AddLambda(
         [this](UVolumeDataComponent *) { setupRenderer(true); });
-    VolumeComponent->OnVolumeDataChanged.AddLambda(
-        [this](UVolumeDataComponent *) { setupRenderer(true); });
+    VolumeComponent->OnVolumeDataChanged.AddLambda([this](UVolumeDataComponent *) {
+        if (renderer.IsValid())
+            renderer->InvalidateContourCache();
+        setupRenderer(true);
+    });
 }
 
 void AMCSActor::checkAndCorrectParameters() {
     if (!VolumeComponent->VolumeTexture)
         return;
 
-    {
-        auto [vxMin, vxMax, vxExt] =
-            VolumeData::GetVoxelMinMaxExtent(VolumeComponent->GetVolumeVoxelType());
-        if (IsoValue < vxMin)
-            IsoValue = vxMin;
-        if (IsoValue > vxMax)
-            IsoValue = vxMax;
-    }
+    auto [valMin, valMax] = VolumeComponent->GetVolumeValueRange();
+    if (IsoValue < valMin)
+        IsoValue = valMin;
+    if (IsoValue > valMax)
+        IsoValue = valMax;
+    for (auto &isoVal : IsoValues)
+        isoVal = FMath::Clamp(isoVal, valMin, valMax);
+    if (IsoValueNum < 1)
+        IsoValueNum = 1;
+    // Levels without a step are spread evenly over [IsoValue, valMax)
+    if (IsoValueNum > 1 && IsoValueStep <= 0.f)
+        IsoValueStep = (valMax - IsoValue) / IsoValueNum;
+    if (IsoValueStep <= 0.f)
+        IsoValueNum = 1;
+    if (SectionColumnNum < 2)
+        SectionColumnNum = 2;
 
     FIntVector voxPerVol(VolumeComponent->VolumeTexture->GetSizeX(),
                           VolumeComponent->VolumeTexture->GetSizeY(),
@@ -139,16 +156,70 @@ void AMCSActor::setupRenderer(bool shouldMarchSquare) {
                                          .GeoRef = GeoComponent->GeoRef.Get()});
     renderer->SetRenderParameters(
         {.LineStyle = LineStyle,
+         .DashLength = DashLength,
          .TransferFunctionTexture = VolumeComponent->TransferFunctionTexture
                                         ? VolumeComponent->TransferFunctionTexture.Get()
                                         : VolumeComponent->DefaultTransferFunctionTexture.Get()});
 
     if (shouldMarchSquare)
-        renderer->MarchingSquare({.UseLerp = UseLerp,
-                                  .UseSmoothedVolume = UseSmoothedVolume,
-                                  .HeightRange = HeightRange,
-                                  .IsoValue = IsoValue,
-                                  .VolumeComponent = VolumeComponent});
+        renderer->MarchingSquare(makeMCSParameters());
+}
+
+FMCSRenderer::MCSParameters AMCSActor::makeMCSParameters() const {
+    return {.UseLerp = UseLerp,
+            .UseSmoothedVolume = UseSmoothedVolume,
+            .HeightRange = HeightRange,
+            .IsoValue = IsoValue,
+            .IsoValueStep = IsoValueStep,
+            .IsoValueNum = IsoValueNum,
+            .IsoValues = IsoValues,
+            .SimplifyTolerance = SimplifyTolerance,
+            .SectionPath = makeSectionPath(),
+            .SectionColumnNum = SectionColumnNum,
+            .VolumeComponent = VolumeComponent};
+}
+
+TArray<FVector2f> AMCSActor::makeSectionPath() const {
+    switch (SectionMode) {
+    case EMCSSectionMode::Longitude:
+        return FVolumeSlicer::MakeLongitudePath(SectionStart.X, GeoComponent->LongtitudeRange);
+    case EMCSSectionMode::Latitude:
+        return FVolumeSlicer::MakeLatitudePath(SectionStart.Y, GeoComponent->LatitudeRange);
+    case EMCSSectionMode::GreatCircle:
+        return FVolumeSlicer::MakeGreatCirclePath(SectionStart, SectionEnd, SectionColumnNum,
+                                                  GeoComponent->LongtitudeRange,
+                                                  GeoComponent->LatitudeRange);
+    }
+    return {};
+}
+
+void AMCSActor::ExportContours() {
+    if (!VolumeComponent->VolumeTexture) {
+        UVolumeDataComponent::ProcessError(TEXT("No volume is loaded."));
+        return;
+    }
+    checkAndCorrectParameters();
+
+    auto isGeoJSON = ExportFormat == EMCSExportFormat::GeoJSON;
+    FJsonSerializableArray files;
+    FDesktopPlatformModule::Get()->SaveFileDialog(
+        nullptr, TEXT("Select a Contour file"), FPaths::GetProjectFilePath(),
+        isGeoJSON ? TEXT("xx_contours.geojson") : TEXT("xx_contours.v4ec"),
+        isGeoJSON ? TEXT("GeoJSON|*.geojson;*.json") : TEXT("Binary|*.v4ec"),
+        EFileDialogFlags::None, files);
+    if (files.IsEmpty())
+        return;
+
+    auto mcsParams = makeMCSParameters();
+    FGeoRenderer::GeoParameters geoParams{.LongtitudeRange = GeoComponent->LongtitudeRange,
+                                          .LatitudeRange = GeoComponent->LatitudeRange,
+                                          .HeightRange = GeoComponent->HeightRange};
+    auto errMsg = FContourExporter::Exec({.FilePath = files[0],
+                                          .Format = ExportFormat,
+                                          .MCSParams = mcsParams,
+                                          .GeoParams = geoParams});
+    if (errMsg.IsSet())
+        UVolumeDataComponent::ProcessError(errMsg.GetValue());
 }
 
 void AMCSActor::destroyRenderer() {
@@ -1,7 +1,10 @@
 #include "MCSRenderer.h"
 
-#include <unordered_map>
+#include <algorithm>
+#include <limits>
 
+#include "Algo/BinarySearch.h"
+#include "Async/ParallelFor.h"
 #include "EngineModule.h"
 #include "RenderGraphBuilder.h"
 #include "RenderGraphUtils.h"
@@ -9,6 +12,10 @@
 
 #include "Runtime/Renderer/Private/SceneRendering.h"
 
+#include "ContourStitcher.h"
+#include "VIS4Earth.h"
+#include "VolumeSlicer.h"
+
 TGlobalResource<FMCSRenderer::FVertexAttrDeclaration> GMCSRendererVertexAttrDeclaration;
 
 class VIS4EARTH_API FMCSShader : public FGlobalShader {
@@ -20,6 +27,7 @@ class VIS4EARTH_API FMCSShader : public FGlobalShader {
     SHADER_PARAMETER(FVector2f, LatRng)
     SHADER_PARAMETER(FVector2f, HeightRng)
     SHADER_PARAMETER(FMatrix44f, EarthToEye)
+    SHADER_PARAMETER(float, DashLength)
     SHADER_PARAMETER_SAMPLER(SamplerState, TFSamplerState)
     SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2D, TFInput)
     RENDER_TARGET_BINDING_SLOTS()
@@ -76,11 +84,49 @@ void FMCSRenderer::MarchingSquare(const MCSParameters &Params) {
     if (!Params.VolumeComponent.IsValid())
         return;
 
-    ENQUEUE_RENDER_COMMAND(UregisterRenderScreenRenderer)
-    ([this, Params](FRHICommandListImmediate &RHICmdList) { marchingSquare(Params, RHICmdList); });
+    // Requests published before the render thread gets to them coalesce into the latest one
+    mcsState.Publish(Params);
+    ENQUEUE_RENDER_COMMAND(MCSRendererMarchingSquare)
+    ([renderer = SharedThis(this)](FRHICommandListImmediate &RHICmdList) {
+        if (renderer->mcsState.Acquire())
+            renderer->marchingSquare(renderer->mcsState.Get(), RHICmdList);
+    });
+}
+
+void FMCSRenderer::InvalidateContourCache() {
+    ENQUEUE_RENDER_COMMAND(MCSRendererInvalidateContourCache)
+    ([renderer = SharedThis(this)](FRHICommandListImmediate &RHICmdList) {
+        renderer->sliceCache.Empty();
+        renderer->sectionCache.Reset();
+    });
+}
+
+void FMCSRenderer::SetGeographicalParameters(const GeoParameters &Params) {
+    FGeoRenderer::SetGeographicalParameters(Params);
+    ENQUEUE_RENDER_COMMAND(MCSRendererSetGeographicalParameters)
+    ([renderer = SharedThis(this)](FRHICommandListImmediate &RHICmdList) {
+        renderer->syncGeographicalParameters(RHICmdList);
+    });
+}
+
+void FMCSRenderer::syncGeographicalParameters(FRHICommandListImmediate &RHICmdList) {
+    if (!geoState.Acquire())
+        return;
+
+    auto &prev = uploadedGeoParams;
+    auto &geoParams = geoState.Get();
+    auto isChanged = prev.LongtitudeRange != geoParams.LongtitudeRange ||
+                     prev.LatitudeRange != geoParams.LatitudeRange ||
+                     prev.HeightRange != geoParams.HeightRange || prev.GeoRef != geoParams.GeoRef;
+    if (isChanged)
+        uploadVertices(RHICmdList);
 }
 
 void FMCSRenderer::render(FPostOpaqueRenderParameters &PostQpqRndrParams) {
+    rndrState.Acquire();
+
+    auto &rndrParams = rndrState.Get();
+    auto &geoParams = uploadedGeoParams;
     if (!rndrParams.TransferFunctionTexture.IsValid() || !geoParams.GeoRef.IsValid() ||
         !vertexBuffer.IsValid() || primNum == 0)
         return;
@@ -93,14 +139,17 @@ void FMCSRenderer::render(FPostOpaqueRenderParameters &PostQpqRndrParams) {
         shaderParams->LatRng = FVector2f(FMath::DegreesToRadians(geoParams.LatitudeRange));
         shaderParams->HeightRng = FVector2f(geoParams.HeightRange);
 
-        /*
-                shaderParams->EarthToEye =
-            FMatrix44f(geoParams.GeoRef->ComputeEarthCenteredEarthFixedToUnrealTransformation() *
-                       PostQpqRndrParams.View->ViewMatrices.GetViewProjectionMatrix());
-        */
-        FMatrix44f(
-                   PostQpqRndrParams.View->ViewMatrices.GetViewProjectionMatrix());
-            
+        // Vertices are transformed once per contour or geographical change, so per frame only
+        // the camera-relative offset of localOrigin is computed in double
+        shaderParams->EarthToEye = FMatrix44f(
+            FTranslationMatrix(localOrigin +
+                               PostQpqRndrParams.View->ViewMatrices.GetPreViewTranslation()) *
+            PostQpqRndrParams.View->ViewMatrices.GetTranslatedViewProjectionMatrix());
+
+        // Dashes are cut by the pixel shader along ArcLength, 0 draws solid lines
+        shaderParams->DashLength =
+            rndrParams.LineStyle == EMCSLineStyle::Dash ? rndrParams.DashLength : 0.f;
+
         shaderParams->TFSamplerState =
             TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
         
@@ -125,32 +174,14 @@ void FMCSRenderer::render(FPostOpaqueRenderParameters &PostQpqRndrParams) {
             PostQpqRndrParams.DepthTexture, ERenderTargetLoadAction::ELoad,
             ERenderTargetLoadAction::ELoad, FExclusiveDepthStencil::DepthWrite_StencilWrite);
     }
-    // transform vertex
-    {
-       
-        uint32 BufferSize = sizeof(VertexAttr)*vertNum; 
-        void *VertexData = RHILockVertexBuffer(this->vertexBuffer, 0, BufferSize, RLM_WriteOnly);
-
-        // 
-        VertexAttr *Vertices = reinterpret_cast<VertexAttr *>(VertexData);
-        int32 NumVertices = BufferSize / sizeof(VertexAttr);
-
-        // �������㲢Ӧ�ñ任
-        for (int32 i = 0; i < NumVertices; ++i) {
-            Vertices[i].Position = FVector3f(geoParams.GeoRef->TransformEcefToUnreal(FVector(Vertices[i].Position)));
-        }
-
-        // �������㻺����
-        RHIUnlockVertexBuffer(this->vertexBuffer);
-    }
     grphBldr.AddPass(
         RDG_EVENT_NAME("Draw Marching Square"), shaderParams, ERDGPassFlags::Raster,
         [shaderParams,
          viewportSz = FIntVector2(PostQpqRndrParams.ViewportRect.Width(),
                                   PostQpqRndrParams.ViewportRect.Height()),
-         vertNum = this->vertNum, primNum = this->primNum, lnStyl = rndrParams.LineStyle,
-         vertexBuffer = this->vertexBuffer,
-         indexBuffer = this->indexBuffer](FRHICommandList &RHICmdList) {
+         vertNum = this->vertNum, primNum = this->primNum,
+         vertexBuffer = this->vertexBuffer.GetBuffer(),
+         indexBuffer = this->indexBuffer.GetBuffer()](FRHICommandList &RHICmdList) {
             RHICmdList.SetViewport(0.f, 0.f, 0.f, viewportSz.X, viewportSz.Y, 1.f);
 
             TShaderMapRef<FMCSShaderVS> shaderVS(GetGlobalShaderMap(GMaxRHIFeatureLevel));
@@ -162,14 +193,7 @@ void FMCSRenderer::render(FPostOpaqueRenderParameters &PostQpqRndrParams) {
             graphicsPSOInit.DepthStencilState =
                 TStaticDepthStencilState<true, CF_Greater>::GetRHI();
             graphicsPSOInit.BlendState = TStaticBlendState<>::GetRHI();
-            switch (lnStyl) {
-            case EMCSLineStyle::Solid:
-                graphicsPSOInit.PrimitiveType = PT_LineList;
-                break;
-            case EMCSLineStyle::Dash:
-                graphicsPSOInit.PrimitiveType = PT_PointList;
-                break;
-            }
+            graphicsPSOInit.PrimitiveType = PT_LineList;
             graphicsPSOInit.BoundShaderState.VertexDeclarationRHI =
                 GMCSRendererVertexAttrDeclaration.VertexDeclarationRHI;
             graphicsPSOInit.BoundShaderState.VertexShaderRHI = shaderVS.GetVertexShader();
@@ -180,21 +204,15 @@ void FMCSRenderer::render(FPostOpaqueRenderParameters &PostQpqRndrParams) {
             SetShaderParameters(RHICmdList, shaderVS, shaderVS.GetVertexShader(), *shaderParams);
 
             RHICmdList.SetStreamSource(0, vertexBuffer, 0);
-            switch (lnStyl) {
-            case EMCSLineStyle::Solid:
-                RHICmdList.DrawIndexedPrimitive(indexBuffer, 0, 0, vertNum, 0, primNum, 1);
-                break;
-            case EMCSLineStyle::Dash:
-                RHICmdList.DrawPrimitive(0, vertNum, 1);
-                break;
-            }
+            RHICmdList.DrawIndexedPrimitive(indexBuffer, 0, 0, vertNum, 0, primNum, 1);
         });
 }
 
-void FMCSRenderer::marchingSquare(const MCSParameters &Params,
-                                  FRHICommandListImmediate &RHICmdList) {
+FMCSRenderer::SliceContour FMCSRenderer::ExtractSliceContour(const MCSParameters &Params,
+                                                              int32 Z) {
+    SliceContour ret;
     if (!Params.VolumeComponent.IsValid() || !Params.VolumeComponent->VolumeTexture)
-        return;
+        return ret;
 
     FIntVector voxPerVol(Params.VolumeComponent->VolumeTexture->GetSizeX(),
                           Params.VolumeComponent->VolumeTexture->GetSizeY(),
@@ -202,138 +220,249 @@ void FMCSRenderer::marchingSquare(const MCSParameters &Params,
     auto [vxMin, vxMax, vxExt] =
         VolumeData::GetVoxelMinMaxExtent(Params.VolumeComponent->GetVolumeVoxelType());
 
-    auto hashEdge = [](const FIntVector &edgeID) {
-        size_t hash = edgeID.X;
-        hash = (hash << 32) | edgeID.Y;
-        hash = (hash << 1) | edgeID.Z;
-        return std::hash<size_t>()(hash);
+    auto isoValues = Params.GetIsoValues();
+    auto isoNum = isoValues.Num();
+
+    // Levels crossed by a cell whose scalars span [vMin, vMax] are those in (vMin, vMax]. They
+    // are indexed directly if evenly spaced, or binary searched among sorted isovalues, so that
+    // classifying a cell costs no more than the levels it crosses.
+    auto isEvenlySpaced = Params.IsoValues.IsEmpty();
+    TArray<int32> lvlOrder; // indices of isoValues in ascending order of isovalue
+    TArray<float> sortedIsoValues;
+    lvlOrder.SetNumUninitialized(isoNum);
+    for (int32 i = 0; i < isoNum; ++i)
+        lvlOrder[i] = i;
+    if (!isEvenlySpaced) {
+        lvlOrder.Sort([&](int32 A, int32 B) { return isoValues[A] < isoValues[B]; });
+        sortedIsoValues.SetNumUninitialized(isoNum);
+        for (int32 i = 0; i < isoNum; ++i)
+            sortedIsoValues[i] = isoValues[lvlOrder[i]];
+    }
+    auto getLevelRange = [&](float vMin, float vMax) {
+        if (!isEvenlySpaced)
+            return FIntPoint(Algo::UpperBound(sortedIsoValues, vMin),
+                             Algo::UpperBound(sortedIsoValues, vMax));
+        if (isoNum == 1)
+            return FIntPoint(0, 1);
+        // One more level on each side absorbs rounding, and is rejected by its corner states
+        auto toLevel = [&](float v) {
+            return FMath::FloorToInt32(FMath::Clamp((v - Params.IsoValue) / Params.IsoValueStep,
+                                                    -1.f, static_cast<float>(isoNum)));
+        };
+        return FIntPoint(std::max(toLevel(vMin), 0), std::min(toLevel(vMax) + 2, isoNum));
     };
-    std::unordered_map<FIntVector, uint32, decltype(hashEdge)> edge2vertIDs;
 
-    TArray<VertexAttr> vertices;
-    TArray<uint32> indices;
-    auto addLineSeg = [&](auto &&func, const FIntVector &startPos, const FVector4f &scalars,
-                          const FVector4f &omegas, uint8 mask, auto &&...masks) {
-        for (int32 i = 0; i < 4; ++i) {
-            if (((mask >> i) & 0b1) == 0)
-                continue;
-
-            // Edge indexed by Start Voxel Position
-            // +----------+
-            // | /*\      |
-            // |  e1      |
-            // |  * e0 *> |
-            // +----------+
-            // *:   startPos
-            // *>:  startPos + (1,0)
-            // /*\: startPos + (0,1)
-            // ID(e0) = (startPos.xy, 0)
-            // ID(e1) = (startPos.xy, 1)
-            FIntVector edgeID(startPos.X + (i == 1 ? 1 : 0), startPos.Y + (i == 2 ? 1 : 0),
-                               i == 1 || i == 3 ? 1 : 0);
-            if (auto itr = edge2vertIDs.find(edgeID); itr != edge2vertIDs.end()) {
-                indices.Emplace(itr->second);
-                continue;
-            }
-
-            FVector3f pos(startPos.X + (i == 0 || i == 2 ? (Params.UseLerp ? omegas[i] : .5f)
-                                        : i == 1         ? 1.f
-                                                         : 0.f),
-                          startPos.Y + (i == 1 || i == 3 ? (Params.UseLerp ? omegas[i] : .5f)
-                                        : i == 2         ? 1.f
-                                                         : 0.f),
-                          startPos.Z);
-            pos /= FVector3f(voxPerVol);
-
-            auto scalar = [&]() {
-                switch (i) {
-                case 0:
-                    return omegas[0] * scalars[0] + (1.f - omegas[0]) * scalars[1];
-                case 1:
-                    return omegas[1] * scalars[1] + (1.f - omegas[1]) * scalars[2];
-                case 2:
-                    return omegas[2] * scalars[3] + (1.f - omegas[2]) * scalars[2];
-                case 3:
-                    return omegas[3] * scalars[0] + (1.f - omegas[3]) * scalars[3];
+    // Marches a 2D grid of GridDim scalars. SampleRow(y, Row) fills Row with the scalars of grid
+    // row y, and ToPos(GridPos) maps a continuous grid position to VertexAttr::Position.
+    auto marchGrid = [&](const FIntPoint &GridDim, auto &&SampleRow, auto &&ToPos,
+                         SliceContour &slice) {
+        // Cells of row y only share vertices on horizontal edges of rows y and y+1 and on
+        // vertical edges of row y. Thus, vertex IDs of each isovalue are cached in a ring of
+        // two horizontal edge rows (selected by the parity of y) and one vertical edge row,
+        // indexed by X.
+        TArray<uint32> edge2vertIDs;
+        edge2vertIDs.SetNumUninitialized(isoNum * 3 * GridDim.X);
+        FMemory::Memset(edge2vertIDs.GetData(), 0xff, sizeof(uint32) * edge2vertIDs.Num());
+        auto edge2vertID = [&](int32 isoIdx, const FIntVector &edgeID) -> uint32 & {
+            return edge2vertIDs[(isoIdx * 3 + (edgeID.Z == 1 ? 2 : edgeID.Y & 0b1)) * GridDim.X +
+                                edgeID.X];
+        };
+
+        auto &vertices = slice.Vertices;
+        auto &indices = slice.Indices;
+        auto addLineSeg = [&](auto &&func, int32 isoIdx, const FIntPoint &startPos,
+                              const FVector4f &omegas, uint8 mask, auto &&...masks) {
+            for (int32 i = 0; i < 4; ++i) {
+                if (((mask >> i) & 0b1) == 0)
+                    continue;
+
+                // Edge indexed by Start Voxel Position
+                // +----------+
+                // | /*\      |
+                // |  e1      |
+                // |  * e0 *> |
+                // +----------+
+                // *:   startPos
+                // *>:  startPos + (1,0)
+                // /*\: startPos + (0,1)
+                // ID(e0) = (startPos.xy, 0)
+                // ID(e1) = (startPos.xy, 1)
+                FIntVector edgeID(startPos.X + (i == 1 ? 1 : 0), startPos.Y + (i == 2 ? 1 : 0),
+                                  i == 1 || i == 3 ? 1 : 0);
+                auto &vertID = edge2vertID(isoIdx, edgeID);
+                if (vertID != std::numeric_limits<uint32>::max()) {
+                    indices.Emplace(vertID);
+                    continue;
                 }
-                return 0.f;
-            }();
-            scalar = (scalar - vxMin) / vxExt; // [vxMin, vxMax] -> [0, 1]
 
-            indices.Emplace(vertices.Num());
-            vertices.Emplace(pos, scalar);
-            edge2vertIDs.emplace(edgeID, indices.Last());
-        }
+                auto pos = ToPos(FVector2f(
+                    startPos.X + (i == 0 || i == 2 ? (Params.UseLerp ? omegas[i] : .5f)
+                                  : i == 1         ? 1.f
+                                                   : 0.f),
+                    startPos.Y + (i == 1 || i == 3 ? (Params.UseLerp ? omegas[i] : .5f)
+                                  : i == 2         ? 1.f
+                                                   : 0.f)));
 
-        if constexpr (sizeof...(masks) >= 1)
-            func(func, startPos, scalars, omegas, masks...);
-    };
-    auto gen = [&]<SupportedVoxelType T>(T) {
-        FIntVector pos;
-        for (pos.Z = Params.HeightRange[0]; pos.Z <= Params.HeightRange[1]; ++pos.Z) {
-            edge2vertIDs.clear(); // hash map only stores vertices on the same height
-
-            for (pos.Y = 0; pos.Y < voxPerVol.Y - 1; ++pos.Y)
-                for (pos.X = 0; pos.X < voxPerVol.X - 1; ++pos.X) {
-                    // Voxels in CCW order form a grid
-                    // +------------+
-                    // |  3 <--- 2  |
-                    // |  |     /|\ |
-                    // | \|/     |  |
-                    // |  0 ---> 1  |
-                    // +------------+
+                // Vertices of the same isovalue share the scalar
+                auto scalar = (isoValues[isoIdx] - vxMin) / vxExt; // [vxMin, vxMax] -> [0, 1]
+
+                indices.Emplace(vertices.Num());
+                vertices.Emplace(pos, scalar, 0.f, static_cast<float>(isoIdx));
+                vertID = indices.Last();
+            }
+
+            if constexpr (sizeof...(masks) >= 1)
+                func(func, isoIdx, startPos, omegas, masks...);
+        };
+
+        // Scalars of rows y and y+1 are sampled once and shared by all isovalues
+        TArray<float> rowScalars;
+        rowScalars.SetNumUninitialized(2 * GridDim.X);
+        auto sampleRow = [&](int32 y) {
+            SampleRow(y, rowScalars.GetData() + (y & 0b1) * GridDim.X);
+        };
+        if (GridDim.Y > 1)
+            sampleRow(0);
+
+        FIntPoint pos;
+        for (pos.Y = 0; pos.Y < GridDim.Y - 1; ++pos.Y) {
+            sampleRow(pos.Y + 1);
+            auto row0 = rowScalars.GetData() + (pos.Y & 0b1) * GridDim.X;
+            auto row1 = rowScalars.GetData() + ((pos.Y + 1) & 0b1) * GridDim.X;
+
+            // Row y+1 of horizontal edges reuses the slot of row y-1, and vertical edges of
+            // row y-1 are no longer reachable
+            for (int32 isoIdx = 0; isoIdx < isoNum; ++isoIdx) {
+                auto rows = edge2vertIDs.GetData() + isoIdx * 3 * GridDim.X;
+                FMemory::Memset(rows + ((pos.Y + 1) & 0b1) * GridDim.X, 0xff,
+                                sizeof(uint32) * GridDim.X);
+                FMemory::Memset(rows + 2 * GridDim.X, 0xff, sizeof(uint32) * GridDim.X);
+            }
+
+            for (pos.X = 0; pos.X < GridDim.X - 1; ++pos.X) {
+                // Voxels in CCW order form a grid
+                // +------------+
+                // |  3 <--- 2  |
+                // |  |     /|\ |
+                // | \|/     |  |
+                // |  0 ---> 1  |
+                // +------------+
+                FVector4f scalars(row0[pos.X], row0[pos.X + 1], row1[pos.X + 1], row1[pos.X]);
+                auto lvlRng =
+                    getLevelRange(std::min({scalars.X, scalars.Y, scalars.Z, scalars.W}),
+                                  std::max({scalars.X, scalars.Y, scalars.Z, scalars.W}));
+
+                for (int32 lvl = lvlRng.X; lvl < lvlRng.Y; ++lvl) {
+                    auto isoIdx = lvlOrder[lvl];
+                    auto isoVal = isoValues[isoIdx];
                     uint8 cornerState = 0;
-                    FVector4f scalars;
-                    for (int32 i = 0; i < 4; ++i) {
-                        if (Params.UseSmoothedVolume) {
-                            scalars[i] = Params.VolumeComponent->SampleVolumeCPUDataSmoothed(pos);
-                            scalars[i] = scalars[i] * vxExt + vxMin; // [0, 1] -> [vxMin, vxMax]
-                        } else
-                            scalars[i] = Params.VolumeComponent->SampleVolumeCPUData<T>(pos);
-                        if (scalars[i] >= Params.IsoValue)
+                    for (int32 i = 0; i < 4; ++i)
+                        if (scalars[i] >= isoVal)
                             cornerState |= 1 << i;
-
-                        pos.X += i == 0 ? 1 : i == 2 ? -1 : 0;
-                        pos.Y += i == 1 ? 1 : i == 3 ? -1 : 0;
-                    }
-                    FVector4f omegas(scalars[0] / (scalars[1] + scalars[0]),
-                                     scalars[1] / (scalars[2] + scalars[1]),
-                                     scalars[3] / (scalars[3] + scalars[2]),
-                                     scalars[0] / (scalars[0] + scalars[3]));
+                    if (cornerState == 0 || cornerState == 0b1111)
+                        continue;
+
+                    // Where isoVal lies along edges 0->1, 1->2, 3->2 and 0->3, only read for
+                    // edges crossed by the contour, whose ends differ in scalar
+                    auto lerp = [&](int32 from, int32 to) {
+                        return scalars[from] == scalars[to]
+                                   ? .5f
+                                   : (isoVal - scalars[from]) / (scalars[to] - scalars[from]);
+                    };
+                    FVector4f omegas(lerp(0, 1), lerp(1, 2), lerp(3, 2), lerp(0, 3));
 
                     switch (cornerState) {
                     case 0b0001:
                     case 0b1110:
-                        addLineSeg(addLineSeg, pos, scalars, omegas, 0b1001);
+                        addLineSeg(addLineSeg, isoIdx, pos, omegas, 0b1001);
                         break;
                     case 0b0010:
                     case 0b1101:
-                        addLineSeg(addLineSeg, pos, scalars, omegas, 0b0011);
+                        addLineSeg(addLineSeg, isoIdx, pos, omegas, 0b0011);
                         break;
                     case 0b0011:
                     case 0b1100:
-                        addLineSeg(addLineSeg, pos, scalars, omegas, 0b1010);
+                        addLineSeg(addLineSeg, isoIdx, pos, omegas, 0b1010);
                         break;
                     case 0b0100:
                     case 0b1011:
-                        addLineSeg(addLineSeg, pos, scalars, omegas, 0b0110);
+                        addLineSeg(addLineSeg, isoIdx, pos, omegas, 0b0110);
                         break;
                     case 0b0101:
-                        addLineSeg(addLineSeg, pos, scalars, omegas, 0b0011, 0b1100);
+                        addLineSeg(addLineSeg, isoIdx, pos, omegas, 0b0011, 0b1100);
                         break;
                     case 0b1010:
-                        addLineSeg(addLineSeg, pos, scalars, omegas, 0b0110, 0b1001);
+                        addLineSeg(addLineSeg, isoIdx, pos, omegas, 0b0110, 0b1001);
                         break;
                     case 0b0110:
                     case 0b1001:
-                        addLineSeg(addLineSeg, pos, scalars, omegas, 0b0101);
+                        addLineSeg(addLineSeg, isoIdx, pos, omegas, 0b0101);
                         break;
                     case 0b0111:
                     case 0b1000:
-                        addLineSeg(addLineSeg, pos, scalars, omegas, 0b1100);
+                        addLineSeg(addLineSeg, isoIdx, pos, omegas, 0b1100);
                         break;
                     }
                 }
+            }
+        }
+    };
+
+    auto gen = [&]<SupportedVoxelType T>(T) {
+        if (!Params.SectionPath.IsEmpty()) {
+            // Vertical section is resampled into a grid of columns x heights, then marched as
+            // a single slice
+            FVolumeSlicer::Parameters slicerParams{.Path = Params.SectionPath,
+                                                   .ColumnNum = Params.SectionColumnNum,
+                                                   .HeightRange = Params.HeightRange,
+                                                   .Dimension = voxPerVol};
+            auto voxNum = static_cast<int64>(voxPerVol.X) * voxPerVol.Y * voxPerVol.Z;
+
+            FVolumeSlicer::Section section;
+            if (Params.UseSmoothedVolume) {
+                auto &volDat = Params.VolumeComponent->GetVolumeCPUDataSmoothed();
+                if (volDat.Num() < voxNum)
+                    return;
+                section = FVolumeSlicer::Exec(slicerParams, volDat.GetData());
+                for (auto &val : section.Values)
+                    val = val * vxExt + vxMin; // [0, 1] -> [vxMin, vxMax]
+            } else {
+                auto &volDat = Params.VolumeComponent->GetVolumeCPUData();
+                if (volDat.Num() < voxNum * static_cast<int64>(sizeof(T)))
+                    return;
+                section = FVolumeSlicer::Exec(slicerParams,
+                                              reinterpret_cast<const T *>(volDat.GetData()));
+            }
+            if (!section.IsValid())
+                return;
+
+            marchGrid(
+                FIntPoint(section.ColumnNum, section.RowNum),
+                [&](int32 y, float *Row) {
+                    FMemory::Memcpy(Row, section.Values.GetData() + y * section.ColumnNum,
+                                    sizeof(float) * section.ColumnNum);
+                },
+                [&](const FVector2f &GridPos) {
+                    return section.GetPosition(GridPos, voxPerVol);
+                },
+                ret);
+        } else {
+            marchGrid(
+                FIntPoint(voxPerVol.X, voxPerVol.Y),
+                [&](int32 y, float *Row) {
+                    for (int32 x = 0; x < voxPerVol.X; ++x) {
+                        FIntVector pos(x, y, Z);
+                        if (Params.UseSmoothedVolume) {
+                            Row[x] = Params.VolumeComponent->SampleVolumeCPUDataSmoothed(pos);
+                            Row[x] = Row[x] * vxExt + vxMin; // [0, 1] -> [vxMin, vxMax]
+                        } else
+                            Row[x] = Params.VolumeComponent->SampleVolumeCPUData<T>(pos);
+                    }
+                },
+                [&](const FVector2f &GridPos) {
+                    return FVector3f(GridPos.X, GridPos.Y, Z) / FVector3f(voxPerVol);
+                },
+                ret);
         }
     };
 
@@ -342,51 +471,164 @@ void FMCSRenderer::marchingSquare(const MCSParameters &Params,
         gen(uint8(0));
         break;
     }
+    if (ret.Vertices.IsEmpty())
+        return ret;
+
+    // Replaces disconnected segments with stitched polylines, whose vertices are contiguous so
+    // that each polyline of N vertices is drawn by N - 1 lines, plus one closing line
+    ret.UnstitchedVertexNum = ret.Vertices.Num();
+    ret.UnstitchedIndexNum = ret.Indices.Num();
+    auto polylines = FContourStitcher::Exec(
+        {.SimplifyTolerance = Params.SimplifyTolerance, .Dimension = voxPerVol}, ret.Vertices,
+        ret.Indices);
+    ret.Vertices = std::move(polylines.Vertices);
+    ret.Indices.Reset(2 * polylines.GetLineNum());
+    for (int32 pl = 0; pl < polylines.GetPolylineNum(); ++pl) {
+        auto start = polylines.Starts[pl], end = polylines.Starts[pl + 1];
+        for (int32 v = start; v + 1 < end; ++v) {
+            ret.Indices.Emplace(v);
+            ret.Indices.Emplace(v + 1);
+        }
+        if (polylines.IsClosed(pl)) {
+            ret.Indices.Emplace(end - 1);
+            ret.Indices.Emplace(start);
+        }
+    }
+
+    return ret;
+}
+
+void FMCSRenderer::marchingSquare(const MCSParameters &Params,
+                                  FRHICommandListImmediate &RHICmdList) {
+    if (!Params.VolumeComponent.IsValid() || !Params.VolumeComponent->VolumeTexture)
+        return;
+
+    FIntVector voxPerVol(Params.VolumeComponent->VolumeTexture->GetSizeX(),
+                          Params.VolumeComponent->VolumeTexture->GetSizeY(),
+                          Params.VolumeComponent->VolumeTexture->GetSizeZ());
+
+    ContourCacheKey key{.IsoValues = Params.GetIsoValues(),
+                        .UseLerp = Params.UseLerp,
+                        .UseSmoothedVolume = Params.UseSmoothedVolume,
+                        .SimplifyTolerance = Params.SimplifyTolerance,
+                        .VolumeComponent = Params.VolumeComponent.Get(),
+                        .Dimension = voxPerVol};
+    TArray<const SliceContour *> slices;
+    if (!Params.SectionPath.IsEmpty()) {
+        // Vertical section is resampled and marched again only when it or the contour
+        // parameters change
+        SectionCacheKey sectionKey{.Contour = std::move(key),
+                                   .Path = Params.SectionPath,
+                                   .ColumnNum = Params.SectionColumnNum,
+                                   .HeightRange = Params.HeightRange};
+        if (!sectionCache.IsSet() || !(sectionKey == sectionCacheKey)) {
+            sectionCache = ExtractSliceContour(Params, 0);
+            sectionCacheKey = std::move(sectionKey);
+        }
+        slices.Emplace(&sectionCache.GetValue());
+    } else {
+        if (!(key == contourCacheKey)) {
+            sliceCache.Empty();
+            contourCacheKey = std::move(key);
+        }
+
+        // Only slices not in the cache are marched. Every height is independent, so each one
+        // is extracted into its own slice on a worker and slices are merged afterwards.
+        TArray<int32> newHeights;
+        for (int32 z = Params.HeightRange[0]; z <= Params.HeightRange[1]; ++z)
+            if (!sliceCache.Contains(z))
+                newHeights.Emplace(z);
+
+        TArray<SliceContour> newSlices;
+        newSlices.SetNum(newHeights.Num());
+        ParallelFor(newSlices.Num(), [&](int32 i) {
+            newSlices[i] = ExtractSliceContour(Params, newHeights[i]);
+        });
+        for (int32 i = 0; i < newHeights.Num(); ++i)
+            sliceCache.Emplace(newHeights[i], std::move(newSlices[i]));
+
+        for (int32 z = Params.HeightRange[0]; z <= Params.HeightRange[1]; ++z)
+            slices.Emplace(sliceCache.Find(z));
+    }
+
+    // Prefix sums over per-slice counts give the offset of each slice in the merged arrays
+    TArray<int32> vertOffsets, idxOffsets;
+    vertOffsets.SetNumUninitialized(slices.Num() + 1);
+    idxOffsets.SetNumUninitialized(slices.Num() + 1);
+    vertOffsets[0] = idxOffsets[0] = 0;
+    for (int32 i = 0; i < slices.Num(); ++i) {
+        vertOffsets[i + 1] = vertOffsets[i] + slices[i]->Vertices.Num();
+        idxOffsets[i + 1] = idxOffsets[i] + slices[i]->Indices.Num();
+    }
+
+    int64 unstitchedVertNum = 0, unstitchedIdxNum = 0;
+    for (auto slice : slices) {
+        unstitchedVertNum += slice->UnstitchedVertexNum;
+        unstitchedIdxNum += slice->UnstitchedIndexNum;
+    }
+    // Runs on every contour update, e.g. each step of scrubbing the isovalue
+    UE_LOG(LogVIS4Earth, Verbose,
+           TEXT("MCS contours of %d slices: %d vertices and %d indices, %lld and %lld before "
+                "stitching and simplification."),
+           slices.Num(), vertOffsets.Last(), idxOffsets.Last(), unstitchedVertNum,
+           unstitchedIdxNum);
+
+    TArray<VertexAttr> vertices;
+    TArray<uint32> indices;
+    vertices.SetNumUninitialized(vertOffsets.Last());
+    indices.SetNumUninitialized(idxOffsets.Last());
+    ParallelFor(slices.Num(), [&](int32 i) {
+        auto &slice = *slices[i];
+        FMemory::Memcpy(vertices.GetData() + vertOffsets[i], slice.Vertices.GetData(),
+                        sizeof(VertexAttr) * slice.Vertices.Num());
+        for (int32 j = 0; j < slice.Indices.Num(); ++j)
+            indices[idxOffsets[i] + j] = slice.Indices[j] + vertOffsets[i];
+    });
+
     if (indices.IsEmpty()) {
+        gridVertices.Empty();
         vertNum = primNum = 0;
         return;
     }
 
-    vertNum = vertices.Num();
-    auto bufSz = sizeof(VertexAttr) * vertNum;
-    if (!vertexBuffer.IsValid() || vertexBuffer->GetSize() != bufSz) {
-        FString FullString = FString(TEXT("Marching Square Create Vertex Buffer")) + TEXT(" in ") +
-                             FString(ANSI_TO_TCHAR(__FUNCTION__));
-
-        // get const TCHAR*
-        const TCHAR *tmpName = *FullString;
-        FRHIResourceCreateInfo info(tmpName);
-        // former code
-        /*
-        vertexBuffer = RHICmdList.RHICreateVertexBuffer(bufSz, BUF_VertexBuffer | BUF_Static,
-                                                     ERHIAccess::VertexOrIndexBuffer, info);
-        */
-        vertexBuffer = RHICreateVertexBuffer(bufSz, BUF_VertexBuffer | BUF_Static,
-                                                        ERHIAccess::VertexOrIndexBuffer, info);
-    }
-    auto dat = RHICmdList.LockBuffer(vertexBuffer, 0, bufSz, RLM_WriteOnly);
-    FMemory::Memmove(dat, vertices.GetData(), bufSz);
-    RHICmdList.UnlockBuffer(vertexBuffer);
+    gridVertices = std::move(vertices);
+    uploadVertices(RHICmdList);
 
     primNum = indices.Num() / 2;
-    bufSz = sizeof(uint32) * indices.Num();
-    if (!indexBuffer.IsValid() || indexBuffer->GetSize() != bufSz) {
-
-
-        FString FullString = FString(TEXT("Marching Square Create Index Buffer")) + TEXT(" in ") +
-                              FString(ANSI_TO_TCHAR(__FUNCTION__));
-        const TCHAR *tmpName = *FullString;
-        FRHIResourceCreateInfo info(tmpName);
-        /* former code
-                indexBuffer =
-            RHICmdList.RHICreateIndexBuffer(sizeof(uint32), bufSz, BUF_VertexBuffer | BUF_Static,
-                                         ERHIAccess::VertexOrIndexBuffer, info);
-        */
-        indexBuffer =
-            RHICreateIndexBuffer(sizeof(uint32), bufSz, BUF_VertexBuffer | BUF_Static,
-                                         ERHIAccess::VertexOrIndexBuffer, info);
-    }
-    dat = RHICmdList.LockBuffer(indexBuffer, 0, bufSz, RLM_WriteOnly);
-    FMemory::Memmove(dat, indices.GetData(), bufSz);
-    RHICmdList.UnlockBuffer(indexBuffer);
+    indexBuffer.Upload(RHICmdList, indices.GetData(), sizeof(uint32) * indices.Num());
+}
+
+void FMCSRenderer::uploadVertices(FRHICommandListImmediate &RHICmdList) {
+    geoState.Acquire();
+    auto &geoParams = geoState.Get();
+    uploadedGeoParams = geoParams;
+
+    vertNum = 0;
+    if (gridVertices.IsEmpty() || !geoParams.GeoRef.IsValid())
+        return;
+
+    auto lonExt = geoParams.LongtitudeRange[1] - geoParams.LongtitudeRange[0];
+    auto latExt = geoParams.LatitudeRange[1] - geoParams.LatitudeRange[0];
+    auto hExt = geoParams.HeightRange[1] - geoParams.HeightRange[0];
+    auto toUnreal = [&](const FVector &pos) {
+        return geoParams.GeoRef->TransformLongitudeLatitudeHeightToUnreal(
+            FVector{geoParams.LongtitudeRange[0] + pos.X * lonExt,
+                    geoParams.LatitudeRange[0] + pos.Y * latExt,
+                    geoParams.HeightRange[0] + pos.Z * hExt});
+    };
+    localOrigin = toUnreal(FVector(.5, .5, .5));
+
+    TArray<VertexAttr> vertices;
+    vertices.SetNumUninitialized(gridVertices.Num());
+    ParallelFor(gridVertices.Num(), [&](int32 i) {
+        vertices[i].Position =
+            FVector3f(toUnreal(FVector(gridVertices[i].Position)) - localOrigin);
+        vertices[i].Scalar = gridVertices[i].Scalar;
+        vertices[i].ArcLength = gridVertices[i].ArcLength;
+        vertices[i].Level = gridVertices[i].Level;
+    });
+
+    vertexBuffer.Upload(RHICmdList, vertices.GetData(), sizeof(VertexAttr) * vertices.Num());
+
+    vertNum = vertices.Num();
 }
@@ -0,0 +1,165 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <algorithm>
+
+#include "CoreMinimal.h"
+
+#include "Util.h"
+
+#include "GeoRenderer.h"
+
+/*
+ * Class: FShellSectorIntersector
+ * Function:
+ * -- Exactly intersects a ray with the spherical shell sector spanned by the longitude,
+ *    latitude and height ranges of a spherical Earth, i.e. the region bounded by two spheres,
+ *    two planes of longitudes and two cones of latitudes.
+ * -- Parameters of the ray where it crosses any bounding surface are solved analytically. The
+ *    ray is inside the sector between two consecutive crossings iff it is at their midpoint, so
+ *    the sector is found as sorted disjoint segments of [0, inf).
+ * -- Runs in double with no dependency on the renderer, so that it can be called anywhere.
+ * -- Longitude ranges wrapping across the antimeridian, e.g. [170, -170] or [170, 190], are
+ *    rejected as empty, the same as UGeoComponent clamps them into [-180, 180].
+ * -- The Earth is the sphere of the WGS84 equatorial radius, while Cesium places geodetic
+ *    coordinates on the WGS84 ellipsoid. Callers registering with Cesium should place points
+ *    by ToEarth() at their geodetic coordinates, see FDVRRenderer::renderCPU().
+ */
+class VIS4EARTH_API FShellSectorIntersector {
+  public:
+    static constexpr double EarthRadius = 6378137.;
+    // A ray crosses 2 spheres, 2 planes and 2 double cones at most 10 times
+    static constexpr int32 MaxSegmentNum = 6;
+
+    struct Parameters {
+        FVector2d LongtitudeRange = FGeoRenderer::GeoParameters::DefLongtitudeRange;
+        FVector2d LatitudeRange = FGeoRenderer::GeoParameters::DefLatitudeRange;
+        FVector2d HeightRange = FGeoRenderer::GeoParameters::DefHeightRange;
+    };
+
+    struct Segments {
+        int32 Num = 0;
+        // [tEnter, tExit] in ascending order
+        FVector2d Ranges[MaxSegmentNum];
+
+        bool IsEmpty() const { return Num == 0; }
+        // Returns [tEnter of the first segment, tExit of the last segment]
+        FVector2d GetHull() const {
+            return Num == 0 ? FVector2d(1., 0.) : FVector2d(Ranges[0][0], Ranges[Num - 1][1]);
+        }
+    };
+
+    // Returns whether the ranges span a sector, i.e. are ascending, with longitudes in
+    // [-180, 180], latitudes in [-90, 90] and heights above the center of the Earth
+    static bool IsValid(const Parameters &Params) {
+        return Params.LongtitudeRange[0] >= -180. &&
+               Params.LongtitudeRange[0] < Params.LongtitudeRange[1] &&
+               Params.LongtitudeRange[1] <= 180. && Params.LatitudeRange[0] >= -90. &&
+               Params.LatitudeRange[0] < Params.LatitudeRange[1] &&
+               Params.LatitudeRange[1] <= 90. && Params.HeightRange[0] > -EarthRadius &&
+               Params.HeightRange[0] < Params.HeightRange[1];
+    }
+
+    // Origin is in Earth-Centered Earth-Fixed meters and Dir is normalized. Returns no segment
+    // if the ranges are not valid.
+    static Segments Exec(const Parameters &Params, const FVector &Origin, const FVector &Dir) {
+        Segments ret;
+        if (!IsValid(Params))
+            return ret;
+
+        constexpr int32 MaxCrossingNum = 10;
+        double ts[MaxCrossingNum + 2];
+        int32 tNum = 0;
+        auto addRoot = [&](double t) {
+            if (t > 0. && tNum < MaxCrossingNum)
+                ts[tNum++] = t;
+        };
+        auto solveQuadratic = [&](double a, double halfB, double c) {
+            if (FMath::Abs(a) < UE_DOUBLE_SMALL_NUMBER) {
+                if (FMath::Abs(halfB) >= UE_DOUBLE_SMALL_NUMBER)
+                    addRoot(-c / (2. * halfB));
+                return;
+            }
+            auto disc = halfB * halfB - a * c;
+            if (disc < 0.)
+                return;
+            disc = FMath::Sqrt(disc);
+            // Avoids cancellation between -halfB and disc
+            auto q = -halfB - (halfB >= 0. ? disc : -disc);
+            addRoot(q / a);
+            if (q != 0.)
+                addRoot(c / q);
+        };
+
+        // The outer sphere bounds the sector
+        auto rOut = EarthRadius + Params.HeightRange[1];
+        auto b = Origin.Dot(Dir);
+        auto disc = b * b - (Origin.SizeSquared() - rOut * rOut);
+        if (disc < 0.)
+            return ret;
+        auto tFar = -b + FMath::Sqrt(disc);
+        if (tFar <= 0.)
+            return ret;
+        addRoot(-b - FMath::Sqrt(disc));
+
+        auto rIn = EarthRadius + Params.HeightRange[0];
+        solveQuadratic(1., b, Origin.SizeSquared() - rIn * rIn);
+
+        for (int32 i = 0; i < 2; ++i) {
+            // Plane through the Z axis, whose normal is (-sin(lon), cos(lon), 0)
+            auto lon = FMath::DegreesToRadians(Params.LongtitudeRange[i]);
+            auto sinLon = FMath::Sin(lon);
+            auto cosLon = FMath::Cos(lon);
+            solveQuadratic(0., .5 * (-sinLon * Dir.X + cosLon * Dir.Y),
+                           -sinLon * Origin.X + cosLon * Origin.Y);
+
+            // Double cone of cos^2(lat) z^2 = sin^2(lat) (x^2 + y^2)
+            auto lat = FMath::DegreesToRadians(Params.LatitudeRange[i]);
+            auto sin2Lat = FMath::Square(FMath::Sin(lat));
+            auto cos2Lat = FMath::Square(FMath::Cos(lat));
+            solveQuadratic(cos2Lat * Dir.Z * Dir.Z - sin2Lat * (Dir.X * Dir.X + Dir.Y * Dir.Y),
+                           cos2Lat * Origin.Z * Dir.Z -
+                               sin2Lat * (Origin.X * Dir.X + Origin.Y * Dir.Y),
+                           cos2Lat * Origin.Z * Origin.Z -
+                               sin2Lat * (Origin.X * Origin.X + Origin.Y * Origin.Y));
+        }
+
+        ts[tNum++] = 0.;
+        ts[tNum++] = tFar;
+        std::sort(ts, ts + tNum);
+
+        for (int32 i = 1; i < tNum; ++i) {
+            if (ts[i] > tFar)
+                break;
+            if (ts[i] <= ts[i - 1] || !IsInside(Params, Origin + .5 * (ts[i - 1] + ts[i]) * Dir))
+                continue;
+
+            if (ret.Num != 0 && ret.Ranges[ret.Num - 1][1] == ts[i - 1])
+                ret.Ranges[ret.Num - 1][1] = ts[i];
+            else if (ret.Num < MaxSegmentNum)
+                ret.Ranges[ret.Num++] = FVector2d(ts[i - 1], ts[i]);
+        }
+        return ret;
+    }
+
+    static bool IsInside(const Parameters &Params, const FVector &Pos) {
+        auto r = Pos.Size();
+        if (r < EarthRadius + Params.HeightRange[0] || r > EarthRadius + Params.HeightRange[1])
+            return false;
+        auto lon = FMath::RadiansToDegrees(FMath::Atan2(Pos.Y, Pos.X));
+        auto lat = FMath::RadiansToDegrees(FMath::Asin(Pos.Z / r));
+        return lon >= Params.LongtitudeRange[0] && lon <= Params.LongtitudeRange[1] &&
+               lat >= Params.LatitudeRange[0] && lat <= Params.LatitudeRange[1];
+    }
+
+    // Returns the point at (longitude, latitude, height) in degrees and meters on the spherical
+    // Earth, in Earth-Centered Earth-Fixed meters
+    static FVector ToEarth(const FVector &LonLatHeight) {
+        auto lon = FMath::DegreesToRadians(LonLatHeight.X);
+        auto lat = FMath::DegreesToRadians(LonLatHeight.Y);
+        return (EarthRadius + LonLatHeight.Z) *
+               FVector(FMath::Cos(lat) * FMath::Cos(lon), FMath::Cos(lat) * FMath::Sin(lon),
+                       FMath::Sin(lat));
+    }
+};
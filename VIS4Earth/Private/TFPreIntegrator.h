@@ -4,6 +4,7 @@
 
 #include <array>
 
+#include "Async/ParallelFor.h"
 #include "CoreMinimal.h"
 #include "Engine/VolumeTexture.h"
 #include "RHIGPUReadback.h"
@@ -21,59 +22,83 @@ class VIS4EARTH_API FTFPreIntegrator {
         TObjectPtr<UTexture2D> TransferFunctionTexture;
     };
     static TArray<FFloat16> Exec(const Parameters &Params) {
-        auto tfDat = reinterpret_cast<std::array<FFloat16, 4> *>(
+        constexpr auto res = TransferFunctionData::Resolution;
+        auto tfDat = reinterpret_cast<const std::array<FFloat16, 4> *>(
             Params.TransferFunctionTexture->GetPlatformData()->Mips[0].BulkData.Lock(
                 EBulkDataLockFlags::LOCK_READ_ONLY));
+        TArray<FLinearColor> tf;
+        tf.SetNumUninitialized(res);
+        for (int32 i = 0; i < res; ++i)
+            tf[i] = FLinearColor(tfDat[i][0], tfDat[i][1], tfDat[i][2], tfDat[i][3]);
+        Params.TransferFunctionTexture->GetPlatformData()->Mips[0].BulkData.Unlock();
 
-        TArray<std::array<float, 4>> tfIntDat;
-        tfIntDat.SetNum(TransferFunctionData::Resolution);
-        {
-            tfIntDat[0][0] = (*tfDat)[0];
-            tfIntDat[0][1] = (*tfDat)[1];
-            tfIntDat[0][2] = (*tfDat)[2];
-            tfIntDat[0][3] = (*tfDat)[3];
-            for (int32 i = 1; i < TransferFunctionData::Resolution; ++i) {
-                auto a = .5f * (tfDat[i - 1][3] + tfDat[i][3]);
-                auto r = .5f * (tfDat[i - 1][0] + tfDat[i][0]) * a;
-                auto g = .5f * (tfDat[i - 1][1] + tfDat[i][1]) * a;
-                auto b = .5f * (tfDat[i - 1][2] + tfDat[i][2]) * a;
+        TArray<FLinearColor> preInt;
+        preInt.SetNumUninitialized(static_cast<int64>(res) * res);
+        execRow(tf.GetData(), preInt.GetData());
 
-                tfIntDat[i][0] = tfIntDat[i - 1][0] + r;
-                tfIntDat[i][1] = tfIntDat[i - 1][1] + g;
-                tfIntDat[i][2] = tfIntDat[i - 1][2] + b;
-                tfIntDat[i][3] = tfIntDat[i - 1][3] + a;
-            }
+        TArray<FFloat16> tfPreIntDat;
+        tfPreIntDat.SetNumUninitialized(preInt.Num() * 4);
+        for (int64 i = 0; i < preInt.Num(); ++i) {
+            tfPreIntDat[i * 4 + 0] = preInt[i].R;
+            tfPreIntDat[i * 4 + 1] = preInt[i].G;
+            tfPreIntDat[i * 4 + 2] = preInt[i].B;
+            tfPreIntDat[i * 4 + 3] = preInt[i].A;
         }
+        return tfPreIntDat;
+    }
 
-        TArray<FFloat16> tfPreIntDat;
-        tfPreIntDat.SetNum(TransferFunctionData::Resolution * TransferFunctionData::Resolution * 4);
-        auto tfPreIntDatPtr = reinterpret_cast<std::array<FFloat16, 4> *>(tfPreIntDat.GetData());
-        for (int32 sf = 0; sf < TransferFunctionData::Resolution; ++sf)
-            for (int32 sb = 0; sb < TransferFunctionData::Resolution; ++sb) {
-                auto sMin = sf;
-                auto sMax = sb;
-                if (sf > sb)
-                    std::swap(sMin, sMax);
+    // Pre-integrates each row of Resolution entries along scalars, e.g. a 1D transfer function
+    // read on the CPU, or each row of gradient magnitude of a 2D one assuming the magnitude is
+    // constant over a slab. Returns entries indexed by
+    // [(Row * Resolution + ScalarFront) * Resolution + ScalarBack].
+    static TArray<FLinearColor> ExecRows(const TArray<FLinearColor> &TF) {
+        constexpr auto res = TransferFunctionData::Resolution;
+        TArray<FLinearColor> ret;
+        if (TF.IsEmpty() || TF.Num() % res != 0)
+            return ret;
+        auto rowNum = static_cast<int32>(TF.Num() / res);
+
+        ret.SetNumUninitialized(static_cast<int64>(res) * res * rowNum);
+        ParallelFor(rowNum, [&](int32 r) {
+            execRow(TF.GetData() + r * res, ret.GetData() + static_cast<int64>(r) * res * res);
+        });
+
+        return ret;
+    }
 
+  private:
+    // Pre-integrates TFRow of Resolution entries into PreInt of Resolution x Resolution entries
+    // indexed by [ScalarFront * Resolution + ScalarBack]
+    static void execRow(const FLinearColor *TFRow, FLinearColor *PreInt) {
+        constexpr auto res = TransferFunctionData::Resolution;
+
+        std::array<FLinearColor, res> tfInt;
+        tfInt[0] = TFRow[0];
+        for (int32 i = 1; i < res; ++i) {
+            auto a = .5f * (TFRow[i - 1].A + TFRow[i].A);
+            tfInt[i] = tfInt[i - 1] + FLinearColor(.5f * (TFRow[i - 1].R + TFRow[i].R) * a,
+                                                   .5f * (TFRow[i - 1].G + TFRow[i].G) * a,
+                                                   .5f * (TFRow[i - 1].B + TFRow[i].B) * a, a);
+        }
+
+        for (int32 sf = 0; sf < res; ++sf)
+            for (int32 sb = 0; sb < res; ++sb) {
+                auto sMin = std::min(sf, sb);
+                auto sMax = std::max(sf, sb);
+
+                auto &entry = PreInt[sf * res + sb];
                 if (sMin == sMax) {
-                    auto a = tfDat[sMin][3].GetFloat();
-                    (*tfPreIntDatPtr)[0] = tfDat[sMin][0] * a;
-                    (*tfPreIntDatPtr)[1] = tfDat[sMin][1] * a;
-                    (*tfPreIntDatPtr)[2] = tfDat[sMin][2] * a;
-                    (*tfPreIntDatPtr)[3] = 1.f - FMath::Exp(-a);
+                    auto a = TFRow[sMin].A;
+                    entry = FLinearColor(TFRow[sMin].R * a, TFRow[sMin].G * a, TFRow[sMin].B * a,
+                                         1.f - FMath::Exp(-a));
                 } else {
                     auto factor = 1.f / (sMax - sMin);
-                    (*tfPreIntDatPtr)[0] = (tfIntDat[sMax][0] - tfIntDat[sMin][0]) * factor;
-                    (*tfPreIntDatPtr)[1] = (tfIntDat[sMax][1] - tfIntDat[sMin][1]) * factor;
-                    (*tfPreIntDatPtr)[2] = (tfIntDat[sMax][2] - tfIntDat[sMin][2]) * factor;
-                    (*tfPreIntDatPtr)[3] =
-                        1.f - FMath::Exp((tfIntDat[sMin][3] - tfIntDat[sMax][3]) * factor);
+                    entry =
+                        FLinearColor((tfInt[sMax].R - tfInt[sMin].R) * factor,
+                                     (tfInt[sMax].G - tfInt[sMin].G) * factor,
+                                     (tfInt[sMax].B - tfInt[sMin].B) * factor,
+                                     1.f - FMath::Exp((tfInt[sMin].A - tfInt[sMax].A) * factor));
                 }
-
-                ++tfPreIntDatPtr;
             }
-        Params.TransferFunctionTexture->GetPlatformData()->Mips[0].BulkData.Unlock();
-
-        return tfPreIntDat;
     }
 };
@@ -0,0 +1,111 @@
+// Author: Kouek Kou
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#include "BrickResidency.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace BrickResidencyTests {
+bool IsResident(const FBrickResidency &Residency, int32 Brick) {
+    return Residency.GetSlot(Brick) != FBrickResidency::InvalidSlot;
+}
+} // namespace BrickResidencyTests
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBrickResidencyLRUEvictionTest,
+                                 "VIS4Earth.BrickResidency.LRUEviction",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FBrickResidencyLRUEvictionTest::RunTest(const FString &Parameters) {
+    using namespace BrickResidencyTests;
+
+    FBrickResidency residency({.BrickNumber = {4, 1, 1}, .SlotNum = 2, .MaxLoadNum = 4});
+    FBrickResidency::Request req0{0, 1.f}, req1{1, 1.f}, req2{2, 1.f};
+    residency.Update({req0});
+    residency.Update({req1});
+    // Brick 0 is requested again, leaving brick 1 the least recently requested
+    auto loads = residency.Update({req0});
+    TestTrue(TEXT("Resident brick is not loaded again"), loads.IsEmpty());
+
+    auto slot1 = residency.GetSlot(1);
+    loads = residency.Update({req2});
+    TestEqual(TEXT("Miss is loaded"), loads.Num(), 1);
+    TestTrue(TEXT("Least recently requested brick is evicted"), !IsResident(residency, 1));
+    TestTrue(TEXT("Recently requested brick stays"), IsResident(residency, 0));
+    TestEqual(TEXT("Miss takes the slot of the evicted brick"), residency.GetSlot(2), slot1);
+    TestEqual(TEXT("Evicted number"), residency.GetEvictedNumber(), int64(1));
+
+    residency.Reset();
+    TestEqual(TEXT("Reset empties all slots"), residency.GetResidentNumber(), 0);
+    TestTrue(TEXT("Reset empties the page table"), !IsResident(residency, 0));
+
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBrickResidencyPriorityTest,
+                                 "VIS4Earth.BrickResidency.Priority",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FBrickResidencyPriorityTest::RunTest(const FString &Parameters) {
+    using namespace BrickResidencyTests;
+
+    // More bricks of a frame than slots keep those of the highest priorities
+    FBrickResidency residency({.BrickNumber = {4, 1, 1}, .SlotNum = 2, .MaxLoadNum = 4});
+    auto loads = residency.Update({{0, .1f}, {1, .2f}, {2, .9f}});
+    TestEqual(TEXT("Loads fill the slots"), loads.Num(), 2);
+    if (loads.Num() == 2) {
+        TestEqual(TEXT("Highest priority is loaded first"), loads[0].Brick, 2);
+        TestEqual(TEXT("Then the next highest"), loads[1].Brick, 1);
+    }
+    TestTrue(TEXT("Lowest priority is not loaded"), !IsResident(residency, 0));
+
+    // Bricks of the current frame are only evicted by higher priorities, lowest first
+    loads = residency.Update({{1, .2f}, {2, .9f}, {3, .5f}});
+    TestEqual(TEXT("Higher priority evicts a brick of the frame"), loads.Num(), 1);
+    TestTrue(TEXT("Higher priority is loaded"), IsResident(residency, 3));
+    TestTrue(TEXT("Lowest priority of the frame is evicted"), !IsResident(residency, 1));
+    TestTrue(TEXT("Highest priority of the frame stays"), IsResident(residency, 2));
+
+    loads = residency.Update({{2, .9f}, {3, .5f}, {0, .1f}});
+    TestTrue(TEXT("Lower priority evicts no brick of the frame"), loads.IsEmpty());
+
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBrickResidencyBudgetTest, "VIS4Earth.BrickResidency.Budget",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FBrickResidencyBudgetTest::RunTest(const FString &Parameters) {
+    using namespace BrickResidencyTests;
+
+    // At most MaxLoadNum bricks are loaded per update, the rest in the following ones
+    FBrickResidency residency({.BrickNumber = {2, 2, 2}, .SlotNum = 8, .MaxLoadNum = 3});
+    TArray<FBrickResidency::Request> reqs;
+    for (int32 b = 0; b < 5; ++b)
+        reqs.Emplace(FBrickResidency::Request{b, static_cast<float>(b)});
+    // Out of the volume, ignored
+    reqs.Emplace(FBrickResidency::Request{8, 10.f});
+    reqs.Emplace(FBrickResidency::Request{-1, 10.f});
+
+    auto loads = residency.Update(reqs);
+    TestEqual(TEXT("Loads are bounded by MaxLoadNum"), loads.Num(), 3);
+    for (int32 b = 2; b < 5; ++b)
+        TestTrue(TEXT("Highest priorities are loaded within the budget"), IsResident(residency, b));
+
+    loads = residency.Update(reqs);
+    TestEqual(TEXT("The rest are loaded by the next update"), loads.Num(), 2);
+    TestEqual(TEXT("Resident number"), residency.GetResidentNumber(), 5);
+    TestEqual(TEXT("Loaded number"), residency.GetLoadedNumber(), int64(5));
+
+    loads = residency.Update(reqs);
+    TestTrue(TEXT("All resident, nothing is loaded"), loads.IsEmpty());
+    TestEqual(TEXT("Nothing is evicted with free slots"), residency.GetEvictedNumber(), int64(0));
+
+    return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
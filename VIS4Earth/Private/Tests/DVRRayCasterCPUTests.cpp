@@ -0,0 +1,319 @@
+// Author: Kouek Kou
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#include "DVRRayCasterCPU.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace DVRRayCasterCPUTests {
+// Center of the default geographical ranges
+constexpr double CenterLon = 115.;
+constexpr double CenterLat = 12.5;
+
+// Returns the eye at Eye in Earth-Centered Earth-Fixed meters looking at Target
+FMatrix MakeEyeToEarth(const FVector &Eye, const FVector &Target) {
+    auto fwd = (Target - Eye).GetSafeNormal();
+    auto right = FVector(0., 0., 1.).Cross(fwd).GetSafeNormal();
+    auto up = fwd.Cross(right);
+    FMatrix ret = FMatrix::Identity;
+    ret.SetAxis(0, right);
+    ret.SetAxis(1, up);
+    ret.SetAxis(2, fwd);
+    ret.SetOrigin(Eye);
+    return ret;
+}
+
+// Maps NDC (x, y, 1, 1) to (x tan(30), y tan(30), 1) in the eye
+FMatrix MakeInvProjection() {
+    auto tanHalfFov = FMath::Tan(FMath::DegreesToRadians(30.));
+    FMatrix ret = FMatrix::Identity;
+    ret.M[0][0] = ret.M[1][1] = tanHalfFov;
+    ret.M[2][2] = 0.;
+    ret.M[3][2] = 1.;
+    return ret;
+}
+
+// A box of a uniform low opacity in an empty volume
+const FIntVector BoxDimension(64, 64, 32);
+TArray<uint8> MakeBoxVolume() {
+    auto &dim = BoxDimension;
+    TArray<uint8> ret;
+    ret.Init(0, static_cast<int64>(dim.X) * dim.Y * dim.Z);
+    for (int32 z = 10; z < 20; ++z)
+        for (int32 y = 28; y < 40; ++y)
+            for (int32 x = 20; x < 44; ++x)
+                ret[(static_cast<int64>(z) * dim.Y + y) * dim.X + x] = 150;
+    return ret;
+}
+
+TArray<FLinearColor> MakeBoxTransferFunction() {
+    TArray<FLinearColor> ret;
+    ret.Init(FLinearColor::Transparent, TransferFunctionData::Resolution);
+    for (int32 i = 100; i < TransferFunctionData::Resolution; ++i)
+        ret[i] = FLinearColor(1.f, .5f, 0.f, .005f);
+    return ret;
+}
+
+// Sees the box obliquely from 2000 km above
+FDVRRayCasterCPU::Parameters MakeBoxParameters(const TArray<FLinearColor> &TF) {
+    auto center = FShellSectorIntersector::ToEarth({CenterLon, CenterLat, 0.});
+    auto eye = FShellSectorIntersector::ToEarth({CenterLon, CenterLat, 2000000.}) +
+               FVector(300000., -200000., 100000.);
+    return {.Step = 1000.f,
+            .EarlyTerminationAlpha = 2.f,
+            .MaxStepScale = 1,
+            .AdaptiveStepTolerance = .02f,
+            .RecordStepCounts = true,
+            .RenderSize = {64, 64},
+            .EyeToEarth = MakeEyeToEarth(eye, center),
+            .InvProjection = MakeInvProjection(),
+            .Dimension = BoxDimension,
+            .TransferFunction = TF};
+}
+
+float GetMaxAlphaDifference(const FDVRRayCasterCPU::Image &A, const FDVRRayCasterCPU::Image &B) {
+    auto ret = 0.f;
+    for (int64 i = 0; i < A.Pixels.Num(); ++i)
+        ret = std::max(ret, FMath::Abs(A.Pixels[i].A - B.Pixels[i].A));
+    return ret;
+}
+} // namespace DVRRayCasterCPUTests
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDVRRayCasterCPUAdaptiveStepTest,
+                                 "VIS4Earth.DVRRayCasterCPU.AdaptiveStep",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FDVRRayCasterCPUAdaptiveStepTest::RunTest(const FString &Parameters) {
+    using namespace DVRRayCasterCPUTests;
+
+    auto volDat = MakeBoxVolume();
+    auto tf = MakeBoxTransferFunction();
+    FVolumeOccupancy occupancy(
+        FVolumeOccupancy::Parameters{.BrickSize = 8, .Dimension = BoxDimension}, volDat.GetData());
+    TArray<float> alphas;
+    for (auto &col : tf)
+        alphas.Emplace(col.A);
+    occupancy.UpdateTransferFunction(alphas);
+
+    auto params = MakeBoxParameters(tf);
+    auto fixedImg = FDVRRayCasterCPU::Exec(params, volDat.GetData());
+    params.MaxStepScale = 8;
+    params.Occupancy = &occupancy;
+    auto adaptiveImg = FDVRRayCasterCPU::Exec(params, volDat.GetData());
+    if (!TestEqual(TEXT("Image sizes"), adaptiveImg.Pixels.Num(), fixedImg.Pixels.Num()))
+        return false;
+
+    int64 fixedStepNum = 0, adaptiveStepNum = 0;
+    auto maxAlpha = 0.f;
+    for (int64 i = 0; i < fixedImg.Pixels.Num(); ++i) {
+        fixedStepNum += fixedImg.StepCounts[i];
+        adaptiveStepNum += adaptiveImg.StepCounts[i];
+        maxAlpha = std::max(maxAlpha, fixedImg.Pixels[i].A);
+    }
+    auto maxAlphaDiff = GetMaxAlphaDifference(fixedImg, adaptiveImg);
+    auto pixNum = static_cast<double>(fixedImg.Pixels.Num());
+    AddInfo(FString::Printf(
+        TEXT("Steps per pixel: %.1f fixed, %.1f adaptive. Max alpha deviation: %.4f."),
+        fixedStepNum / pixNum, adaptiveStepNum / pixNum, maxAlphaDiff));
+
+    TestTrue(TEXT("Box is visible"), maxAlpha > .1f);
+    TestTrue(TEXT("Adaptive stepping marches at most a quarter of the fixed steps"),
+             adaptiveStepNum * 4 <= fixedStepNum);
+    TestTrue(TEXT("Adaptive stepping deviates within the tolerance"),
+             maxAlphaDiff <= params.AdaptiveStepTolerance);
+
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDVRRayCasterCPUOpacityReferenceStepTest,
+                                 "VIS4Earth.DVRRayCasterCPU.OpacityReferenceStep",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FDVRRayCasterCPUOpacityReferenceStepTest::RunTest(const FString &Parameters) {
+    using namespace DVRRayCasterCPUTests;
+
+    // A step coarsened as in motion keeps the opacities of the reference step only if corrected
+    auto volDat = MakeBoxVolume();
+    auto tf = MakeBoxTransferFunction();
+    auto params = MakeBoxParameters(tf);
+    auto refImg = FDVRRayCasterCPU::Exec(params, volDat.GetData());
+    params.OpacityReferenceStep = params.Step;
+    params.Step *= 4.f;
+    auto correctedImg = FDVRRayCasterCPU::Exec(params, volDat.GetData());
+    params.OpacityReferenceStep = 0.f;
+    auto uncorrectedImg = FDVRRayCasterCPU::Exec(params, volDat.GetData());
+    if (!TestEqual(TEXT("Image sizes"), correctedImg.Pixels.Num(), refImg.Pixels.Num()))
+        return false;
+
+    auto correctedDiff = GetMaxAlphaDifference(refImg, correctedImg);
+    auto uncorrectedDiff = GetMaxAlphaDifference(refImg, uncorrectedImg);
+    AddInfo(FString::Printf(TEXT("Max alpha deviation: %.4f corrected, %.4f uncorrected."),
+                            correctedDiff, uncorrectedDiff));
+
+    TestTrue(TEXT("Corrected coarse steps keep the opacities"), correctedDiff <= .02f);
+    TestTrue(TEXT("Uncorrected coarse steps lose the opacities"), uncorrectedDiff > .1f);
+
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDVRRayCasterCPUResidentBricksTest,
+                                 "VIS4Earth.DVRRayCasterCPU.ResidentBricks",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FDVRRayCasterCPUResidentBricksTest::RunTest(const FString &Parameters) {
+    using namespace DVRRayCasterCPUTests;
+
+    // Only bricks resident in a brick pool are marched
+    auto volDat = MakeBoxVolume();
+    auto tf = MakeBoxTransferFunction();
+    FVolumeOccupancy occupancy(
+        FVolumeOccupancy::Parameters{.BrickSize = 8, .Dimension = BoxDimension}, volDat.GetData());
+    TArray<float> alphas;
+    for (auto &col : tf)
+        alphas.Emplace(col.A);
+    occupancy.UpdateTransferFunction(alphas);
+
+    auto params = MakeBoxParameters(tf);
+    params.Occupancy = &occupancy;
+    auto fullImg = FDVRRayCasterCPU::Exec(params, volDat.GetData());
+
+    auto &brickNum = occupancy.GetBrickNumber();
+    TArray<int32> pageTable;
+    pageTable.Init(0, static_cast<int64>(brickNum.X) * brickNum.Y * brickNum.Z);
+    params.ResidentBricks = &pageTable;
+    auto residentImg = FDVRRayCasterCPU::Exec(params, volDat.GetData());
+    pageTable.Init(FBrickResidency::InvalidSlot, pageTable.Num());
+    auto evictedImg = FDVRRayCasterCPU::Exec(params, volDat.GetData());
+    if (!TestEqual(TEXT("Image sizes"), residentImg.Pixels.Num(), fullImg.Pixels.Num()) ||
+        !TestEqual(TEXT("Image sizes"), evictedImg.Pixels.Num(), fullImg.Pixels.Num()))
+        return false;
+
+    auto maxAlpha = 0.f;
+    for (auto &pix : evictedImg.Pixels)
+        maxAlpha = std::max(maxAlpha, pix.A);
+    TestTrue(TEXT("All resident bricks render the whole volume"),
+             GetMaxAlphaDifference(fullImg, residentImg) == 0.f);
+    TestTrue(TEXT("No resident brick renders nothing"), maxAlpha == 0.f);
+
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FDVRRayCasterCPUIsosurfaceTest,
+                                 "VIS4Earth.DVRRayCasterCPU.Isosurface",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FDVRRayCasterCPUIsosurfaceTest::RunTest(const FString &Parameters) {
+    using namespace DVRRayCasterCPUTests;
+
+    // Field of a sphere in the Earth, whose isosurface at IsoValue is the sphere. It is
+    // quadratic in the distance, so that the crossing is only found by bisections.
+    const FVector2d lonRng(-1., 1.), latRng(-1., 1.), hRng(0., 200000.);
+    auto sphereCenter = FShellSectorIntersector::ToEarth({0., 0., 100000.});
+    constexpr double SphereRadius = 50000.;
+    constexpr float IsoValue = 32768.f;
+    FIntVector dim(128, 128, 128);
+    TArray<uint16> volDat;
+    volDat.SetNumUninitialized(static_cast<int64>(dim.X) * dim.Y * dim.Z);
+    FIntVector pos;
+    for (pos.Z = 0; pos.Z < dim.Z; ++pos.Z)
+        for (pos.Y = 0; pos.Y < dim.Y; ++pos.Y)
+            for (pos.X = 0; pos.X < dim.X; ++pos.X) {
+                auto coord = [&](int32 axis, const FVector2d &rng) {
+                    return FMath::Lerp(rng[0], rng[1], (pos[axis] + .5) / dim[axis]);
+                };
+                auto dist = FVector::Dist(FShellSectorIntersector::ToEarth(
+                                              {coord(0, lonRng), coord(1, latRng), coord(2, hRng)}),
+                                          sphereCenter);
+                auto val =
+                    IsoValue + .5 * (SphereRadius * SphereRadius - dist * dist) / SphereRadius;
+                volDat[(static_cast<int64>(pos.Z) * dim.Y + pos.Y) * dim.X + pos.X] =
+                    static_cast<uint16>(FMath::Clamp(FMath::RoundToDouble(val), 0., 65535.));
+            }
+    auto grads = GradientVolume::FromFlatArray(
+        {.VoxTy = ESupportedVoxelType::UInt16,
+         .Dimension = dim,
+         .VolDat = TConstArrayView<uint8>(reinterpret_cast<const uint8 *>(volDat.GetData()),
+                                          sizeof(uint16) * volDat.Num())});
+    if (!TestTrue(TEXT("Gradients are computed"), grads.IsType<GradientVolume>()))
+        return false;
+
+    // Opaque white, lit only by the diffuse term, so that the red of a hit is |normal . ray|
+    TArray<FLinearColor> tf;
+    tf.Init(FLinearColor::White, TransferFunctionData::Resolution);
+    auto eye = FShellSectorIntersector::ToEarth({.5, .3, 280000.});
+    FDVRRayCasterCPU::Parameters params{.Step = 8000.f,
+                                        .UseIsosurface = true,
+                                        .IsoValue = IsoValue,
+                                        .IsoBisectionNum = 6,
+                                        .RecordDepths = true,
+                                        .UseShading = true,
+                                        .Ambient = 0.f,
+                                        .Diffuse = 1.f,
+                                        .Specular = 0.f,
+                                        .RenderSize = {32, 32},
+                                        .LongtitudeRange = lonRng,
+                                        .LatitudeRange = latRng,
+                                        .HeightRange = hRng,
+                                        .EyeToEarth = MakeEyeToEarth(eye, sphereCenter),
+                                        .InvProjection = MakeInvProjection(),
+                                        .Dimension = dim,
+                                        .TransferFunction = tf,
+                                        .Gradients = &grads.Get<GradientVolume>()};
+    auto img = FDVRRayCasterCPU::Exec(params, volDat.GetData());
+    if (!TestEqual(TEXT("Depth number"), img.Depths.Num(), img.Pixels.Num()))
+        return false;
+
+    // Hits are off the sphere by no more than the bracket left by the bisections of the step
+    auto distTolerance = params.Step / (1 << params.IsoBisectionNum);
+    int32 hitNum = 0;
+    auto maxDistErr = 0., maxCosErr = 0.;
+    for (int32 y = 0; y < img.Size.Y; ++y)
+        for (int32 x = 0; x < img.Size.X; ++x) {
+            FVector4 ndc(2. * (x + .5) / img.Size.X - 1., 1. - 2. * (y + .5) / img.Size.Y, 1.,
+                         1.);
+            auto eyePos = params.InvProjection.TransformFVector4(ndc);
+            auto dir = params.EyeToEarth.TransformVector(FVector(eyePos) / eyePos.W);
+            dir.Normalize();
+
+            // Skips rays grazing the sphere, whose hits are ill-conditioned
+            auto b = dir.Dot(sphereCenter - eye);
+            auto disc = b * b - (eye - sphereCenter).SizeSquared() + SphereRadius * SphereRadius;
+            auto pixIdx = static_cast<int64>(y) * img.Size.X + x;
+            if (disc <= 0.) {
+                TestTrue(TEXT("Ray missing the sphere misses the isosurface"),
+                         img.Depths[pixIdx] < 0.);
+                continue;
+            }
+            auto cosTheta = FMath::Sqrt(disc) / SphereRadius;
+            if (cosTheta < .3)
+                continue;
+
+            ++hitNum;
+            if (img.Depths[pixIdx] < 0.) {
+                maxDistErr = std::numeric_limits<double>::infinity();
+                continue;
+            }
+            auto hitPos = eye + img.Depths[pixIdx] * dir;
+            maxDistErr = std::max(maxDistErr,
+                                  FMath::Abs(FVector::Dist(hitPos, sphereCenter) - SphereRadius));
+            maxCosErr = std::max(maxCosErr, FMath::Abs(img.Pixels[pixIdx].R - cosTheta));
+        }
+    AddInfo(FString::Printf(TEXT("%d hits. Max distance to the sphere: %.2f m. Max cosine error: "
+                                 "%.4f."),
+                            hitNum, maxDistErr, maxCosErr));
+
+    TestTrue(TEXT("Rays hit the sphere"), hitNum > 100);
+    TestTrue(TEXT("Hits are on the sphere within the bisection tolerance"),
+             maxDistErr <= distTolerance);
+    TestTrue(TEXT("Normals follow the sphere"), maxCosErr <= .03);
+
+    return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
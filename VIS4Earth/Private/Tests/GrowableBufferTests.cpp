@@ -0,0 +1,89 @@
+// Author: Kouek Kou
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "RenderingThread.h"
+
+#include "GrowableBuffer.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FGrowableBufferGrowShrinkTest,
+                                 "VIS4Earth.GrowableBuffer.GrowShrink",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FGrowableBufferGrowShrinkTest::RunTest(const FString &Parameters) {
+    constexpr uint32 MinCapacity = 256;
+    constexpr int32 DoublingNum = 4;
+    constexpr int32 ShrinkDelay = 4;
+    constexpr int32 RingSize = 2;
+
+    struct Record {
+        FString What;
+        int64 AllocNum;
+        int64 ReleaseNum;
+        int64 AllocatedByteNum;
+        int64 ExpectedAllocNum;
+        int64 ExpectedReleaseNum;
+        int64 ExpectedAllocatedByteNum;
+    };
+    TArray<Record> records;
+
+    // Statistics are shared by all instances, so deltas are taken within one render command
+    ENQUEUE_RENDER_COMMAND(GrowableBufferGrowShrinkTest)
+    ([&](FRHICommandListImmediate &RHICmdList) {
+        FGrowableBuffer buffer(
+            {.MinCapacity = MinCapacity, .ShrinkDelay = ShrinkDelay, .RingSize = RingSize});
+        TArray<uint8> dat;
+        dat.SetNumZeroed(MinCapacity << DoublingNum);
+
+        auto base = FGrowableBuffer::GetStatistics();
+        auto record = [&](FString What, int64 AllocNum, int64 ReleaseNum,
+                          int64 AllocatedByteNum) {
+            auto stats = FGrowableBuffer::GetStatistics();
+            records.Emplace(Record{What, stats.AllocNum - base.AllocNum,
+                                   stats.ReleaseNum - base.ReleaseNum,
+                                   stats.AllocatedByteNum - base.AllocatedByteNum, AllocNum,
+                                   ReleaseNum, AllocatedByteNum});
+        };
+
+        // Each size is uploaded once per buffer of the ring, each upload doubles one of them
+        int64 allocNum = 0;
+        for (int32 k = 0; k <= DoublingNum; ++k) {
+            auto sz = MinCapacity << k;
+            for (int32 i = 0; i < RingSize; ++i)
+                buffer.Upload(RHICmdList, dat.GetData(), sz);
+            allocNum += RingSize;
+            record(FString::Printf(TEXT("Growing to %u bytes"), sz), allocNum,
+                   allocNum - RingSize, static_cast<int64>(sz) * RingSize);
+        }
+
+        // Small uploads only shrink each buffer once they last ShrinkDelay uploads
+        constexpr uint32 SmallSz = 64;
+        auto grownCap = static_cast<int64>(MinCapacity << DoublingNum) * RingSize;
+        for (int32 i = 0; i < (ShrinkDelay - 1) * RingSize; ++i)
+            buffer.Upload(RHICmdList, dat.GetData(), SmallSz);
+        record(TEXT("Before ShrinkDelay"), allocNum, allocNum - RingSize, grownCap);
+        for (int32 i = 0; i < RingSize; ++i)
+            buffer.Upload(RHICmdList, dat.GetData(), SmallSz);
+        record(TEXT("After ShrinkDelay"), allocNum + RingSize, allocNum,
+               static_cast<int64>(MinCapacity) * RingSize);
+
+        buffer.Reset();
+        record(TEXT("Reset"), allocNum + RingSize, allocNum + RingSize, 0);
+    });
+    FlushRenderingCommands();
+
+    for (auto &rec : records) {
+        TestEqual(rec.What + TEXT(", allocated number"), rec.AllocNum, rec.ExpectedAllocNum);
+        TestEqual(rec.What + TEXT(", released number"), rec.ReleaseNum, rec.ExpectedReleaseNum);
+        TestEqual(rec.What + TEXT(", allocated bytes"), rec.AllocatedByteNum,
+                  rec.ExpectedAllocatedByteNum);
+    }
+    TestEqual(TEXT("Every step is checked"), records.Num(), DoublingNum + 4);
+
+    return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
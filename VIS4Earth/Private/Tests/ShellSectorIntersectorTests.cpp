@@ -0,0 +1,173 @@
+// Author: Kouek Kou
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#include "ShellSectorIntersector.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace ShellSectorIntersectorTests {
+const FShellSectorIntersector::Parameters Params{.LongtitudeRange = {-10., 10.},
+                                                 .LatitudeRange = {10., 30.},
+                                                 .HeightRange = {0., 1000000.}};
+
+// Returns the unit vector at (longitude, latitude) in degrees
+FVector ToUnit(double Lon, double Lat) {
+    return FShellSectorIntersector::ToEarth({Lon, Lat, 0.}) / FShellSectorIntersector::EarthRadius;
+}
+
+double GetLength(const FShellSectorIntersector::Segments &Segs) {
+    auto ret = 0.;
+    for (int32 i = 0; i < Segs.Num; ++i)
+        ret += Segs.Ranges[i][1] - Segs.Ranges[i][0];
+    return ret;
+}
+} // namespace ShellSectorIntersectorTests
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FShellSectorIntersectorCrossingTest,
+                                 "VIS4Earth.ShellSectorIntersector.Crossing",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FShellSectorIntersectorCrossingTest::RunTest(const FString &Parameters) {
+    using namespace ShellSectorIntersectorTests;
+
+    // Segments agree with IsInside() on samples along a ray through the sector
+    auto origin = FShellSectorIntersector::ToEarth({-20., 5., 3000000.});
+    auto dir = (FShellSectorIntersector::ToEarth({8., 25., 200000.}) - origin).GetSafeNormal();
+    auto segs = FShellSectorIntersector::Exec(Params, origin, dir);
+    TestFalse(TEXT("Ray through the sector hits it"), segs.IsEmpty());
+
+    auto hull = segs.GetHull();
+    constexpr int32 SampleNum = 1000;
+    for (int32 i = 0; i <= SampleNum; ++i) {
+        auto t = hull[0] - 1000. + (hull[1] - hull[0] + 2000.) * i / SampleNum;
+        auto isInSeg = false, isNearEnd = false;
+        for (int32 s = 0; s < segs.Num; ++s) {
+            isInSeg |= t >= segs.Ranges[s][0] && t <= segs.Ranges[s][1];
+            isNearEnd |= FMath::Abs(t - segs.Ranges[s][0]) < 1. ||
+                         FMath::Abs(t - segs.Ranges[s][1]) < 1.;
+        }
+        if (!isNearEnd)
+            TestEqual(TEXT("Segments agree with IsInside()"), isInSeg,
+                      FShellSectorIntersector::IsInside(Params, origin + t * dir));
+    }
+
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FShellSectorIntersectorGrazingTest,
+                                 "VIS4Earth.ShellSectorIntersector.Grazing",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FShellSectorIntersectorGrazingTest::RunTest(const FString &Parameters) {
+    using namespace ShellSectorIntersectorTests;
+
+    // Tangent to the outer sphere, then 100 m below it, where the chord is known
+    {
+        auto rOut = FShellSectorIntersector::EarthRadius + Params.HeightRange[1];
+        auto up = ToUnit(0., 20.);
+        FVector east(0., 1., 0.);
+        auto segs = FShellSectorIntersector::Exec(Params, rOut * up - 1000000. * east, east);
+        TestTrue(TEXT("Ray tangent to the outer sphere grazes it"), GetLength(segs) < 1.);
+
+        segs = FShellSectorIntersector::Exec(Params, (rOut - 100.) * up - 1000000. * east, east);
+        TestEqual(TEXT("Chord below the outer sphere"), segs.Num, 1);
+        TestEqual(TEXT("Chord below the outer sphere"), GetLength(segs),
+                  2. * FMath::Sqrt(rOut * rOut - FMath::Square(rOut - 100.)), 1e-2);
+    }
+
+    // Parallel to the plane of the minimum longitude, 10 m outside and inside it
+    {
+        auto up = ToUnit(Params.LongtitudeRange[0], 20.);
+        auto lon = FMath::DegreesToRadians(Params.LongtitudeRange[0]);
+        FVector east(-FMath::Sin(lon), FMath::Cos(lon), 0.);
+        auto origin = (FShellSectorIntersector::EarthRadius + 2000000.) * up;
+        auto segs = FShellSectorIntersector::Exec(Params, origin - 10. * east, -up);
+        TestTrue(TEXT("Ray outside the longitude plane misses"), segs.IsEmpty());
+
+        segs = FShellSectorIntersector::Exec(Params, origin + 10. * east, -up);
+        TestEqual(TEXT("Ray inside the longitude plane crosses the shell"), GetLength(segs),
+                  Params.HeightRange[1] - Params.HeightRange[0], 1e-2);
+    }
+
+    // Horizontal, touching the cone of the minimum latitude from below, then 1 km above it
+    {
+        auto r = FShellSectorIntersector::EarthRadius + 500000.;
+        auto pos = r * ToUnit(0., Params.LatitudeRange[0]);
+        FVector east(0., 1., 0.);
+        auto segs = FShellSectorIntersector::Exec(Params, pos - 1000000. * east, east);
+        TestTrue(TEXT("Ray tangent to the latitude cone grazes it"), GetLength(segs) < 1.);
+
+        segs = FShellSectorIntersector::Exec(Params, pos + FVector(0., -1000000., 1000.), east);
+        TestFalse(TEXT("Ray above the latitude cone enters the sector"), segs.IsEmpty());
+        for (int32 s = 0; s < segs.Num; ++s)
+            TestTrue(TEXT("Ray above the latitude cone is inside between crossings"),
+                     FShellSectorIntersector::IsInside(
+                         Params, pos + FVector(0., -1000000., 1000.) +
+                                     .5 * (segs.Ranges[s][0] + segs.Ranges[s][1]) * east));
+    }
+
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FShellSectorIntersectorInsideTest,
+                                 "VIS4Earth.ShellSectorIntersector.Inside",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FShellSectorIntersectorInsideTest::RunTest(const FString &Parameters) {
+    using namespace ShellSectorIntersectorTests;
+
+    // Starts inside the shell and goes straight up
+    auto up = ToUnit(0., 20.);
+    auto segs = FShellSectorIntersector::Exec(
+        Params, (FShellSectorIntersector::EarthRadius + 500000.) * up, up);
+    TestEqual(TEXT("Ray from inside has one segment"), segs.Num, 1);
+    if (segs.Num == 1) {
+        TestEqual(TEXT("Ray from inside enters at its origin"), segs.Ranges[0][0], 0.);
+        TestEqual(TEXT("Ray from inside exits at the outer sphere"), segs.Ranges[0][1],
+                  Params.HeightRange[1] - 500000., 1e-3);
+    }
+
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FShellSectorIntersectorEmptyTest,
+                                 "VIS4Earth.ShellSectorIntersector.Empty",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FShellSectorIntersectorEmptyTest::RunTest(const FString &Parameters) {
+    using namespace ShellSectorIntersectorTests;
+
+    auto up = ToUnit(0., 20.);
+    auto origin = (FShellSectorIntersector::EarthRadius + 2000000.) * up;
+    auto segs = FShellSectorIntersector::Exec(Params, origin, up);
+    TestTrue(TEXT("Ray leaving the Earth misses"), segs.IsEmpty());
+    auto hull = segs.GetHull();
+    TestTrue(TEXT("Hull of no segment is empty"), hull[0] > hull[1]);
+
+    // Crosses the shell at longitudes out of the sector
+    origin = (FShellSectorIntersector::EarthRadius + 2000000.) * ToUnit(90., 20.);
+    segs = FShellSectorIntersector::Exec(Params, origin, -ToUnit(90., 20.));
+    TestTrue(TEXT("Ray through other longitudes misses"), segs.IsEmpty());
+
+    // Wrapping longitude ranges are rejected instead of treated as their complements
+    auto wrapped = Params;
+    wrapped.LongtitudeRange = {170., -170.};
+    TestFalse(TEXT("Wrapping longitude range is invalid"),
+              FShellSectorIntersector::IsValid(wrapped));
+    wrapped.LongtitudeRange = {170., 190.};
+    TestFalse(TEXT("Longitude range beyond 180 is invalid"),
+              FShellSectorIntersector::IsValid(wrapped));
+    origin = (FShellSectorIntersector::EarthRadius + 2000000.) * ToUnit(180., 20.);
+    segs = FShellSectorIntersector::Exec(wrapped, origin, -ToUnit(180., 20.));
+    TestTrue(TEXT("Ray into a wrapping longitude range misses"), segs.IsEmpty());
+
+    return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
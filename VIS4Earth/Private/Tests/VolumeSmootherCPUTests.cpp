@@ -0,0 +1,100 @@
+// Author: Kouek Kou
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#include "VolumeSmootherCPU.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace VolumeSmootherCPUTests {
+const FIntVector Dimension(37, 23, 11);
+
+template <SupportedVoxelType T> TArray<T> MakeRandomVolume(float VoxMax) {
+    FRandomStream rand(27);
+    TArray<T> ret;
+    ret.SetNumUninitialized(static_cast<int64>(Dimension.X) * Dimension.Y * Dimension.Z);
+    for (auto &v : ret)
+        v = static_cast<T>(rand.FRandRange(0.f, VoxMax));
+    return ret;
+}
+
+// Same as the smoothing shader, which visits the 3x3x3 (or 3x3 for XY) neighbourhood restricted
+// to valid voxels and sums it in float
+template <SupportedVoxelType T>
+TArray<float> SmoothAsShader(EVolumeSmoothType SmoothType, EVolumeSmoothDimension SmoothDimension,
+                             const TArray<T> &VolDat) {
+    auto &dim = Dimension;
+    auto idx = [&](int32 x, int32 y, int32 z) {
+        return (static_cast<int64>(z) * dim.Y + y) * dim.X + x;
+    };
+    auto rz = SmoothDimension == EVolumeSmoothDimension::XY ? 0 : 1;
+
+    TArray<float> ret;
+    ret.SetNumUninitialized(VolDat.Num());
+    for (int32 z = 0; z < dim.Z; ++z)
+        for (int32 y = 0; y < dim.Y; ++y)
+            for (int32 x = 0; x < dim.X; ++x) {
+                auto sum = 0.f;
+                auto max = std::numeric_limits<float>::lowest();
+                auto cnt = 0;
+                for (int32 dz = -rz; dz <= rz; ++dz)
+                    for (int32 dy = -1; dy <= 1; ++dy)
+                        for (int32 dx = -1; dx <= 1; ++dx) {
+                            FIntVector pos(x + dx, y + dy, z + dz);
+                            if (pos.X < 0 || pos.Y < 0 || pos.Z < 0 || pos.X >= dim.X ||
+                                pos.Y >= dim.Y || pos.Z >= dim.Z)
+                                continue;
+                            auto v = static_cast<float>(VolDat[idx(pos.X, pos.Y, pos.Z)]);
+                            sum += v;
+                            max = std::max(max, v);
+                            ++cnt;
+                        }
+                ret[idx(x, y, z)] = SmoothType == EVolumeSmoothType::Max ? max : sum / cnt;
+            }
+    return ret;
+}
+
+template <SupportedVoxelType T>
+float GetMaxDifference(EVolumeSmoothType SmoothType, EVolumeSmoothDimension SmoothDimension,
+                       const TArray<T> &VolDat) {
+    auto cpu = FVolumeSmootherCPU::Exec(
+        {.SmoothType = SmoothType, .SmoothDimension = SmoothDimension, .Dimension = Dimension},
+        VolDat.GetData());
+    auto gpu = SmoothAsShader(SmoothType, SmoothDimension, VolDat);
+
+    auto ret = 0.f;
+    for (int64 i = 0; i < gpu.Num(); ++i)
+        ret = std::max(ret, FMath::Abs(cpu[i] - gpu[i]));
+    return ret;
+}
+} // namespace VolumeSmootherCPUTests
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVolumeSmootherCPUGPUParityTest,
+                                 "VIS4Earth.VolumeSmootherCPU.GPUParity",
+                                 EAutomationTestFlags::EditorContext |
+                                     EAutomationTestFlags::EngineFilter)
+
+bool FVolumeSmootherCPUGPUParityTest::RunTest(const FString &Parameters) {
+    using namespace VolumeSmootherCPUTests;
+
+    auto test = [&]<SupportedVoxelType T>(const TArray<T> &VolDat, float VoxExt) {
+        auto tolerance = FVolumeSmootherCPU::GPUParityTolerance * VoxExt;
+        for (auto smoothDim : {EVolumeSmoothDimension::XYZ, EVolumeSmoothDimension::XY}) {
+            auto dimStr = smoothDim == EVolumeSmoothDimension::XY ? TEXT("XY") : TEXT("XYZ");
+            TestTrue(FString::Printf(TEXT("Max over %s equals the shader"), dimStr),
+                     GetMaxDifference(EVolumeSmoothType::Max, smoothDim, VolDat) == 0.f);
+            auto avgDiff = GetMaxDifference(EVolumeSmoothType::Avg, smoothDim, VolDat);
+            TestTrue(FString::Printf(TEXT("Avg over %s is within %g of the shader, got %g"),
+                                     dimStr, tolerance, avgDiff),
+                     avgDiff <= tolerance);
+        }
+    };
+    test(MakeRandomVolume<uint8>(255.f), 255.f);
+    test(MakeRandomVolume<uint16>(65535.f), 65535.f);
+    test(MakeRandomVolume<float>(1.f), 1.f);
+
+    return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -4,6 +4,8 @@
 
 #define LOCTEXT_NAMESPACE "FVIS4EarthModule"
 
+DEFINE_LOG_CATEGORY(LogVIS4Earth);
+
 void FVIS4EarthModule::StartupModule() {
     // This code will execute after your module is loaded into memory; the exact timing is specified
     // in the .uplugin file per-module
@@ -84,18 +84,16 @@ void UVolumeDataComponent::LoadRAWVolume() {
     if (files.IsEmpty())
         return;
 
-    auto volume = keepVolumeInCPU ? VolumeData::LoadFromFile({.VoxTy = ImportVoxelType,
-                                                              .Axis = ImportVolumeTransformedAxis,
-                                                              .Dimension = ImportVolumeDimension,
-                                                              .FilePath = files[0]},
-                                                             std::reference_wrapper(volumeCPUData))
-                                  : VolumeData::LoadFromFile({.VoxTy = ImportVoxelType,
-                                                              .Axis = ImportVolumeTransformedAxis,
-                                                              .Dimension = ImportVolumeDimension,
-                                                              .FilePath = files[0]});
+    TArray<uint8> volDat;
+    auto volume = VolumeData::LoadFromFile({.VoxTy = ImportVoxelType,
+                                            .Axis = ImportVolumeTransformedAxis,
+                                            .Dimension = ImportVolumeDimension,
+                                            .FilePath = files[0],
+                                            .UploadToGPU = keepVolumeInGPU},
+                                           std::reference_wrapper(volDat));
     if (volume.IsType<FString>()) {
         auto &errMsg = volume.Get<FString>();
-        processError(errMsg);
+        ProcessError(errMsg);
         return;
     }
 
@@ -104,11 +102,49 @@ void UVolumeDataComponent::LoadRAWVolume() {
     prevVolumeDataDesc.VoxTy = ImportVoxelType;
     prevVolumeDataDesc.Dimension = ImportVolumeDimension;
 
+    // Scanned once here, subsystems query the cached statistics instead of the volume
+    if (auto stats = VolumeStatistics::FromFlatArray(
+            {.VoxTy = ImportVoxelType,
+             .Dimension = FIntVector(VolumeTexture->GetSizeX(), VolumeTexture->GetSizeY(),
+                                     VolumeTexture->GetSizeZ()),
+             .VolDat = volDat});
+        stats.IsType<FString>()) {
+        ProcessError(stats.Get<FString>());
+        volumeStatistics = {};
+    } else
+        volumeStatistics = std::move(stats.Get<VolumeStatistics>());
+
+    if (volumeStatistics.IsValid()) {
+        if (auto spectrum = ContourSpectrum::FromFlatArray(
+                {.VoxTy = ImportVoxelType,
+                 .Dimension = FIntVector(VolumeTexture->GetSizeX(), VolumeTexture->GetSizeY(),
+                                         VolumeTexture->GetSizeZ()),
+                 .IsoValueRange = {volumeStatistics.Volume.Min, volumeStatistics.Volume.Max},
+                 .VolDat = volDat});
+            spectrum.IsType<FString>())
+            contourSpectrum = {};
+        else
+            contourSpectrum = std::move(spectrum.Get<ContourSpectrum>());
+    } else
+        contourSpectrum = {};
+
+    // Replaced by gradients of the smoothed volume once it is generated
+    generateGradientVolume(volDat, ImportVoxelType);
+
+    if (keepVolumeInCPU)
+        volumeCPUData = MakeShared<TArray<uint8>>(std::move(volDat));
+    else
+        volumeCPUData = MakeShared<TArray<uint8>>();
+
     generateSmoothedVolume();
 
     OnVolumeDataChanged.Broadcast(this);
 }
 
+TArray<float> UVolumeDataComponent::GetInterestingIsoValues(int32 MaxNum) const {
+    return contourSpectrum.FindInterestingIsoValues(MaxNum);
+}
+
 void UVolumeDataComponent::LoadTF() {
     FJsonSerializableArray files;
     FDesktopPlatformModule::Get()->OpenFileDialog(
@@ -121,7 +157,7 @@ void UVolumeDataComponent::LoadTF() {
     auto tf = TransferFunctionData::LoadFromFile({.FilePath = files[0]});
     if (tf.IsType<FString>()) {
         auto &errMsg = tf.Get<FString>();
-        processError(errMsg);
+        ProcessError(errMsg);
 
         return;
     }
@@ -143,7 +179,7 @@ void UVolumeDataComponent::SaveTF() {
 
     auto errMsg = TransferFunctionData::SaveToFile(TransferFunctionCurve, FFilePath(files[0]));
     if (errMsg.IsSet())
-        processError(errMsg.GetValue());
+        ProcessError(errMsg.GetValue());
 }
 
 void UVolumeDataComponent::SyncTFCurveTexture() {
@@ -215,10 +251,29 @@ void UVolumeDataComponent::BeginPlay() {
     }
 }
 
+void UVolumeDataComponent::syncVolumeTexture() {
+    if (!VolumeTexture)
+        return;
+    if (!keepVolumeInGPU) {
+        VolumeTexture->ReleaseResource();
+        return;
+    }
+    if (VolumeTexture->GetResource() || volumeCPUData->IsEmpty())
+        return;
+
+    auto platformData = *VolumeTexture->GetRunningPlatformData();
+    auto *texDat = platformData->Mips[0].BulkData.Lock(EBulkDataLockFlags::LOCK_READ_WRITE);
+    FMemory::Memcpy(texDat, volumeCPUData->GetData(), volumeCPUData->Num());
+    platformData->Mips[0].BulkData.Unlock();
+
+    VolumeTexture->UpdateResource();
+}
+
 void UVolumeDataComponent::generateSmoothedVolume() {
     if (!VolumeTexture)
         return;
-    if (!keepSmoothedVolume) {
+    // Without the volume in the GPU, the CPU backend smooths the voxels kept in the CPU
+    if (!keepSmoothedVolume || (!keepVolumeInGPU && volumeCPUData->IsEmpty())) {
         VolumeTextureSmoothed = nullptr;
         return;
     }
@@ -229,10 +284,15 @@ void UVolumeDataComponent::generateSmoothedVolume() {
     VolumeTexturet->PlatformData->SetNumSlices(VolumeTexture->GetSizeZ()) ;
     VolumeTexturet->PlatformData->PixelFormat = EPixelFormat::PF_R32_FLOAT;
 
+    TSharedPtr<const TArray<uint8>> volDat;
+    if (!volumeCPUData->IsEmpty())
+        volDat = volumeCPUData;
+
     FVolumeSmoother::Exec(
         {.SmoothType = VolumeSmoothType,
          .SmoothDimension = VolumeSmoothDimension,
          .VolumeTexture = VolumeTexture,
+         .VolumeCPUData = volDat,
          .FinishedCallback = [this, VolumeTexturet](TSharedPtr<TArray<float>> VolDat) {
             VolumeTextureSmoothed = VolumeTexturet;
              VolumeTextureSmoothed->Filter = TextureFilter::TF_Trilinear;
@@ -242,19 +302,76 @@ void UVolumeDataComponent::generateSmoothedVolume() {
 
              //VolumeTextureSmoothed->AddressMode = TextureAddress::TA_Clamp;
 
-             auto platformData = *VolumeTextureSmoothed->GetRunningPlatformData();
-             auto texDat = platformData->Mips[0].BulkData.Lock(
-                 EBulkDataLockFlags::LOCK_READ_WRITE);
-             FMemory::Memcpy(texDat, VolDat->GetData(), sizeof(float) * VolDat->Num());
-             platformData->Mips[0].BulkData.Unlock();
+             // Smoothed voxels are uploaded only if the volume is
+             if (keepVolumeInGPU) {
+                 auto platformData = *VolumeTextureSmoothed->GetRunningPlatformData();
+                 auto texDat = platformData->Mips[0].BulkData.Lock(
+                     EBulkDataLockFlags::LOCK_READ_WRITE);
+                 FMemory::Memcpy(texDat, VolDat->GetData(), sizeof(float) * VolDat->Num());
+                 platformData->Mips[0].BulkData.Unlock();
+
+                 VolumeTextureSmoothed->UpdateResource();
+             }
 
-             VolumeTextureSmoothed->UpdateResource();
+             generateGradientVolume(
+                 TConstArrayView<uint8>(reinterpret_cast<const uint8 *>(VolDat->GetData()),
+                                        sizeof(float) * VolDat->Num()),
+                 ESupportedVoxelType::Float32);
 
              if (keepVolumeInCPU)
                  volumeCPUDataSmoothed = std::move(*VolDat);
 
              OnVolumeDataChanged.Broadcast(this);
-         }});
+         },
+         .Radius = VolumeSmoothRadius,
+         .Sigma = VolumeSmoothSigma});
+}
+
+void UVolumeDataComponent::generateGradientVolume(TConstArrayView<uint8> VolDat,
+                                                  ESupportedVoxelType VoxTy) {
+    if (!keepGradientVolume || !VolumeTexture) {
+        gradientVolume = MakeShared<GradientVolume>();
+        jointHistogram = {};
+        return;
+    }
+
+    FIntVector dim(VolumeTexture->GetSizeX(), VolumeTexture->GetSizeY(),
+                   VolumeTexture->GetSizeZ());
+    auto voxNum = static_cast<int64>(dim.X) * dim.Y * dim.Z;
+    if (VolDat.IsEmpty()) {
+        if (keepSmoothedVolume && volumeCPUDataSmoothed.Num() == voxNum) {
+            VolDat = TConstArrayView<uint8>(
+                reinterpret_cast<const uint8 *>(volumeCPUDataSmoothed.GetData()),
+                sizeof(float) * voxNum);
+            VoxTy = ESupportedVoxelType::Float32;
+        } else if (!volumeCPUData->IsEmpty()) {
+            VolDat = *volumeCPUData;
+            VoxTy = prevVolumeDataDesc.VoxTy;
+        } else {
+            // Recomputed once the volume is loaded again
+            gradientVolume = MakeShared<GradientVolume>();
+            jointHistogram = {};
+            return;
+        }
+    }
+
+    if (auto grad =
+            GradientVolume::FromFlatArray({.VoxTy = VoxTy, .Dimension = dim, .VolDat = VolDat});
+        grad.IsType<FString>()) {
+        ProcessError(grad.Get<FString>());
+        gradientVolume = MakeShared<GradientVolume>();
+        jointHistogram = {};
+        return;
+    } else
+        gradientVolume = MakeShared<GradientVolume>(std::move(grad.Get<GradientVolume>()));
+
+    if (auto hist = JointHistogram::FromFlatArray(
+            {.VoxTy = VoxTy, .Dimension = dim, .VolDat = VolDat, .Gradients = *gradientVolume});
+        hist.IsType<FString>()) {
+        ProcessError(hist.Get<FString>());
+        jointHistogram = {};
+    } else
+        jointHistogram = std::move(hist.Get<JointHistogram>());
 }
 
 void UVolumeDataComponent::createDefaultTFTexture() {
@@ -277,7 +394,7 @@ void UVolumeDataComponent::createDefaultTFTexture() {
     OnTransferFunctionDataChanged.Broadcast(this);
 }
 
-void UVolumeDataComponent::processError(const FString &ErrMsg) {
+void UVolumeDataComponent::ProcessError(const FString &ErrMsg) {
     FNotificationInfo info(FText::FromString(ErrMsg));
 
     auto notifyItem = FSlateNotificationManager::Get().AddNotification(info);
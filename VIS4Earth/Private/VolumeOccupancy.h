@@ -0,0 +1,156 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <algorithm>
+
+#include "Async/ParallelFor.h"
+#include "CoreMinimal.h"
+
+#include "Util.h"
+
+#include "Data.h"
+
+/*
+ * Class: FVolumeOccupancy
+ * Function:
+ * -- Min/max grid over bricks of BrickSize^3 voxels combined with the opacity of a transfer
+ *    function, giving the range of opacities in each brick. Bricks whose opacities are all zero
+ *    are empty.
+ * -- Brick b covers voxels [b * BrickSize, (b + 1) * BrickSize] per axis, one more than its
+ *    size, so that trilinear samples anywhere in the brick only read voxels of the brick.
+ * -- Scalar ranges are kept as ranges of transfer function entries. When the transfer function
+ *    changes, only bricks whose range covers a changed entry are re-evaluated, each by an O(1)
+ *    range min/max query.
+ */
+class VIS4EARTH_API FVolumeOccupancy {
+  public:
+    struct Parameters {
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, BrickSize, 8)
+        FIntVector Dimension = FIntVector::ZeroValue;
+    };
+
+    FVolumeOccupancy() = default;
+    template <SupportedVoxelType T>
+    FVolumeOccupancy(const Parameters &Params, const T *VolDat)
+        : brickSz(std::max(Params.BrickSize, 1)), dim(Params.Dimension) {
+        brickNum = FIntVector(FMath::DivideAndRoundUp(dim.X, brickSz),
+                              FMath::DivideAndRoundUp(dim.Y, brickSz),
+                              FMath::DivideAndRoundUp(dim.Z, brickSz));
+        auto num = static_cast<int64>(brickNum.X) * brickNum.Y * brickNum.Z;
+        entryRanges.SetNumUninitialized(num);
+        alphaRanges.Init(FVector2f(0.f, 1.f), num);
+
+        auto [vxMin, vxMax, vxExt] =
+            VolumeData::GetVoxelMinMaxExtent(VolumeData::GetVoxelType<T>());
+        auto voxPerVolYxX = static_cast<int64>(dim.Y) * dim.X;
+        ParallelFor(brickNum.Z, [&](int32 bz) {
+            FIntVector b;
+            b.Z = bz;
+            for (b.Y = 0; b.Y < brickNum.Y; ++b.Y)
+                for (b.X = 0; b.X < brickNum.X; ++b.X) {
+                    auto start = b * brickSz;
+                    FIntVector end(std::min(start.X + brickSz, dim.X - 1),
+                                   std::min(start.Y + brickSz, dim.Y - 1),
+                                   std::min(start.Z + brickSz, dim.Z - 1));
+
+                    auto vMin = std::numeric_limits<float>::max();
+                    auto vMax = std::numeric_limits<float>::lowest();
+                    for (int32 z = start.Z; z <= end.Z; ++z)
+                        for (int32 y = start.Y; y <= end.Y; ++y) {
+                            auto row = VolDat + z * voxPerVolYxX + static_cast<int64>(y) * dim.X;
+                            for (int32 x = start.X; x <= end.X; ++x) {
+                                auto v = static_cast<float>(row[x]);
+                                vMin = std::min(vMin, v);
+                                vMax = std::max(vMax, v);
+                            }
+                        }
+
+                    // Entries lerped by samples in [vMin, vMax]
+                    constexpr auto maxEntry = TransferFunctionData::Resolution - 1;
+                    auto toEntry = [&](float v) {
+                        return FMath::Clamp((v - vxMin) / vxExt, 0.f, 1.f) * maxEntry;
+                    };
+                    entryRanges[getBrickIndex(b)] =
+                        FIntPoint(std::min(FMath::FloorToInt32(toEntry(vMin)), maxEntry),
+                                  std::min(FMath::CeilToInt32(toEntry(vMax)), maxEntry));
+                }
+        });
+    }
+
+    bool IsValid() const { return !alphaRanges.IsEmpty(); }
+    int32 GetBrickSize() const { return brickSz; }
+    const FIntVector &GetBrickNumber() const { return brickNum; }
+    const FIntVector &GetDimension() const { return dim; }
+
+    // Refreshes opacity ranges with Alphas of TransferFunctionData::Resolution entries.
+    // Returns the number of re-evaluated bricks.
+    int64 UpdateTransferFunction(const TArray<float> &Alphas) {
+        constexpr auto res = TransferFunctionData::Resolution;
+        if (Alphas.Num() != res || !IsValid())
+            return 0;
+
+        // Prefix counts of changed entries, so that a range is queried in O(1)
+        TArray<int32> changedPrefix;
+        changedPrefix.SetNumUninitialized(res + 1);
+        changedPrefix[0] = 0;
+        auto isFirst = alphas.Num() != res;
+        for (int32 i = 0; i < res; ++i)
+            changedPrefix[i + 1] = changedPrefix[i] + (isFirst || alphas[i] != Alphas[i] ? 1 : 0);
+        alphas = Alphas;
+        if (changedPrefix[res] == 0)
+            return 0;
+
+        // Sparse tables of min/max over [i, i + 2^lvl)
+        constexpr auto lvlNum = FMath::ConstExprCeilLogTwo(res) + 1;
+        TArray<FVector2f> sparse[lvlNum];
+        sparse[0].SetNumUninitialized(res);
+        for (int32 i = 0; i < res; ++i)
+            sparse[0][i] = FVector2f(Alphas[i], Alphas[i]);
+        for (int32 lvl = 1; lvl < lvlNum; ++lvl) {
+            auto half = 1 << (lvl - 1);
+            sparse[lvl].SetNumUninitialized(res - (1 << lvl) + 1);
+            for (int32 i = 0; i < sparse[lvl].Num(); ++i) {
+                auto &a = sparse[lvl - 1][i];
+                auto &b = sparse[lvl - 1][i + half];
+                sparse[lvl][i] = FVector2f(std::min(a.X, b.X), std::max(a.Y, b.Y));
+            }
+        }
+
+        int64 updatedNum = 0;
+        for (int64 i = 0; i < entryRanges.Num(); ++i) {
+            auto &rng = entryRanges[i];
+            if (changedPrefix[rng.Y + 1] == changedPrefix[rng.X])
+                continue;
+            auto lvl = FMath::FloorLog2(static_cast<uint32>(rng.Y - rng.X + 1));
+            auto &a = sparse[lvl][rng.X];
+            auto &b = sparse[lvl][rng.Y - (1 << lvl) + 1];
+            alphaRanges[i] = FVector2f(std::min(a.X, b.X), std::max(a.Y, b.Y));
+            ++updatedNum;
+        }
+        return updatedNum;
+    }
+
+    bool IsOccupied(const FIntVector &Brick) const { return GetAlphaRange(Brick).Y > 0.f; }
+    // Returns [min, max] of transfer function entries lerped by scalars in Brick, which bound
+    // the scalars independently of the transfer function
+    const FIntPoint &GetEntryRange(const FIntVector &Brick) const {
+        return entryRanges[getBrickIndex(Brick)];
+    }
+    // Returns [min, max] of opacities of the transfer function over scalars in Brick
+    const FVector2f &GetAlphaRange(const FIntVector &Brick) const {
+        return alphaRanges[getBrickIndex(Brick)];
+    }
+
+  private:
+    int32 brickSz = 1;
+    FIntVector dim = FIntVector::ZeroValue;
+    FIntVector brickNum = FIntVector::ZeroValue;
+    TArray<FIntPoint> entryRanges;
+    TArray<FVector2f> alphaRanges;
+    TArray<float> alphas;
+
+    int64 getBrickIndex(const FIntVector &Brick) const {
+        return (static_cast<int64>(Brick.Z) * brickNum.Y + Brick.Y) * brickNum.X + Brick.X;
+    }
+};
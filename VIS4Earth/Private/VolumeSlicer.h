@@ -0,0 +1,200 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <algorithm>
+
+#include "Async/ParallelFor.h"
+#include "CoreMinimal.h"
+
+#include "Util.h"
+
+#include "Data.h"
+
+/*
+ * Class: FVolumeSlicer
+ * Function:
+ * -- Resamples a volume along a vertical section into a 2D grid of columns x rows.
+ * -- The section stands on a polyline Path in the XY plane of the volume, where [0,1]^2 maps
+ *    to the whole plane the same way as FMCSRenderer::VertexAttr::Position does, i.e.
+ *    voxel (x, y) lies at (x / Dimension.X, y / Dimension.Y).
+ * -- Columns are spread evenly by arc length along Path, rows evenly over HeightRange.
+ * -- Samples trilinearly, parallel per column. The 4 bilinear weights of a column are shared
+ *    by all its rows. The 8 voxels of a sample are loaded one by one, only their vertical
+ *    lerp and the dot with the weights run in SIMD registers.
+ */
+class VIS4EARTH_API FVolumeSlicer {
+  public:
+    struct Parameters {
+        TArray<FVector2f> Path;
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, ColumnNum, 256)
+        // 0 places one row at each voxel height in HeightRange
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, RowNum, 0)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntPoint, HeightRange, {0 VIS4EARTH_COMMA 0})
+        FIntVector Dimension = FIntVector::ZeroValue;
+    };
+
+    struct Section {
+        int32 ColumnNum = 0;
+        int32 RowNum = 0;
+        TArray<FVector2f> ColumnPositions; // in the same space as Path
+        TArray<float> RowHeights;          // in voxels
+        TArray<float> Values;              // value at row r and column c is [r * ColumnNum + c]
+
+        bool IsValid() const { return ColumnNum >= 2 && RowNum >= 2; }
+        // Returns the position of a continuous grid coordinate in the same space as
+        // FMCSRenderer::VertexAttr::Position
+        FVector3f GetPosition(const FVector2f &GridPos, const FIntVector &Dimension) const {
+            auto c = FMath::Clamp(FMath::FloorToInt32(GridPos.X), 0, ColumnNum - 2);
+            auto r = FMath::Clamp(FMath::FloorToInt32(GridPos.Y), 0, RowNum - 2);
+            auto xy = FMath::Lerp(ColumnPositions[c], ColumnPositions[c + 1], GridPos.X - c);
+            auto z = FMath::Lerp(RowHeights[r], RowHeights[r + 1], GridPos.Y - r);
+            return FVector3f(xy.X, xy.Y, z / Dimension.Z);
+        }
+    };
+
+    template <SupportedVoxelType T>
+    static Section Exec(const Parameters &Params, const T *VolDat) {
+        Section ret;
+        auto &dim = Params.Dimension;
+        if (Params.Path.Num() < 2 || Params.ColumnNum < 2 || dim.X < 2 || dim.Y < 2 ||
+            dim.Z < 1)
+            return ret;
+
+        ret.ColumnNum = Params.ColumnNum;
+        ret.ColumnPositions = resamplePath(Params.Path, Params.ColumnNum, dim);
+
+        auto hMin = FMath::Clamp(Params.HeightRange[0], 0, dim.Z - 1);
+        auto hMax = FMath::Clamp(Params.HeightRange[1], hMin, dim.Z - 1);
+        ret.RowNum = Params.RowNum > 0 ? Params.RowNum : hMax - hMin + 1;
+        if (ret.RowNum < 2)
+            return ret;
+        ret.RowHeights.SetNumUninitialized(ret.RowNum);
+        for (int32 r = 0; r < ret.RowNum; ++r)
+            ret.RowHeights[r] = hMin + static_cast<float>(hMax - hMin) * r / (ret.RowNum - 1);
+
+        auto voxPerVolYxX = static_cast<int64>(dim.Y) * dim.X;
+        TArray<int64> rowOffs0, rowOffs1;
+        TArray<float> rowFracs;
+        rowOffs0.SetNumUninitialized(ret.RowNum);
+        rowOffs1.SetNumUninitialized(ret.RowNum);
+        rowFracs.SetNumUninitialized(ret.RowNum);
+        for (int32 r = 0; r < ret.RowNum; ++r) {
+            auto z0 = std::min(FMath::FloorToInt32(ret.RowHeights[r]), dim.Z - 1);
+            rowOffs0[r] = z0 * voxPerVolYxX;
+            rowOffs1[r] = std::min(z0 + 1, dim.Z - 1) * voxPerVolYxX;
+            rowFracs[r] = ret.RowHeights[r] - z0;
+        }
+
+        ret.Values.SetNumUninitialized(static_cast<int64>(ret.RowNum) * ret.ColumnNum);
+        ParallelFor(ret.ColumnNum, [&](int32 c) {
+            auto vx = FMath::Clamp(ret.ColumnPositions[c].X * dim.X, 0.f, dim.X - 1.f);
+            auto vy = FMath::Clamp(ret.ColumnPositions[c].Y * dim.Y, 0.f, dim.Y - 1.f);
+            auto x0 = std::min(FMath::FloorToInt32(vx), dim.X - 2);
+            auto y0 = std::min(FMath::FloorToInt32(vy), dim.Y - 2);
+            auto fx = vx - x0;
+            auto fy = vy - y0;
+
+            auto off = static_cast<int64>(y0) * dim.X + x0;
+            int64 offs[4] = {off, off + 1, off + dim.X, off + dim.X + 1};
+            auto weights = MakeVectorRegisterFloat((1.f - fx) * (1.f - fy), fx * (1.f - fy),
+                                                   (1.f - fx) * fy, fx * fy);
+
+            for (int32 r = 0; r < ret.RowNum; ++r) {
+                auto src0 = VolDat + rowOffs0[r];
+                auto src1 = VolDat + rowOffs1[r];
+                auto v0 = MakeVectorRegisterFloat(
+                    static_cast<float>(src0[offs[0]]), static_cast<float>(src0[offs[1]]),
+                    static_cast<float>(src0[offs[2]]), static_cast<float>(src0[offs[3]]));
+                auto v1 = MakeVectorRegisterFloat(
+                    static_cast<float>(src1[offs[0]]), static_cast<float>(src1[offs[1]]),
+                    static_cast<float>(src1[offs[2]]), static_cast<float>(src1[offs[3]]));
+                auto v = VectorMultiplyAdd(VectorSubtract(v1, v0), VectorSetFloat1(rowFracs[r]),
+                                           v0);
+                ret.Values[static_cast<int64>(r) * ret.ColumnNum + c] =
+                    VectorGetComponent(VectorDot4(v, weights), 0);
+            }
+        });
+
+        return ret;
+    }
+
+    // Path along a meridian crossing the whole latitude range
+    static TArray<FVector2f> MakeLongitudePath(double Lon, const FVector2d &LonRange) {
+        Lon = unwrapLongitude(Lon, .5 * (LonRange[0] + LonRange[1]));
+        auto x = static_cast<float>((Lon - LonRange[0]) / (LonRange[1] - LonRange[0]));
+        return {FVector2f(x, 0.f), FVector2f(x, 1.f)};
+    }
+    // Path along a parallel crossing the whole longitude range
+    static TArray<FVector2f> MakeLatitudePath(double Lat, const FVector2d &LatRange) {
+        auto y = static_cast<float>((Lat - LatRange[0]) / (LatRange[1] - LatRange[0]));
+        return {FVector2f(0.f, y), FVector2f(1.f, y)};
+    }
+    // Path along the shorter great-circle arc between 2 points in degrees of (lon, lat).
+    // Longitudes are unwrapped along the arc, so that it stays continuous across the
+    // antimeridian and lands in a LonRange beyond [-180, 180].
+    static TArray<FVector2f> MakeGreatCirclePath(const FVector2d &StartLonLat,
+                                                 const FVector2d &EndLonLat, int32 PointNum,
+                                                 const FVector2d &LonRange,
+                                                 const FVector2d &LatRange) {
+        auto toUnit = [](const FVector2d &lonLat) {
+            auto lon = FMath::DegreesToRadians(lonLat.X);
+            auto lat = FMath::DegreesToRadians(lonLat.Y);
+            return FVector(FMath::Cos(lat) * FMath::Cos(lon), FMath::Cos(lat) * FMath::Sin(lon),
+                           FMath::Sin(lat));
+        };
+        auto p0 = toUnit(StartLonLat);
+        auto p1 = toUnit(EndLonLat);
+        auto omega = FMath::Acos(FMath::Clamp(p0.Dot(p1), -1., 1.));
+        auto sinOmega = FMath::Sin(omega);
+
+        TArray<FVector2f> ret;
+        PointNum = std::max(PointNum, 2);
+        ret.Reserve(PointNum);
+        auto prevLon = .5 * (LonRange[0] + LonRange[1]);
+        for (int32 i = 0; i < PointNum; ++i) {
+            auto t = static_cast<double>(i) / (PointNum - 1);
+            auto p = sinOmega < UE_DOUBLE_KINDA_SMALL_NUMBER
+                         ? FMath::Lerp(p0, p1, t)
+                         : (FMath::Sin((1. - t) * omega) * p0 + FMath::Sin(t * omega) * p1) /
+                               sinOmega;
+            auto lon = unwrapLongitude(FMath::RadiansToDegrees(FMath::Atan2(p.Y, p.X)), prevLon);
+            prevLon = lon;
+            auto lat = FMath::RadiansToDegrees(FMath::Asin(FMath::Clamp(p.Z, -1., 1.)));
+            ret.Emplace(static_cast<float>((lon - LonRange[0]) / (LonRange[1] - LonRange[0])),
+                        static_cast<float>((lat - LatRange[0]) / (LatRange[1] - LatRange[0])));
+        }
+        return ret;
+    }
+
+  private:
+    // Returns Lon shifted by whole turns to lie within 180 degrees of Ref
+    static double unwrapLongitude(double Lon, double Ref) {
+        return Lon + 360. * FMath::RoundToDouble((Ref - Lon) / 360.);
+    }
+
+    // Places Num points evenly by arc length in voxels along Path
+    static TArray<FVector2f> resamplePath(const TArray<FVector2f> &Path, int32 Num,
+                                          const FIntVector &Dimension) {
+        FVector2f scale(Dimension.X, Dimension.Y);
+        TArray<float> arcLens;
+        arcLens.SetNumUninitialized(Path.Num());
+        arcLens[0] = 0.f;
+        for (int32 i = 1; i < Path.Num(); ++i)
+            arcLens[i] =
+                arcLens[i - 1] + FVector2f::Distance(Path[i - 1] * scale, Path[i] * scale);
+
+        TArray<FVector2f> ret;
+        ret.SetNumUninitialized(Num);
+        int32 seg = 0;
+        for (int32 i = 0; i < Num; ++i) {
+            auto arcLen = arcLens.Last() * i / (Num - 1);
+            while (seg < Path.Num() - 2 && arcLens[seg + 1] < arcLen)
+                ++seg;
+            auto segLen = arcLens[seg + 1] - arcLens[seg];
+            auto t = segLen <= 0.f ? 0.f : FMath::Clamp((arcLen - arcLens[seg]) / segLen, 0.f, 1.f);
+            ret[i] = FMath::Lerp(Path[seg], Path[seg + 1], t);
+        }
+        return ret;
+    }
+};
@@ -2,8 +2,10 @@
 
 #pragma once
 
+#include "Async/Async.h"
 #include "CoreMinimal.h"
 #include "Engine/VolumeTexture.h"
+#include "Misc/CoreDelegates.h"
 #include "RHIGPUReadback.h"
 #include "RenderGraphBuilder.h"
 #include "RenderGraphUtils.h"
@@ -12,6 +14,7 @@
 #include "Util.h"
 
 #include "Data.h"
+#include "VolumeSmootherCPU.h"
 
 class VIS4EARTH_API FVolumeSmoothShader : public FGlobalShader {
   public:
@@ -42,13 +45,37 @@ IMPLEMENT_GLOBAL_SHADER(FVolumeSmoothShader, "/VIS4Earth/VolumeSmoother.usf", "S
 
 class VIS4EARTH_API FVolumeSmoother {
   public:
+    enum class EBackend : uint8 { Auto = 0, GPU, CPU };
+
     struct Parameters {
         EVolumeSmoothType SmoothType;
         EVolumeSmoothDimension SmoothDimension;
         TObjectPtr<UVolumeTexture> VolumeTexture;
+        // Voxels of VolumeTexture, read by the CPU backend instead of its bulk data if set.
+        // The CPU backend is selected if VolumeTexture is not uploaded to the GPU.
+        TSharedPtr<const TArray<uint8>> VolumeCPUData;
         TFunction<void(TSharedPtr<TArray<float>> VolDat)> FinishedCallback;
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector, Radius,
+                                         {1 VIS4EARTH_COMMA 1 VIS4EARTH_COMMA 1})
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FVector3f, Sigma,
+                                         {1.f VIS4EARTH_COMMA 1.f VIS4EARTH_COMMA 1.f})
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(EBackend, Backend, EBackend::Auto)
+        // Auto backend smooths volumes with no more voxels than this on the CPU,
+        // where a GPU round trip costs more than the smoothing itself
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int64, MaxCPUVoxelNum, 64 * 64 * 64)
     };
     static void Exec(const Parameters &Params) {
+        if (!Params.VolumeTexture)
+            return;
+
+        if (selectBackend(Params) == EBackend::CPU) {
+            if (IsInGameThread())
+                execCPU(Params);
+            else
+                AsyncTask(ENamedThreads::GameThread, [Params]() { execCPU(Params); });
+            return;
+        }
+
         if (IsInRenderingThread()) {
             exec(GetImmediateCommandList_ForRenderCommand(), Params);
             return;
@@ -59,6 +86,103 @@ class VIS4EARTH_API FVolumeSmoother {
     }
 
   private:
+    struct PendingReadback {
+        TUniquePtr<FRHIGPUBufferReadback> Readback;
+        FIntVector VolDim;
+        TFunction<void(TSharedPtr<TArray<float>> VolDat)> FinishedCallback;
+    };
+    // Only accessed on the rendering thread
+    static inline TArray<TSharedRef<PendingReadback>> pendingReadbacks;
+    static inline FDelegateHandle onEndFrameRT;
+
+    static EBackend selectBackend(const Parameters &Params) {
+        // Smoothing shader only implements the 3x3x3 Avg and Max kernels
+        auto isGPUSupported = (Params.SmoothType == EVolumeSmoothType::Avg ||
+                               Params.SmoothType == EVolumeSmoothType::Max) &&
+                              Params.Radius == FIntVector(1, 1, 1);
+        auto isInGPU = Params.VolumeTexture->GetResource() != nullptr;
+        if (GUsingNullRHI || !isGPUSupported || (!isInGPU && Params.VolumeCPUData.IsValid()))
+            return EBackend::CPU;
+        if (Params.Backend != EBackend::Auto)
+            return Params.Backend;
+
+        auto voxNum = static_cast<int64>(Params.VolumeTexture->GetSizeX()) *
+                      Params.VolumeTexture->GetSizeY() * Params.VolumeTexture->GetSizeZ();
+        return voxNum <= Params.MaxCPUVoxelNum ? EBackend::CPU : EBackend::GPU;
+    }
+
+    static void execCPU(const Parameters &Params) {
+        auto platformData = *Params.VolumeTexture->GetRunningPlatformData();
+        if (!platformData)
+            return;
+
+        FIntVector volDim(Params.VolumeTexture->GetSizeX(), Params.VolumeTexture->GetSizeY(),
+                          Params.VolumeTexture->GetSizeZ());
+        auto voxTy = VolumeData::GetVoxelType(platformData->PixelFormat);
+        auto volSz = VolumeData::GetVoxelSize(voxTy) * volDim.X * volDim.Y * volDim.Z;
+
+        // Bulk data can only be touched on the game thread, copy it out before going wide.
+        // Snapshots are never modified in place and are read directly.
+        auto volDat = Params.VolumeCPUData;
+        if (!volDat.IsValid()) {
+            if (platformData->Mips.IsEmpty())
+                return;
+            auto &bulkData = platformData->Mips[0].BulkData;
+            if (bulkData.GetBulkDataSize() != volSz)
+                return;
+
+            auto copied = MakeShared<TArray<uint8>>();
+            copied->SetNumUninitialized(volSz);
+            FMemory::Memcpy(copied->GetData(), bulkData.Lock(EBulkDataLockFlags::LOCK_READ_ONLY),
+                            volSz);
+            bulkData.Unlock();
+            volDat = copied;
+        }
+        if (volSz == 0 || static_cast<size_t>(volDat->Num()) != volSz)
+            return;
+
+        AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [Params, volDim, voxTy,
+                                                                 volDat]() {
+            auto smooth = [&]<SupportedVoxelType T>(const T *dat) {
+                auto [vxMin, vxMax, vxExt] = VolumeData::GetVoxelMinMaxExtent(voxTy);
+                auto smoothed = MakeShared<TArray<float>>(
+                    FVolumeSmootherCPU::Exec({.SmoothType = Params.SmoothType,
+                                              .SmoothDimension = Params.SmoothDimension,
+                                              .Radius = Params.Radius,
+                                              .Sigma = Params.Sigma,
+                                              .Dimension = volDim},
+                                             dat));
+
+                // Same [vxMin, vxMax] -> [0, 1] mapping as the GPU output
+                ParallelFor(volDim.Z, [&](int32 z) {
+                    auto voxPerVolYxX = static_cast<int64>(volDim.Y) * volDim.X;
+                    for (int64 i = z * voxPerVolYxX; i < (z + 1) * voxPerVolYxX; ++i)
+                        (*smoothed)[i] = ((*smoothed)[i] - vxMin) / vxExt;
+                });
+
+                return smoothed;
+            };
+
+            TSharedPtr<TArray<float>> smoothed;
+            switch (voxTy) {
+            case ESupportedVoxelType::UInt8:
+                smoothed = smooth(reinterpret_cast<const uint8 *>(volDat->GetData()));
+                break;
+            case ESupportedVoxelType::UInt16:
+                smoothed = smooth(reinterpret_cast<const uint16 *>(volDat->GetData()));
+                break;
+            case ESupportedVoxelType::Float32:
+                smoothed = smooth(reinterpret_cast<const float *>(volDat->GetData()));
+                break;
+            default:
+                return;
+            }
+
+            AsyncTask(ENamedThreads::GameThread,
+                      [smoothed, callback = Params.FinishedCallback]() { callback(smoothed); });
+        });
+    }
+
     static void exec(FRHICommandListImmediate &RHICmdList, const Parameters &Params) {
         if (!Params.VolumeTexture)
             return;
@@ -109,32 +233,47 @@ class VIS4EARTH_API FVolumeSmoother {
                 FMath::DivideAndRoundUp(shaderParams->VolDim.Y, VIS4EARTH_THREAD_PER_GROUP_Y),
                 FMath::DivideAndRoundUp(shaderParams->VolDim.Z, VIS4EARTH_THREAD_PER_GROUP_Z)));
 
-        auto bufReadback = new FRHIGPUBufferReadback(ReadbackSmoothedVolumeTChar);
-        AddEnqueueCopyPass(grphBldr, bufReadback, smoothedVolBuf,
+        auto pending = MakeShared<PendingReadback>();
+        pending->Readback = MakeUnique<FRHIGPUBufferReadback>(ReadbackSmoothedVolumeTChar);
+        pending->VolDim = volDim;
+        pending->FinishedCallback = Params.FinishedCallback;
+        AddEnqueueCopyPass(grphBldr, pending->Readback.Get(), smoothedVolBuf,
                            smoothedVolBuf->Desc.GetTotalNumBytes());
 
-        auto waitTask = [bufReadback, volDim,
-                         callback = Params.FinishedCallback](auto &&waitTask) -> void {
-            if (!bufReadback->IsReady()) {
-                AsyncTask(ENamedThreads::ActualRenderingThread,
-                          [waitTask]() { waitTask(waitTask); });
-                return;
-            }
+        grphBldr.Execute();
+
+        // Fences of pending readbacks are checked at the end of each rendered frame. The hook is
+        // only registered while readbacks are pending, so idle frames pay nothing.
+        pendingReadbacks.Emplace(pending);
+        if (!onEndFrameRT.IsValid())
+            onEndFrameRT = FCoreDelegates::OnEndFrameRT.AddStatic(&FVolumeSmoother::onReadbacks);
+    }
 
-            auto bufNum = volDim.X * volDim.Y * volDim.Z;
+    static void onReadbacks() {
+        for (int32 i = pendingReadbacks.Num() - 1; i >= 0; --i) {
+            auto pending = pendingReadbacks[i];
+            if (!pending->Readback->IsReady())
+                continue;
+
+            auto bufNum = pending->VolDim.X * pending->VolDim.Y * pending->VolDim.Z;
             auto bufSz = sizeof(float) * bufNum;
 
             auto volDat = MakeShared<TArray<float>>();
             volDat->SetNum(bufNum);
-            FMemory::Memcpy(volDat->GetData(), bufReadback->Lock(bufSz), bufSz);
-
-            AsyncTask(ENamedThreads::GameThread, [volDat, callback]() { callback(volDat); });
+            FMemory::Memcpy(volDat->GetData(), pending->Readback->Lock(bufSz), bufSz);
+            pending->Readback->Unlock();
+            pending->Readback.Reset();
 
-            bufReadback->Unlock();
-            delete bufReadback;
-        };
-        AsyncTask(ENamedThreads::ActualRenderingThread, [waitTask]() { waitTask(waitTask); });
+            AsyncTask(ENamedThreads::GameThread,
+                      [volDat, callback = std::move(pending->FinishedCallback)]() {
+                          callback(volDat);
+                      });
+            pendingReadbacks.RemoveAtSwap(i);
+        }
 
-        grphBldr.Execute();
+        if (pendingReadbacks.IsEmpty()) {
+            FCoreDelegates::OnEndFrameRT.Remove(onEndFrameRT);
+            onEndFrameRT.Reset();
+        }
     }
 };
@@ -0,0 +1,241 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+
+#include "Async/ParallelFor.h"
+#include "CoreMinimal.h"
+
+#include "Util.h"
+
+#include "Data.h"
+
+/*
+ * Class: FVolumeSmootherCPU
+ * Function:
+ * -- Separable volume smoothing on the CPU with independent radius per axis.
+ * -- Avg uses a running-sum box filter, Max uses the van Herk/Gil-Werman algorithm,
+ *    so the cost per voxel of each axis pass does not depend on Radius.
+ * -- Gaussian derives the radius of each axis from Sigma as ceil(3 * Sigma).
+ * -- Median applies 1D medians axis by axis, i.e. the separable median approximation.
+ * -- Windows are clipped by the volume boundary. For Avg, Max and Gaussian this equals
+ *    evaluating the full 3D (or 2D for XY) neighbourhood restricted to valid voxels.
+ * -- Max equals the 3x3x3 smoothing shader exactly. Avg sums in another order than the float
+ *    sum of the shader, and stays within GPUParityTolerance times the voxel extent of it.
+ */
+class VIS4EARTH_API FVolumeSmootherCPU {
+  public:
+    struct Parameters {
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(EVolumeSmoothType, SmoothType, EVolumeSmoothType::Avg)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(EVolumeSmoothDimension, SmoothDimension,
+                                         EVolumeSmoothDimension::XYZ)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector, Radius,
+                                         {1 VIS4EARTH_COMMA 1 VIS4EARTH_COMMA 1})
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FVector3f, Sigma,
+                                         {1.f VIS4EARTH_COMMA 1.f VIS4EARTH_COMMA 1.f})
+        FIntVector Dimension = FIntVector::ZeroValue;
+    };
+
+    // Rounding error bound of a float sum of 27 voxels, 26 * 2^-24, plus that of the divisions
+    static constexpr float GPUParityTolerance = 2e-6f;
+
+    // Returns the smoothed volume in the value domain of T, i.e. without normalization.
+    template <SupportedVoxelType T>
+    static TArray<float> Exec(const Parameters &Params, const T *VolDat) {
+        auto &dim = Params.Dimension;
+        auto voxPerVolYxX = static_cast<int64>(dim.Y) * dim.X;
+        auto voxNum = voxPerVolYxX * dim.Z;
+
+        TArray<float> dst;
+        dst.SetNumUninitialized(voxNum);
+        ParallelFor(dim.Z, [&](int32 z) {
+            auto offs = z * voxPerVolYxX;
+            for (int64 i = 0; i < voxPerVolYxX; ++i)
+                dst[offs + i] = static_cast<float>(VolDat[offs + i]);
+        });
+        if (voxNum == 0)
+            return dst;
+
+        TArray<float> src;
+        src.SetNumUninitialized(voxNum);
+
+        auto pass = [&](int32 axis) {
+            auto r = GetAxisRadius(Params, axis);
+            if (r <= 0)
+                return;
+
+            TArray<float> weights;
+            if (Params.SmoothType == EVolumeSmoothType::Gaussian) {
+                weights.SetNumUninitialized(2 * r + 1);
+                auto invTwoSigmaSqr = 1.f / (2.f * Params.Sigma[axis] * Params.Sigma[axis]);
+                for (int32 k = -r; k <= r; ++k)
+                    weights[k + r] = FMath::Exp(-k * k * invTwoSigmaSqr);
+            }
+
+            Swap(src, dst);
+            auto n = dim[axis];
+
+            switch (axis) {
+            case 0:
+                // Lines are contiguous, one lane per line
+                ParallelFor(dim.Z, [&](int32 z) {
+                    LineScratch scratch;
+                    for (int32 y = 0; y < dim.Y; ++y) {
+                        auto offs = z * voxPerVolYxX + y * dim.X;
+                        filterLines(Params.SmoothType, r, weights.GetData(), src.GetData() + offs,
+                                    dst.GetData() + offs, n, 1, 1, scratch);
+                    }
+                });
+                break;
+            case 1:
+                // All X lanes of a Z slab advance along Y together to stay row-contiguous
+                ParallelFor(dim.Z, [&](int32 z) {
+                    LineScratch scratch;
+                    auto offs = z * voxPerVolYxX;
+                    filterLines(Params.SmoothType, r, weights.GetData(), src.GetData() + offs,
+                                dst.GetData() + offs, n, dim.X, dim.X, scratch);
+                });
+                break;
+            case 2:
+                // All X lanes of a Y row advance along Z together
+                ParallelFor(dim.Y, [&](int32 y) {
+                    LineScratch scratch;
+                    auto offs = static_cast<int64>(y) * dim.X;
+                    filterLines(Params.SmoothType, r, weights.GetData(), src.GetData() + offs,
+                                dst.GetData() + offs, n, voxPerVolYxX, dim.X, scratch);
+                });
+                break;
+            }
+        };
+        pass(0);
+        pass(1);
+        pass(2);
+
+        return dst;
+    }
+
+    static int32 GetAxisRadius(const Parameters &Params, int32 Axis) {
+        if (Axis == 2 && Params.SmoothDimension == EVolumeSmoothDimension::XY)
+            return 0;
+        if (Params.SmoothType == EVolumeSmoothType::Gaussian)
+            return Params.Sigma[Axis] <= 0.f ? 0 : FMath::CeilToInt32(3.f * Params.Sigma[Axis]);
+        return std::max(Params.Radius[Axis], 0);
+    }
+
+  private:
+    struct LineScratch {
+        TArray<double> Acc;
+        TArray<float> Blocks;
+    };
+
+    // Filters Lanes interleaved lines of length N, where element i of lane l is at
+    // Src[i * Stride + l].
+    static void filterLines(EVolumeSmoothType SmoothType, int32 Radius, const float *Weights,
+                            const float *Src, float *Dst, int32 N, int64 Stride, int32 Lanes,
+                            LineScratch &Scratch) {
+        auto r = Radius;
+
+        switch (SmoothType) {
+        case EVolumeSmoothType::Avg: {
+            // Accumulate in double to avoid drift of the running sum
+            Scratch.Acc.SetNumUninitialized(Lanes);
+            auto acc = Scratch.Acc.GetData();
+            for (int32 l = 0; l < Lanes; ++l)
+                acc[l] = 0.;
+            for (int32 j = 0; j <= std::min(r, N - 1); ++j)
+                for (int32 l = 0; l < Lanes; ++l)
+                    acc[l] += Src[j * Stride + l];
+
+            for (int32 i = 0; i < N; ++i) {
+                auto lo = i - r;
+                auto hi = i + r;
+                auto invCnt = 1. / (std::min(N - 1, hi) - std::max(0, lo) + 1);
+                for (int32 l = 0; l < Lanes; ++l)
+                    Dst[i * Stride + l] = static_cast<float>(acc[l] * invCnt);
+
+                if (hi + 1 < N)
+                    for (int32 l = 0; l < Lanes; ++l)
+                        acc[l] += Src[(hi + 1) * Stride + l];
+                if (lo >= 0)
+                    for (int32 l = 0; l < Lanes; ++l)
+                        acc[l] -= Src[lo * Stride + l];
+            }
+        } break;
+        case EVolumeSmoothType::Max: {
+            // Window [i-r, i+r] maps to [p, p+w-1] in the padded line, where p = i.
+            // Padded line is split into blocks of w, g holds prefix maxima and h holds suffix
+            // maxima inside each block, so max of any window is max(h[p], g[p+w-1]).
+            auto w = 2 * r + 1;
+            auto padN = (N + 2 * r + w - 1) / w * w;
+            Scratch.Blocks.SetNumUninitialized(static_cast<int64>(padN) * Lanes * 2);
+            auto g = Scratch.Blocks.GetData();
+            auto h = g + static_cast<int64>(padN) * Lanes;
+
+            constexpr auto lowest = std::numeric_limits<float>::lowest();
+            auto padded = [&](int32 p, int32 l) {
+                auto i = p - r;
+                return i < 0 || i >= N ? lowest : Src[i * Stride + l];
+            };
+
+            for (int32 p = 0; p < padN; ++p)
+                for (int32 l = 0; l < Lanes; ++l)
+                    g[p * Lanes + l] = p % w == 0 ? padded(p, l)
+                                                  : std::max(g[(p - 1) * Lanes + l], padded(p, l));
+            for (int32 p = padN - 1; p >= 0; --p)
+                for (int32 l = 0; l < Lanes; ++l)
+                    h[p * Lanes + l] = p % w == w - 1
+                                           ? padded(p, l)
+                                           : std::max(h[(p + 1) * Lanes + l], padded(p, l));
+
+            for (int32 i = 0; i < N; ++i)
+                for (int32 l = 0; l < Lanes; ++l)
+                    Dst[i * Stride + l] =
+                        std::max(h[i * Lanes + l], g[(i + w - 1) * Lanes + l]);
+        } break;
+        case EVolumeSmoothType::Gaussian: {
+            // Weights are renormalized over the clipped window
+            Scratch.Acc.SetNumUninitialized(Lanes);
+            auto acc = Scratch.Acc.GetData();
+            for (int32 i = 0; i < N; ++i) {
+                auto lo = std::max(0, i - r);
+                auto hi = std::min(N - 1, i + r);
+
+                for (int32 l = 0; l < Lanes; ++l)
+                    acc[l] = 0.;
+                double wSum = 0.;
+                for (int32 j = lo; j <= hi; ++j) {
+                    auto wj = Weights[j - i + r];
+                    wSum += wj;
+                    for (int32 l = 0; l < Lanes; ++l)
+                        acc[l] += wj * Src[j * Stride + l];
+                }
+
+                auto invWSum = 1. / wSum;
+                for (int32 l = 0; l < Lanes; ++l)
+                    Dst[i * Stride + l] = static_cast<float>(acc[l] * invWSum);
+            }
+        } break;
+        case EVolumeSmoothType::Median: {
+            // Windows of all lanes are gathered row by row, then each lane selects its median
+            auto w = 2 * r + 1;
+            Scratch.Blocks.SetNumUninitialized(static_cast<int64>(w) * Lanes);
+            auto win = Scratch.Blocks.GetData();
+            for (int32 i = 0; i < N; ++i) {
+                auto lo = std::max(0, i - r);
+                auto cnt = std::min(N - 1, i + r) - lo + 1;
+                for (int32 k = 0; k < cnt; ++k)
+                    for (int32 l = 0; l < Lanes; ++l)
+                        win[l * w + k] = Src[(lo + k) * Stride + l];
+
+                for (int32 l = 0; l < Lanes; ++l) {
+                    auto lnWin = win + l * w;
+                    std::nth_element(lnWin, lnWin + cnt / 2, lnWin + cnt);
+                    Dst[i * Stride + l] = lnWin[cnt / 2];
+                }
+            }
+        } break;
+        }
+    }
+};
@@ -13,10 +13,28 @@
 
 #include "DVRActor.generated.h"
 
+// Editable counterpart of TransferFunction2DData::Widget
+USTRUCT()
+struct FDVRTransferFunction2DWidget {
+    GENERATED_BODY()
+
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    ETransferFunction2DWidgetType Type = ETransferFunction2DWidgetType::Box;
+    // In [0, 1] along scalar and gradient magnitude
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    FVector2f Center = FVector2f(.5f, .5f);
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    FVector2f Extent = FVector2f(.1f, .1f);
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    FLinearColor Color = FLinearColor::White;
+};
+
 /*
  * Class: ADVRActor
  * Function:
  * -- Implements Time-Variable Direct Volume Rendering.
+ * -- Variables of ExtraVolumeComponents co-registered with VolumeComponent are blended into
+ *    its samples in the same ray-march, each by its own transfer function, on the CPU path.
  */
 UCLASS()
 class VIS4EARTH_API ADVRActor : public AActor {
@@ -33,12 +51,86 @@ class VIS4EARTH_API ADVRActor : public AActor {
     float Step = FDVRRenderer::RenderParameters::DefStep;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     float RelativeLightness = FDVRRenderer::RenderParameters::DefRelativeLightness;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    float EarlyTerminationAlpha = FDVRRenderer::RenderParameters::DefEarlyTerminationAlpha;
+    // Lights samples with precomputed gradients, on the CPU path
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Shading")
+    bool UseShading = FDVRRenderer::RenderParameters::DefUseShading;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Shading")
+    float ShadingAmbient = FDVRRenderer::RenderParameters::DefShadingAmbient;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Shading")
+    float ShadingDiffuse = FDVRRenderer::RenderParameters::DefShadingDiffuse;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Shading")
+    float ShadingSpecular = FDVRRenderer::RenderParameters::DefShadingSpecular;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Shading")
+    float ShadingShininess = FDVRRenderer::RenderParameters::DefShadingShininess;
+    // Classifies samples by scalar and gradient magnitude, on the CPU path
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|TF2D")
+    bool Use2DTF = FDVRRenderer::RenderParameters::DefUse2DTF;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|TF2D")
+    TArray<FDVRTransferFunction2DWidget> TransferFunction2DWidgets;
+    UPROPERTY(VisibleAnywhere, Transient, Category = "VIS4Earth|TF2D")
+    TObjectPtr<UTexture2D> TransferFunction2DTexture;
+    // Voxel counts over scalar (X) x gradient magnitude (Y) to place widgets by
+    UPROPERTY(VisibleAnywhere, Transient, Category = "VIS4Earth|TF2D")
+    TObjectPtr<UTexture2D> JointHistogramTexture;
+    UFUNCTION(CallInEditor, Category = "VIS4Earth|TF2D")
+    void LoadTF2D();
+    UFUNCTION(CallInEditor, Category = "VIS4Earth|TF2D")
+    void SaveTF2D();
+    // Renders the first crossing of IsoValue along rays instead of compositing, on the CPU path
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Isosurface")
+    bool UseIsosurface = FDVRRenderer::RenderParameters::DefUseIsosurface;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Isosurface")
+    float IsoValue = FDVRRenderer::RenderParameters::DefIsoValue;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Isosurface")
+    int32 IsoBisectionNum = FDVRRenderer::RenderParameters::DefIsoBisectionNum;
+    // Ray-casts on the CPU, e.g. where the shader path is unavailable
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|CPU")
+    bool UseCPU = FDVRRenderer::RenderParameters::DefUseCPU;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|CPU")
+    int32 CPUDownsample = FDVRRenderer::RenderParameters::DefCPUDownsample;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|CPU")
+    int32 OccupancyBrickSize = FDVRRenderer::RenderParameters::DefOccupancyBrickSize;
+    // 1 disables adaptive stepping
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|CPU")
+    int32 MaxStepScale = FDVRRenderer::RenderParameters::DefMaxStepScale;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|CPU")
+    float AdaptiveStepTolerance = FDVRRenderer::RenderParameters::DefAdaptiveStepTolerance;
+    // Renders coarsely while the camera moves and refines over frames once it stops
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Progressive")
+    bool UseProgressive = FDVRRenderer::RenderParameters::DefUseProgressive;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Progressive")
+    int32 MotionDownsample = FDVRRenderer::RenderParameters::DefMotionDownsample;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Progressive")
+    float MotionStepScale = FDVRRenderer::RenderParameters::DefMotionStepScale;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Progressive")
+    int32 RefinementFrameNum = FDVRRenderer::RenderParameters::DefRefinementFrameNum;
+    // Streams bricks of the volume into a fixed-size atlas instead of one volume texture, which
+    // is then not uploaded. The CPU copy of the volume stays whole as the source of bricks, so
+    // that only the GPU memory is bounded by the pool. The CPU path marches resident bricks only.
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|BrickPool")
+    bool UseBrickPool = FDVRRenderer::RenderParameters::DefUseBrickPool;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|BrickPool")
+    int32 PoolBrickSize = FDVRRenderer::RenderParameters::DefPoolBrickSize;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|BrickPool")
+    int32 PoolSlotNumPerAxis = FDVRRenderer::RenderParameters::DefPoolSlotNumPerAxis;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|BrickPool")
+    int32 MaxBrickLoadNum = FDVRRenderer::RenderParameters::DefMaxBrickLoadNum;
     UPROPERTY(VisibleAnywhere, Category = "VIS4Earth")
     TObjectPtr<UGeoComponent> GeoComponent;
     UPROPERTY(VisibleAnywhere, Category = "VIS4Earth")
     TObjectPtr<UVolumeDataComponent> VolumeComponent;
     UPROPERTY(VisibleAnywhere, Category = "VIS4Earth")
     TObjectPtr<UTexture2D> PreIntegratedTF;
+    // Volumes of the same dimension and voxel type as VolumeComponent, e.g. humidity and
+    // reflectivity along with temperature
+    UPROPERTY(VisibleAnywhere, Category = "VIS4Earth|MultiVariable")
+    TArray<TObjectPtr<UVolumeDataComponent>> ExtraVolumeComponents;
+    UFUNCTION(CallInEditor, Category = "VIS4Earth|MultiVariable")
+    void AddVariable();
+    UFUNCTION(CallInEditor, Category = "VIS4Earth|MultiVariable")
+    void RemoveVariable();
 
     UPROPERTY(VisibleAnywhere, Category = "VIS4Earth")
     TObjectPtr<UWidgetComponent> UIComponent;
@@ -46,6 +138,7 @@ class VIS4EARTH_API ADVRActor : public AActor {
     void OnCheckBox_UsePreIntegratedTFCheckStateChanged(bool Checked) {
         UsePreIntegratedTF = Checked;
         generatePreIntegratedTF();
+        generateTF2D();
     }
     UFUNCTION()
     void OnEditableText_MaxStepCountTextChanged(const FText &Text) {
@@ -69,7 +162,15 @@ class VIS4EARTH_API ADVRActor : public AActor {
     virtual void PostLoad() override {
         Super::PostLoad();
 
+        VolumeComponent->SetKeepGradientVolume(isGradientVolumeNeeded());
+        VolumeComponent->SetKeepVolumeInGPU(!UseBrickPool);
+        for (auto &volComp : ExtraVolumeComponents)
+            if (volComp) {
+                volComp->SetKeepVolumeInCPU(true);
+                setupVariableSignalsSlots(volComp);
+            }
         generatePreIntegratedTF();
+        generateTF2D();
         setupRenderer();
     }
 
@@ -84,11 +185,20 @@ class VIS4EARTH_API ADVRActor : public AActor {
 
   private:
     TSharedPtr<FDVRRenderer> renderer;
+    // Rasterized, and pre-integrated if UsePreIntegratedTF, from TransferFunction2DWidgets
+    TSharedPtr<const TArray<FLinearColor>> tf2DCPUData;
 
     void setupSignalsSlots();
+    void setupVariableSignalsSlots(UVolumeDataComponent *VolComp);
     void setupRenderer();
     void destroyRenderer();
     void generatePreIntegratedTF();
+    void generateTF2D();
+    TArray<TransferFunction2DData::Widget> makeTF2DWidgets() const;
+    void updateJointHistogramTexture();
+    bool isGradientVolumeNeeded() const { return UseShading || Use2DTF || UseIsosurface; }
+    // Isosurfaces are classified by the transfer function at a single scalar
+    bool isPreIntegratedTFUsed() const { return UsePreIntegratedTF && !UseIsosurface; }
 
 #if WITH_EDITOR
   public:
@@ -101,14 +211,64 @@ class VIS4EARTH_API ADVRActor : public AActor {
         auto name = PropChngedEv.MemberProperty->GetFName();
         if (name == GET_MEMBER_NAME_CHECKED(ADVRActor, MaxStepCount) ||
             name == GET_MEMBER_NAME_CHECKED(ADVRActor, Step) ||
-            name == GET_MEMBER_NAME_CHECKED(ADVRActor, RelativeLightness)) {
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, RelativeLightness) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, EarlyTerminationAlpha) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, ShadingAmbient) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, ShadingDiffuse) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, ShadingSpecular) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, ShadingShininess) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, IsoValue) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, IsoBisectionNum) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, UseCPU) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, CPUDownsample) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, OccupancyBrickSize) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, MaxStepScale) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, AdaptiveStepTolerance) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, UseProgressive) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, MotionDownsample) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, MotionStepScale) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, RefinementFrameNum) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, PoolBrickSize) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, PoolSlotNumPerAxis) ||
+            name == GET_MEMBER_NAME_CHECKED(ADVRActor, MaxBrickLoadNum)) {
+            setupRenderer();
+            return;
+        }
+
+        if (name == GET_MEMBER_NAME_CHECKED(ADVRActor, UseBrickPool)) {
+            VolumeComponent->SetKeepVolumeInGPU(!UseBrickPool);
             setupRenderer();
             return;
         }
 
+        if (name == GET_MEMBER_NAME_CHECKED(ADVRActor, UseShading)) {
+            VolumeComponent->SetKeepGradientVolume(isGradientVolumeNeeded());
+            setupRenderer();
+            return;
+        }
+
+        if (name == GET_MEMBER_NAME_CHECKED(ADVRActor, UseIsosurface)) {
+            VolumeComponent->SetKeepGradientVolume(isGradientVolumeNeeded());
+            generateTF2D();
+            return;
+        }
+
+        if (name == GET_MEMBER_NAME_CHECKED(ADVRActor, Use2DTF)) {
+            VolumeComponent->SetKeepGradientVolume(isGradientVolumeNeeded());
+            updateJointHistogramTexture();
+            generateTF2D();
+            return;
+        }
+        if (name == GET_MEMBER_NAME_CHECKED(ADVRActor, TransferFunction2DWidgets)) {
+            generateTF2D();
+            return;
+        }
+
         if (name == GET_MEMBER_NAME_CHECKED(ADVRActor, UsePreIntegratedTF) ||
             name == GET_MEMBER_NAME_CHECKED(ADVRActor, Step) && PreIntegratedTF) {
             generatePreIntegratedTF();
+            if (name == GET_MEMBER_NAME_CHECKED(ADVRActor, UsePreIntegratedTF))
+                generateTF2D();
             return;
         }
     }
@@ -5,6 +5,10 @@
 #include "GeoRenderer.h"
 
 #include "Util.h"
+#include "VolumeDataComponent.h"
+
+class FBrickAtlas;
+class FVolumeOccupancy;
 
 class VIS4EARTH_API FDVRRenderer : public FGeoRenderer {
   public:
@@ -13,22 +17,116 @@ class VIS4EARTH_API FDVRRenderer : public FGeoRenderer {
     virtual void Register() override;
     virtual void Unregister() override;
 
+    // A volume co-registered with RenderParameters::VolumeCPUData, classified by its own
+    // transfer function
+    struct VariableParameters {
+        TSharedPtr<const TArray<uint8>> VolumeCPUData;
+        FIntVector Dimension = FIntVector::ZeroValue;
+        ESupportedVoxelType VoxelType = ESupportedVoxelType::None;
+        // Pre-integrated if RenderParameters::UsePreIntegratedTF, never 2D
+        TSharedPtr<const TArray<FLinearColor>> TransferFunctionCPUData;
+    };
+
     struct RenderParameters {
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UsePreIntegratedTF, false)
+        // TransferFunctionCPUData is a 2D transfer function over scalar x gradient magnitude,
+        // with the gradients of Gradients. Read by the CPU path only.
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, Use2DTF, false)
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int, MaxStepCount, 1000)
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, Step,
                                          .01f * (FGeoRenderer::GeoParameters::DefHeightRange[1] -
                                                  FGeoRenderer::GeoParameters::DefHeightRange[0]))
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, RelativeLightness, 1.f)
+        // Rays stop once their opacity reaches it
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, EarlyTerminationAlpha, .99f)
+        // Renders the first crossing of IsoValue, in voxel values, along each ray instead,
+        // refined by IsoBisectionNum bisections and colored by the transfer function. Read by
+        // the CPU path only.
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UseIsosurface, false)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, IsoValue, 0.f)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, IsoBisectionNum, 6)
+        // Lights samples by Blinn-Phong under a headlight, with the gradients of Gradients.
+        // Read by the CPU path only.
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UseShading, false)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, ShadingAmbient, .3f)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, ShadingDiffuse, .7f)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, ShadingSpecular, .2f)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, ShadingShininess, 16.f)
+        // Ray-casts on the CPU at 1 / CPUDownsample of the viewport resolution instead
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UseCPU, false)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, CPUDownsample, 4)
+        // Voxels per side of the bricks skipped when empty under the transfer function
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, OccupancyBrickSize, 8)
+        // Steps are scaled up to MaxStepScale in bricks of low or uniform opacity, as long as
+        // the scaled opacity error estimate stays under AdaptiveStepTolerance
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, MaxStepScale, 4)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, AdaptiveStepTolerance, .02f)
+        // While the camera moves, renders with the resolution divided by MotionDownsample and
+        // the step multiplied by MotionStepScale. Once it stops, refines at full quality by
+        // accumulating RefinementFrameNum frames of jittered rays.
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UseProgressive, true)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, MotionDownsample, 2)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, MotionStepScale, 2.f)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, RefinementFrameNum, 8)
+        // Streams bricks of PoolBrickSize^3 voxels into an atlas of PoolSlotNumPerAxis^3 slots,
+        // at most MaxBrickLoadNum per frame, prioritized by screen coverage x opacity. The CPU
+        // path marches only the resident bricks, skipping the others as empty.
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UseBrickPool, false)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, PoolBrickSize, 32)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, PoolSlotNumPerAxis, 8)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, MaxBrickLoadNum, 16)
         TWeakObjectPtr<UVolumeTexture> VolumeTexture;
         TWeakObjectPtr<UTexture2D> TransferFunctionTexture;
+        // Snapshots taken from UVolumeDataComponent in the game thread, so that the render
+        // thread never reads the component. Read by the CPU path and the brick pool only.
+        TSharedPtr<const TArray<uint8>> VolumeCPUData;
+        TSharedPtr<const GradientVolume> Gradients;
+        FIntVector Dimension = FIntVector::ZeroValue;
+        ESupportedVoxelType VoxelType = ESupportedVoxelType::None;
+        TSharedPtr<const TArray<FLinearColor>> TransferFunctionCPUData;
+        // Blended into every sample of VolumeCPUData in the same ray-march. Read by the CPU
+        // path only, skipping those of other dimensions or voxel types.
+        TArray<VariableParameters> ExtraVariables;
     };
-    void SetRenderParameters(const RenderParameters &Params) { rndrParams = Params; }
+    void SetRenderParameters(const RenderParameters &Params) { rndrState.Publish(Params); }
+    // Called when the volume data changes
+    void InvalidateVolumeOccupancy();
 
   private:
-    RenderParameters rndrParams;
+    TRendererState<RenderParameters> rndrState;
+
+    // Accessed in the render thread only. Snapshots are held rather than their addresses, so
+    // that a new snapshot allocated where a released one was is never taken for it.
+    struct OccupancyCache {
+        TSharedPtr<FVolumeOccupancy> Occupancy;
+        // Volume the Occupancy is built from
+        TSharedPtr<const TArray<uint8>> VolumeData;
+        // Transfer function the Occupancy is updated with
+        TSharedPtr<const TArray<FLinearColor>> TransferFunction;
+    };
+    OccupancyCache occupancyCache;
+    OccupancyCache brickOccupancyCache;
+    TArray<OccupancyCache> extraOccupancyCaches;
+    TSharedPtr<FBrickAtlas> brickAtlas;
+
+    // Progressive refinement, accessed in the render thread only
+    bool isRefinementDirty = true;
+    FMatrix prevEyeToEarth = FMatrix::Identity;
+    FMatrix prevInvProjection = FMatrix::Identity;
+    FIntPoint prevViewportSize = FIntPoint::ZeroValue;
+    int32 refinedFrameNum = 0;
+    FIntPoint refinedSize = FIntPoint::ZeroValue;
+    TArray<FLinearColor> refinedPixels;
 
     virtual void render(FPostOpaqueRenderParameters &PostQpqRndrParams) override;
 
     template <typename ShaderTy> void render(FPostOpaqueRenderParameters &PostQpqRndrParams);
+    void renderCPU(FPostOpaqueRenderParameters &PostQpqRndrParams);
+    void updateBrickPool(FPostOpaqueRenderParameters &PostQpqRndrParams);
+    // Builds Cache once per volume and refreshes it once per transfer function, which has
+    // TFRowNum rows as in a 2D one. Returns whether the occupancy is valid.
+    bool syncOccupancy(OccupancyCache &Cache, int32 BrickSize,
+                       const TSharedPtr<const TArray<uint8>> &VolDat, const FIntVector &Dimension,
+                       ESupportedVoxelType VoxTy, const TSharedPtr<const TArray<FLinearColor>> &TF,
+                       int32 TFRowNum = 1);
 };
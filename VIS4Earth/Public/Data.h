@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <functional>
 
 #include "CoreMinimal.h"
@@ -24,13 +25,21 @@ enum class ESupportedVoxelType : uint8 {
 UENUM()
 enum class EVolumeSmoothType : uint8 {
     Avg = 0 UMETA(DisplayName = "Average"),
-    Max UMETA(DisplayName = "Maximum")
+    Max UMETA(DisplayName = "Maximum"),
+    Gaussian UMETA(DisplayName = "Gaussian"),
+    Median UMETA(DisplayName = "Median")
 };
 UENUM()
 enum class EVolumeSmoothDimension : uint8 {
     XYZ = 0 UMETA(DisplayName = "Smooth over XYZ Sapce"),
     XY UMETA(DisplayName = "Smooth over XY Plane")
 };
+UENUM()
+enum class ETransferFunction2DWidgetType : uint8 {
+    Box = 0 UMETA(DisplayName = "Box"),
+    Triangle UMETA(DisplayName = "Triangle"),
+    Gaussian UMETA(DisplayName = "Gaussian")
+};
 
 class VolumeData {
   public:
@@ -42,6 +51,8 @@ class VolumeData {
         static inline FIntVector DefDimension = FIntVector::ZeroValue;
         FIntVector Dimension = DefDimension;
         FFilePath FilePath;
+        // Leaves the texture without a GPU resource, e.g. when bricks are streamed instead
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UploadToGPU, true)
         FName Name;
     };
     static TVariant<UVolumeTexture *, FString>
@@ -52,6 +63,10 @@ class VolumeData {
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(EVolumeSmoothType, SmoothTy, EVolumeSmoothType::Avg)
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(EVolumeSmoothDimension, SmoothDim,
                                          EVolumeSmoothDimension::XYZ)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntVector, Radius,
+                                         {1 VIS4EARTH_COMMA 1 VIS4EARTH_COMMA 1})
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FVector3f, Sigma,
+                                         {1.f VIS4EARTH_COMMA 1.f VIS4EARTH_COMMA 1.f})
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(ESupportedVoxelType, VoxTy, ESupportedVoxelType::None)
         static inline FIntVector DefDimension = FIntVector::ZeroValue;
         FIntVector Dimension = DefDimension;
@@ -76,6 +91,29 @@ class VolumeData {
         return PF_Unknown;
     }
 
+    static ESupportedVoxelType GetVoxelType(EPixelFormat PixelFormat) {
+        switch (PixelFormat) {
+        case PF_R8:
+            return ESupportedVoxelType::UInt8;
+        case PF_R16_UINT:
+            return ESupportedVoxelType::UInt16;
+        case PF_R32_FLOAT:
+            return ESupportedVoxelType::Float32;
+        default:
+            break;
+        }
+        return ESupportedVoxelType::None;
+    }
+
+    template <SupportedVoxelType T> static constexpr ESupportedVoxelType GetVoxelType() {
+        if constexpr (std::is_same_v<T, uint8>)
+            return ESupportedVoxelType::UInt8;
+        else if constexpr (std::is_same_v<T, uint16>)
+            return ESupportedVoxelType::UInt16;
+        else
+            return ESupportedVoxelType::Float32;
+    }
+
     static size_t GetVoxelSize(ESupportedVoxelType Type) {
         switch (Type) {
         case ESupportedVoxelType::UInt8:
@@ -107,6 +145,182 @@ class VolumeData {
     }
 };
 
+class VolumeStatistics {
+  public:
+    static constexpr auto MaxHistogramResolution = 1024;
+
+    struct Statistics {
+        float Min = 0.f;
+        float Max = 0.f;
+        double Mean = 0.;
+        double Variance = 0.;
+        int64 VoxelNum = 0;
+        // Bins evenly divide HistogramRange
+        TArray<uint64> Histogram;
+    };
+    Statistics Volume;
+    TArray<Statistics> PerHeight;
+    ESupportedVoxelType VoxTy = ESupportedVoxelType::None;
+    // Range of the voxel type for integers, see GetVoxelMinMaxExtent(), which matches the
+    // domain of transfer functions. [Volume.Min, Volume.Max] for floats, whose values are not
+    // bounded by the type.
+    FVector2f HistogramRange = FVector2f(0.f, 1.f);
+
+    bool IsValid() const { return Volume.VoxelNum != 0; }
+    int32 GetHistogramBin(float Scalar) const {
+        return GetHistogramBin(Scalar, HistogramRange, Volume.Histogram.Num());
+    }
+    static int32 GetHistogramBin(float Scalar, const FVector2f &Range, int32 BinNum) {
+        auto ext = Range.Y - Range.X;
+        if (ext <= 0.f)
+            return 0;
+        return std::clamp(static_cast<int32>((Scalar - Range.X) / ext * BinNum), 0, BinNum - 1);
+    }
+
+    static int32 GetHistogramResolution(ESupportedVoxelType Type) {
+        switch (Type) {
+        case ESupportedVoxelType::UInt8:
+            return std::numeric_limits<uint8>::max() + 1;
+        case ESupportedVoxelType::UInt16:
+        case ESupportedVoxelType::Float32:
+            return MaxHistogramResolution;
+        default:
+            break;
+        }
+        return 0;
+    }
+
+    struct FromFlatArrayDesc {
+        ESupportedVoxelType VoxTy = ESupportedVoxelType::None;
+        FIntVector Dimension = FIntVector::ZeroValue;
+        const TArray<uint8> &VolDat;
+    };
+    static TVariant<VolumeStatistics, FString> FromFlatArray(const FromFlatArrayDesc &Desc);
+};
+
+/*
+ * Class: ContourSpectrum
+ * Function:
+ * -- Isosurface area, enclosed volume and active cell number as functions of isovalue.
+ * -- Each cell is split into 6 tetrahedra. Over a tetrahedron, the distribution of a linear
+ *    scalar field is the quadratic B-spline with the 4 vertex scalars as knots, which gives
+ *    the enclosed volume and (with the gradient magnitude) the area of all isovalues at once.
+ * -- Lengths are measured in voxels.
+ */
+class ContourSpectrum {
+  public:
+    TArray<float> IsoValues;
+    TArray<double> Area;
+    // Volume of the region where scalar >= isovalue, i.e. inside the isosurface
+    TArray<double> EnclosedVolume;
+    TArray<int64> ActiveCellNum;
+
+    bool IsValid() const { return !IsoValues.IsEmpty(); }
+    // Returns isovalues at the largest local maxima of Area, in descending order of Area
+    TArray<float> FindInterestingIsoValues(int32 MaxNum) const;
+
+    struct FromFlatArrayDesc {
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, Resolution, 256)
+        ESupportedVoxelType VoxTy = ESupportedVoxelType::None;
+        FIntVector Dimension = FIntVector::ZeroValue;
+        FVector2f IsoValueRange = FVector2f::ZeroVector;
+        const TArray<uint8> &VolDat;
+    };
+    static TVariant<ContourSpectrum, FString> FromFlatArray(const FromFlatArrayDesc &Desc);
+};
+
+/*
+ * Class: GradientVolume
+ * Function:
+ * -- Gradients of a volume precomputed once for shading and isosurface normals, by central
+ *    differences inside and one-sided differences on the borders.
+ * -- Each voxel packs the direction into 2 x 8 bits of octahedral encoding and the magnitude
+ *    into 8 bits relative to MaxMagnitude, i.e. 3 bytes instead of 12.
+ * -- Lengths are measured in voxels and scalars are those of the volume, e.g. MaxMagnitude is
+ *    in scalar units per voxel.
+ */
+class GradientVolume {
+  public:
+    struct Voxel {
+        uint8 Octahedral[2];
+        uint8 Magnitude;
+    };
+    static_assert(sizeof(Voxel) == 3);
+
+    FIntVector Dimension = FIntVector::ZeroValue;
+    float MaxMagnitude = 0.f;
+    TArray<Voxel> Voxels;
+
+    bool IsValid() const { return !Voxels.IsEmpty(); }
+
+    // Magnitudes in [0, MagnitudeRange] are quantized into [0, 255]
+    static Voxel Encode(const FVector3f &Gradient, float MagnitudeRange) {
+        Voxel ret;
+        ret.Magnitude = MagnitudeRange <= 0.f
+                            ? 0
+                            : static_cast<uint8>(FMath::RoundToInt32(
+                                  std::min(Gradient.Size() / MagnitudeRange, 1.f) * 255.f));
+
+        // Projected onto the octahedron |x| + |y| + |z| = 1, whose lower half is folded
+        FVector2f oct = FVector2f::ZeroVector;
+        if (auto l1 = FMath::Abs(Gradient.X) + FMath::Abs(Gradient.Y) + FMath::Abs(Gradient.Z);
+            l1 > 0.f) {
+            oct = FVector2f(Gradient.X, Gradient.Y) / l1;
+            if (Gradient.Z < 0.f)
+                oct = FVector2f((1.f - FMath::Abs(oct.Y)) * (oct.X >= 0.f ? 1.f : -1.f),
+                                (1.f - FMath::Abs(oct.X)) * (oct.Y >= 0.f ? 1.f : -1.f));
+        }
+        for (int32 i = 0; i < 2; ++i)
+            ret.Octahedral[i] =
+                static_cast<uint8>(FMath::RoundToInt32((oct[i] * .5f + .5f) * 255.f));
+        return ret;
+    }
+    // Returns the normalized direction
+    static FVector3f DecodeNormal(const Voxel &Vox) {
+        FVector3f ret(Vox.Octahedral[0] / 255.f * 2.f - 1.f, Vox.Octahedral[1] / 255.f * 2.f - 1.f,
+                      0.f);
+        ret.Z = 1.f - FMath::Abs(ret.X) - FMath::Abs(ret.Y);
+        if (ret.Z < 0.f) {
+            auto x = ret.X;
+            ret.X = (1.f - FMath::Abs(ret.Y)) * (x >= 0.f ? 1.f : -1.f);
+            ret.Y = (1.f - FMath::Abs(x)) * (ret.Y >= 0.f ? 1.f : -1.f);
+        }
+        return ret.GetSafeNormal();
+    }
+    FVector3f Decode(const Voxel &Vox) const {
+        return DecodeNormal(Vox) * (Vox.Magnitude / 255.f * MaxMagnitude);
+    }
+
+    const Voxel &At(const FIntVector &Pos) const {
+        return Voxels[(static_cast<int64>(Pos.Z) * Dimension.Y + Pos.Y) * Dimension.X + Pos.X];
+    }
+    // Trilinearly interpolates the gradient at Pos in voxels, clamped to the volume
+    FVector3f Sample(const FVector3f &Pos) const {
+        FIntVector p0, p1;
+        FVector3f f;
+        for (int32 i = 0; i < 3; ++i) {
+            auto x = FMath::Clamp(Pos[i], 0.f, Dimension[i] - 1.f);
+            p0[i] = std::min(static_cast<int32>(x), Dimension[i] - 1);
+            p1[i] = std::min(p0[i] + 1, Dimension[i] - 1);
+            f[i] = x - p0[i];
+        }
+        auto at = [&](int32 x, int32 y, int32 z) { return Decode(At(FIntVector(x, y, z))); };
+        auto g00 = FMath::Lerp(at(p0.X, p0.Y, p0.Z), at(p1.X, p0.Y, p0.Z), f.X);
+        auto g10 = FMath::Lerp(at(p0.X, p1.Y, p0.Z), at(p1.X, p1.Y, p0.Z), f.X);
+        auto g01 = FMath::Lerp(at(p0.X, p0.Y, p1.Z), at(p1.X, p0.Y, p1.Z), f.X);
+        auto g11 = FMath::Lerp(at(p0.X, p1.Y, p1.Z), at(p1.X, p1.Y, p1.Z), f.X);
+        return FMath::Lerp(FMath::Lerp(g00, g10, f.Y), FMath::Lerp(g01, g11, f.Y), f.Z);
+    }
+
+    struct FromFlatArrayDesc {
+        ESupportedVoxelType VoxTy = ESupportedVoxelType::None;
+        FIntVector Dimension = FIntVector::ZeroValue;
+        // Raw or smoothed voxels of VoxTy
+        TConstArrayView<uint8> VolDat;
+    };
+    static TVariant<GradientVolume, FString> FromFlatArray(const FromFlatArrayDesc &Desc);
+};
+
 class TransferFunctionData {
   public:
     struct Desc {
@@ -128,3 +342,73 @@ class TransferFunctionData {
     static void FromPointsToCurve(UCurveLinearColor *Curve, const TMap<float, FVector4f> &Pnts);
     static TArray<FFloat16> LerpFromPointsToFlatArray(const TMap<float, FVector4f> &Pnts);
 };
+
+/*
+ * Class: TransferFunction2DData
+ * Function:
+ * -- Transfer function indexed by scalar and gradient magnitude, which isolates boundaries
+ *    between materials of similar scalars. Scalars are normalized by the voxel type and
+ *    magnitudes by GradientVolume::MaxMagnitude.
+ * -- Edited as widgets rasterized into a lookup table of Resolution x GradientResolution
+ *    entries, indexed by [GradientBin * Resolution + ScalarBin]. Overlapping widgets are
+ *    composited by opacity, i.e. opacities as 1 - product(1 - a_i) and colors averaged by a_i.
+ * -- Files keep a widget per line as
+ *    Type ScalarCenter GradientCenter ScalarExtent GradientExtent R G B A,
+ *    where Type is the index of ETransferFunction2DWidgetType and others are in [0, 255].
+ */
+class TransferFunction2DData {
+  public:
+    static constexpr auto Resolution = TransferFunctionData::Resolution;
+    static constexpr auto GradientResolution = 32;
+
+    struct Widget {
+        ETransferFunction2DWidgetType Type = ETransferFunction2DWidgetType::Box;
+        // In [0, 1] along scalar and gradient magnitude
+        FVector2f Center = FVector2f(.5f, .5f);
+        // Half sizes for Box, half width at the top and half height for Triangle, sigmas for
+        // Gaussian
+        FVector2f Extent = FVector2f(.1f, .1f);
+        FLinearColor Color = FLinearColor::White;
+    };
+
+    struct Desc {
+        FFilePath FilePath;
+    };
+    static TVariant<TArray<Widget>, FString> LoadFromFile(const Desc &Desc);
+    static TOptional<FString> SaveToFile(TConstArrayView<Widget> Widgets,
+                                         const FFilePath &FilePath);
+
+    static TArray<FLinearColor> Rasterize(TConstArrayView<Widget> Widgets);
+    static UTexture2D *FromFlatArrayToTexture(const TArray<FLinearColor> &Dat,
+                                              const FName &Name = NAME_None);
+};
+
+/*
+ * Class: JointHistogram
+ * Function:
+ * -- Voxel counts over scalar x gradient magnitude, binned the same as TransferFunction2DData
+ *    to guide placing its widgets. Boundaries show up as arcs between the clusters of
+ *    materials on the scalar axis.
+ */
+class JointHistogram {
+  public:
+    FIntPoint Resolution = FIntPoint::ZeroValue;
+    // Indexed by [GradientBin * Resolution.X + ScalarBin]
+    TArray<uint64> Counts;
+
+    bool IsValid() const { return !Counts.IsEmpty(); }
+    // Grayscale of log(1 + count) normalized by the fullest bin
+    UTexture2D *ToTexture(const FName &Name = NAME_None) const;
+
+    struct FromFlatArrayDesc {
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntPoint, Resolution,
+                                         {TransferFunction2DData::Resolution VIS4EARTH_COMMA
+                                              TransferFunction2DData::GradientResolution})
+        ESupportedVoxelType VoxTy = ESupportedVoxelType::None;
+        FIntVector Dimension = FIntVector::ZeroValue;
+        TConstArrayView<uint8> VolDat;
+        // Computed from VolDat
+        const GradientVolume &Gradients;
+    };
+    static TVariant<JointHistogram, FString> FromFlatArray(const FromFlatArrayDesc &Desc);
+};
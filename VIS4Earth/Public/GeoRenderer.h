@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "CoreMinimal.h"
 #include "Engine/VolumeTexture.h"
 
@@ -9,6 +11,43 @@
 
 #include "CesiumGeoreference.h"
 
+/*
+ * Class: TRendererState
+ * Function:
+ * -- Hands parameters of a renderer from the game thread to the render thread without locks.
+ * -- Game thread writes into its own slot and publishes it by atomically swapping it with
+ *    the pending slot. Render thread takes the pending slot by another atomic swap. Neither
+ *    side blocks, and neither sees a value being written by the other.
+ * -- Values published between two Acquire() coalesce, only the latest one is seen.
+ */
+template <typename T> class TRendererState {
+  public:
+    // Called in the game thread
+    void Publish(const T &Val) {
+        slots[writeIdx] = Val;
+        writeIdx = pending.exchange(writeIdx | DirtyBit, std::memory_order_acq_rel) & IndexMask;
+    }
+
+    // Called in the render thread. Returns whether a newer value is acquired.
+    bool Acquire() {
+        if ((pending.load(std::memory_order_acquire) & DirtyBit) == 0)
+            return false;
+        readIdx = pending.exchange(readIdx, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+
+    // Called in the render thread. Stays unchanged until the next Acquire().
+    const T &Get() const { return slots[readIdx]; }
+
+  private:
+    static constexpr uint8 IndexMask = 0b11;
+    static constexpr uint8 DirtyBit = 0b100;
+
+    T slots[3];
+    uint8 writeIdx = 0;
+    uint8 readIdx = 1;
+    std::atomic<uint8> pending = 2;
+};
 
 class VIS4EARTH_API FGeoRenderer : public TSharedFromThis<FGeoRenderer> {
   public:
@@ -21,13 +60,15 @@ class VIS4EARTH_API FGeoRenderer : public TSharedFromThis<FGeoRenderer> {
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FVector2d, HeightRange, {300000. VIS4EARTH_COMMA 900000.})
         TWeakObjectPtr<ACesiumGeoreference> GeoRef;
     };
-    void SetGeographicalParameters(const GeoParameters &Params) { geoParams = Params; }
+    virtual void SetGeographicalParameters(const GeoParameters &Params) {
+        geoState.Publish(Params);
+    }
 
     virtual void Register() = 0;
     virtual void Unregister() = 0;
 
   protected:
-    GeoParameters geoParams;
+    TRendererState<GeoParameters> geoState;
     FDelegateHandle onPostOpaqueRender;
 
     virtual void render(FPostOpaqueRenderParameters &PostQpqRndrParams) = 0;
@@ -0,0 +1,152 @@
+// Author: Kouek Kou
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+
+#include "CoreMinimal.h"
+#include "RHICommandList.h"
+#include "RHIResources.h"
+
+#include "Util.h"
+
+/*
+ * Class: FGrowableBuffer
+ * Function:
+ * -- Vertex or index buffer whose content is replaced frequently, e.g. by isovalue scrubbing.
+ * -- Buffers are BUF_Dynamic and locked with RLM_WriteOnly, which lets the RHI rename their
+ *    memory if frames still in flight draw them, so that uploads never stall on the GPU.
+ *    Uploads rotate through a ring of RingSize buffers, so that the buffer drawn by the last
+ *    frame is not locked again right away and renames stay rare.
+ * -- Each buffer of the ring grows by doubling its capacity, and only shrinks to twice the
+ *    uploaded size after ShrinkDelay consecutive uploads using at most 1/4 of its capacity.
+ * -- Only the uploaded range is locked and written.
+ * -- Allocations of all instances are counted by GetStatistics(), which also works under the
+ *    null RHI.
+ * -- Only accessed in the render thread.
+ */
+class VIS4EARTH_API FGrowableBuffer {
+  public:
+    struct Parameters {
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, IsIndexBuffer, false)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(uint32, Stride, 0)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(uint32, MinCapacity, 4096)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, ShrinkDelay, 8)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, RingSize, 2)
+        const TCHAR *DebugName = TEXT("VIS4Earth Growable Buffer");
+    };
+
+    struct Statistics {
+        int64 AllocNum = 0;
+        int64 ReleaseNum = 0;
+        int64 UploadNum = 0;
+        int64 UploadedByteNum = 0;
+        int64 AllocatedByteNum = 0; // capacity of all living buffers
+    };
+
+    FGrowableBuffer() : FGrowableBuffer(Parameters{}) {}
+    FGrowableBuffer(const Parameters &Params) : params(Params) {
+        slots.SetNum(std::max(params.RingSize, 1));
+    }
+    ~FGrowableBuffer() { Reset(); }
+
+    FGrowableBuffer(const FGrowableBuffer &) = delete;
+    FGrowableBuffer &operator=(const FGrowableBuffer &) = delete;
+
+    void Upload(FRHICommandListImmediate &RHICmdList, const void *Data, uint32 Size) {
+        if (Size == 0) {
+            size = 0;
+            return;
+        }
+
+        curr = (curr + 1) % slots.Num();
+        auto &slot = slots[curr];
+
+        auto newCap = slot.Capacity;
+        if (Size > slot.Capacity) {
+            newCap = std::max({params.MinCapacity, slot.Capacity * 2, Size});
+            slot.UnderusedNum = 0;
+        } else if (static_cast<uint64>(Size) * 4 <= slot.Capacity) {
+            if (++slot.UnderusedNum >= params.ShrinkDelay) {
+                newCap = std::max(params.MinCapacity, Size * 2);
+                slot.UnderusedNum = 0;
+            }
+        } else
+            slot.UnderusedNum = 0;
+
+        if (newCap != slot.Capacity || !slot.Buffer.IsValid()) {
+            release(slot);
+
+            FRHIResourceCreateInfo info(params.DebugName);
+            slot.Buffer = params.IsIndexBuffer
+                              ? RHICreateIndexBuffer(params.Stride, newCap, BUF_Dynamic,
+                                                     ERHIAccess::VertexOrIndexBuffer, info)
+                              : RHICreateVertexBuffer(newCap, BUF_Dynamic,
+                                                      ERHIAccess::VertexOrIndexBuffer, info);
+            slot.Capacity = newCap;
+
+            ++allocNum;
+            allocatedByteNum += newCap;
+        }
+
+        auto dat = RHICmdList.LockBuffer(slot.Buffer, 0, Size, RLM_WriteOnly);
+        FMemory::Memcpy(dat, Data, Size);
+        RHICmdList.UnlockBuffer(slot.Buffer);
+        size = Size;
+
+        ++uploadNum;
+        uploadedByteNum += Size;
+    }
+
+    void Reset() {
+        for (auto &slot : slots)
+            release(slot);
+        size = 0;
+    }
+
+    bool IsValid() const { return size != 0 && slots[curr].Buffer.IsValid(); }
+    // Buffer holding the last upload
+    const FBufferRHIRef &GetBuffer() const { return slots[curr].Buffer; }
+    uint32 GetSize() const { return size; }
+
+    static Statistics GetStatistics() {
+        Statistics ret;
+        ret.AllocNum = allocNum.load();
+        ret.ReleaseNum = releaseNum.load();
+        ret.UploadNum = uploadNum.load();
+        ret.UploadedByteNum = uploadedByteNum.load();
+        ret.AllocatedByteNum = allocatedByteNum.load();
+        return ret;
+    }
+
+  private:
+    struct Slot {
+        FBufferRHIRef Buffer;
+        uint32 Capacity = 0;
+        int32 UnderusedNum = 0;
+    };
+
+    Parameters params;
+    TArray<Slot> slots;
+    int32 curr = 0;
+    uint32 size = 0;
+
+    // Shared by all instances
+    static inline std::atomic<int64> allocNum = 0;
+    static inline std::atomic<int64> releaseNum = 0;
+    static inline std::atomic<int64> uploadNum = 0;
+    static inline std::atomic<int64> uploadedByteNum = 0;
+    static inline std::atomic<int64> allocatedByteNum = 0;
+
+    void release(Slot &ToRelease) {
+        if (!ToRelease.Buffer.IsValid())
+            return;
+
+        ToRelease.Buffer.SafeRelease();
+        ++releaseNum;
+        allocatedByteNum -= ToRelease.Capacity;
+        ToRelease.Capacity = 0;
+        ToRelease.UnderusedNum = 0;
+    }
+};
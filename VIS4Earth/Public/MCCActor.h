@@ -38,6 +38,9 @@ class VIS4EARTH_API AMCCActor : public AStaticMeshActor {
     bool UseSmoothedVolume = false;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     EMCCMeshSmoothType MeshSmoothType = EMCCMeshSmoothType::None;
+    // Takes vertex normals from the precomputed gradients instead of the adjacent faces
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    bool UseGradientNormals = false;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     FIntPoint HeightRange = {0, 0};
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
@@ -80,6 +83,13 @@ class VIS4EARTH_API AMCCActor : public AStaticMeshActor {
 
     AMCCActor();
 
+    virtual void PostLoad() override {
+        Super::PostLoad();
+
+        // Gradients are only computed for the normals
+        VolumeComponent->SetKeepGradientVolume(UseGradientNormals);
+    }
+
   protected:
     virtual void BeginPlay() override;
 
@@ -94,6 +104,7 @@ class VIS4EARTH_API AMCCActor : public AStaticMeshActor {
     struct VertexAttr {
         FVector Position;
         FVector Normal = FVector::Zero();
+        FVector GradientNormal = FVector::Zero();
         FVector PositionSmoothed;
         FVector NormalSmoothed;
         double Scalar;
@@ -142,6 +153,11 @@ class VIS4EARTH_API AMCCActor : public AStaticMeshActor {
             marchingCube();
             return;
         }
+        if (name == GET_MEMBER_NAME_CHECKED(AMCCActor, UseGradientNormals)) {
+            VolumeComponent->SetKeepGradientVolume(UseGradientNormals);
+            marchingCube();
+            return;
+        }
         if (name == GET_MEMBER_NAME_CHECKED(AMCCActor, MeshSmoothType)) {
             generateSmoothedMesh();
             return;
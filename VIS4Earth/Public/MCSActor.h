@@ -29,6 +29,8 @@ class VIS4EARTH_API AMCSActor : public AActor {
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     EMCSLineStyle LineStyle = FMCSRenderer::RenderParameters::DefLineStyle;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    float DashLength = FMCSRenderer::RenderParameters::DefDashLength;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     bool UseLerp = FMCSRenderer::MCSParameters::DefUseLerp;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     bool UseSmoothedVolume = FMCSRenderer::MCSParameters::DefUseSmoothedVolume;
@@ -36,6 +38,26 @@ class VIS4EARTH_API AMCSActor : public AActor {
     FIntPoint HeightRange = FMCSRenderer::MCSParameters::DefHeightRange;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     float IsoValue = FMCSRenderer::MCSParameters::DefIsoValue;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    float IsoValueStep = FMCSRenderer::MCSParameters::DefIsoValueStep;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    int32 IsoValueNum = FMCSRenderer::MCSParameters::DefIsoValueNum;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    TArray<float> IsoValues;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth")
+    float SimplifyTolerance = FMCSRenderer::MCSParameters::DefSimplifyTolerance;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Section")
+    EMCSSectionMode SectionMode = EMCSSectionMode::None;
+    // (Longitude, Latitude) in degrees. Longitude mode reads X, Latitude mode reads Y.
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Section")
+    FVector2D SectionStart = FVector2D::ZeroVector;
+    // (Longitude, Latitude) in degrees, only read by GreatCircle mode
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Section")
+    FVector2D SectionEnd = FVector2D::ZeroVector;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Section")
+    int32 SectionColumnNum = FMCSRenderer::MCSParameters::DefSectionColumnNum;
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Export")
+    EMCSExportFormat ExportFormat = EMCSExportFormat::GeoJSON;
     UPROPERTY(VisibleAnywhere, Category = "VIS4Earth")
     TObjectPtr<UGeoComponent> GeoComponent;
     UPROPERTY(VisibleAnywhere, Category = "VIS4Earth")
@@ -81,6 +103,10 @@ class VIS4EARTH_API AMCSActor : public AActor {
         setupRenderer(true);
     }
 
+    // Exports contours of the current parameters per level and height
+    UFUNCTION(CallInEditor, Category = "VIS4Earth|Export")
+    void ExportContours();
+
     AMCSActor();
     ~AMCSActor() { destroyRenderer(); }
 
@@ -104,6 +130,8 @@ class VIS4EARTH_API AMCSActor : public AActor {
     void setupSignalsSlots();
     void checkAndCorrectParameters();
     void setupRenderer(bool shouldMarchSquare = false);
+    FMCSRenderer::MCSParameters makeMCSParameters() const;
+    TArray<FVector2f> makeSectionPath() const;
     void destroyRenderer();
 
   private:
@@ -118,14 +146,23 @@ class VIS4EARTH_API AMCSActor : public AActor {
             return;
 
         auto name = PropChngedEv.MemberProperty->GetFName();
-        if (name == GET_MEMBER_NAME_CHECKED(AMCSActor, LineStyle)) {
+        if (name == GET_MEMBER_NAME_CHECKED(AMCSActor, LineStyle) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCSActor, DashLength)) {
             setupRenderer();
             return;
         }
         if (name == GET_MEMBER_NAME_CHECKED(AMCSActor, UseLerp) ||
             name == GET_MEMBER_NAME_CHECKED(AMCSActor, UseSmoothedVolume) ||
             name == GET_MEMBER_NAME_CHECKED(AMCSActor, HeightRange) ||
-            name == GET_MEMBER_NAME_CHECKED(AMCSActor, IsoValue)) {
+            name == GET_MEMBER_NAME_CHECKED(AMCSActor, IsoValue) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCSActor, IsoValueStep) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCSActor, IsoValueNum) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCSActor, IsoValues) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCSActor, SimplifyTolerance) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCSActor, SectionMode) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCSActor, SectionStart) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCSActor, SectionEnd) ||
+            name == GET_MEMBER_NAME_CHECKED(AMCSActor, SectionColumnNum)) {
             setupRenderer(true);
             return;
         }
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "GeoRenderer.h"
+#include "GrowableBuffer.h"
 
 #include "Util.h"
 #include "VolumeDataComponent.h"
@@ -13,6 +14,20 @@ enum class EMCSLineStyle : uint8 {
     Dash UMETA(DisplayName = "Dash")
 };
 
+UENUM()
+enum class EMCSSectionMode : uint8 {
+    None = 0 UMETA(DisplayName = "Horizontal Slices"),
+    Longitude UMETA(DisplayName = "Vertical Section along Longitude"),
+    Latitude UMETA(DisplayName = "Vertical Section along Latitude"),
+    GreatCircle UMETA(DisplayName = "Vertical Section along Great Circle")
+};
+
+UENUM()
+enum class EMCSExportFormat : uint8 {
+    GeoJSON = 0 UMETA(DisplayName = "GeoJSON"),
+    Binary UMETA(DisplayName = "Binary")
+};
+
 class VIS4EARTH_API FMCSRenderer : public FGeoRenderer {
   public:
     ~FMCSRenderer() { Unregister(); }
@@ -22,34 +37,133 @@ class VIS4EARTH_API FMCSRenderer : public FGeoRenderer {
 
     struct RenderParameters {
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(EMCSLineStyle, LineStyle, EMCSLineStyle::Solid)
+        // Length in voxels of a dash and of the gap after it
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, DashLength, 2.f)
         TWeakObjectPtr<UTexture2D> TransferFunctionTexture;
     };
-    void SetRenderParameters(const RenderParameters &Params) { rndrParams = Params; }
+    void SetRenderParameters(const RenderParameters &Params) { rndrState.Publish(Params); }
+    // Vertices are re-transformed and uploaded in a render command, not while rendering
+    virtual void SetGeographicalParameters(const GeoParameters &Params) override;
 
     struct MCSParameters {
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UseLerp, true)
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(bool, UseSmoothedVolume, false)
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(FIntPoint, HeightRange, {0 VIS4EARTH_COMMA 0})
         VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, IsoValue, 0.f)
+        // Contour levels IsoValue + i * IsoValueStep for i in [0, IsoValueNum). A non-positive
+        // IsoValueStep gives IsoValue only.
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, IsoValueStep, 0.f)
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, IsoValueNum, 1)
+        // Overrides the contour levels above if not empty
+        TArray<float> IsoValues;
+        // Douglas-Peucker tolerance in voxels, 0 keeps every vertex of stitched contours
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(float, SimplifyTolerance, 0.f)
+        // Contours a vertical section standing on this path over HeightRange instead of
+        // horizontal slices if not empty. The path lies in the XY plane of the volume with the
+        // same [0,1]^2 mapping as VertexAttr::Position.
+        TArray<FVector2f> SectionPath;
+        VIS4EARTH_DEFINE_VAR_WITH_DEFVAL(int32, SectionColumnNum, 256)
         TWeakObjectPtr<UVolumeDataComponent> VolumeComponent;
+
+        TArray<float> GetIsoValues() const {
+            if (!IsoValues.IsEmpty())
+                return IsoValues;
+
+            TArray<float> ret;
+            auto num = IsoValueStep > 0.f ? std::max(IsoValueNum, 1) : 1;
+            for (int32 i = 0; i < num; ++i)
+                ret.Emplace(IsoValue + i * IsoValueStep);
+            return ret;
+        }
     };
     void MarchingSquare(const MCSParameters &Params);
+    // Drops cached slice contours, required when the voxels of the volume change
+    void InvalidateContourCache();
+
+    struct VertexAttr {
+        FVector3f Position; // position in [0,1]^3, or relative to localOrigin once uploaded
+        float Scalar;
+        float ArcLength; // distance in voxels from the start of the polyline
+        float Level;     // index of the isovalue in MCSParameters::GetIsoValues()
+    };
+
+    // Contours of all levels on one slice. Stitched polylines are contiguous in Vertices, and
+    // a polyline spanning Vertices[s, e) is drawn by the lines (v, v + 1) for v in [s, e - 1),
+    // followed by the line (e - 1, s) if it is closed.
+    struct SliceContour {
+        TArray<VertexAttr> Vertices;
+        TArray<uint32> Indices; // local to Vertices of the same slice
+        // Counts of the marched segments, to measure the reduction of stitching
+        int32 UnstitchedVertexNum = 0;
+        int32 UnstitchedIndexNum = 0;
+    };
+    // Extracts stitched contours of the slice at height Z, or of the vertical section if
+    // Params.SectionPath is not empty (Z is ignored then). Reads the volume on the CPU, thus can
+    // be called from any thread. Positions of vertices are in [0,1]^3.
+    static SliceContour ExtractSliceContour(const MCSParameters &Params, int32 Z);
 
   private:
+    // Parameters other than HeightRange that slice contours depend on
+    struct ContourCacheKey {
+        TArray<float> IsoValues;
+        bool UseLerp = false;
+        bool UseSmoothedVolume = false;
+        float SimplifyTolerance = 0.f;
+        const UVolumeDataComponent *VolumeComponent = nullptr;
+        FIntVector Dimension = FIntVector::ZeroValue;
+
+        bool operator==(const ContourCacheKey &Other) const {
+            return IsoValues == Other.IsoValues && UseLerp == Other.UseLerp &&
+                   UseSmoothedVolume == Other.UseSmoothedVolume &&
+                   SimplifyTolerance == Other.SimplifyTolerance &&
+                   VolumeComponent == Other.VolumeComponent && Dimension == Other.Dimension;
+        }
+    };
+    // Parameters the contour of a vertical section depends on
+    struct SectionCacheKey {
+        ContourCacheKey Contour;
+        TArray<FVector2f> Path;
+        int32 ColumnNum = 0;
+        FIntPoint HeightRange = FIntPoint::ZeroValue;
+
+        bool operator==(const SectionCacheKey &Other) const {
+            return Contour == Other.Contour && Path == Other.Path &&
+                   ColumnNum == Other.ColumnNum && HeightRange == Other.HeightRange;
+        }
+    };
+
     uint32 vertNum = 0, primNum = 0;
-    RenderParameters rndrParams;
-    FBufferRHIRef vertexBuffer;
-    FBufferRHIRef indexBuffer;
+    TRendererState<RenderParameters> rndrState;
+    TRendererState<MCSParameters> mcsState;
+    // Geographical parameters the uploaded vertices are transformed with, which render() draws
+    // with so that a newer published value never meets older vertices
+    GeoParameters uploadedGeoParams;
+    FGrowableBuffer vertexBuffer{
+        {.Stride = sizeof(VertexAttr), .DebugName = TEXT("Marching Square Vertex Buffer")}};
+    FGrowableBuffer indexBuffer{{.IsIndexBuffer = true,
+                                 .Stride = sizeof(uint32),
+                                 .DebugName = TEXT("Marching Square Index Buffer")}};
+
+    // Contours of every slice marched under contourCacheKey, indexed by height.
+    // Only accessed in the render thread.
+    ContourCacheKey contourCacheKey;
+    TMap<int32, SliceContour> sliceCache;
+    // Contour of the last vertical section marched under sectionCacheKey
+    SectionCacheKey sectionCacheKey;
+    TOptional<SliceContour> sectionCache;
+
+    // Vertices in [0,1]^3 kept to re-transform when only geographical parameters change
+    TArray<VertexAttr> gridVertices;
+    // Unreal space origin of uploaded vertices, kept in double for camera-relative rendering
+    FVector localOrigin = FVector::ZeroVector;
 
     virtual void render(FPostOpaqueRenderParameters &PostQpqRndrParams) override;
 
     void marchingSquare(const MCSParameters &Params, FRHICommandListImmediate &RHICmdList);
+    void syncGeographicalParameters(FRHICommandListImmediate &RHICmdList);
+    void uploadVertices(FRHICommandListImmediate &RHICmdList);
 
   public:
-    struct VertexAttr {
-        FVector3f Position; // position in [0,1]^3
-        float Scalar;
-    };
     class FVertexAttrDeclaration : public FRenderResource {
       public:
         FVertexDeclarationRHIRef VertexDeclarationRHI;
@@ -59,6 +173,8 @@ class VIS4EARTH_API FMCSRenderer : public FGeoRenderer {
             uint16 stride = sizeof(VertexAttr);
             elemeList.Emplace(0, STRUCT_OFFSET(VertexAttr, Position), VET_Float3, 0, stride);
             elemeList.Emplace(0, STRUCT_OFFSET(VertexAttr, Scalar), VET_Float1, 1, stride);
+            elemeList.Emplace(0, STRUCT_OFFSET(VertexAttr, ArcLength), VET_Float1, 2, stride);
+            elemeList.Emplace(0, STRUCT_OFFSET(VertexAttr, Level), VET_Float1, 3, stride);
 
             VertexDeclarationRHI = PipelineStateCache::GetOrCreateVertexDeclaration(elemeList);
         }
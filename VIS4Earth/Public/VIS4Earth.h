@@ -5,6 +5,8 @@
 #include "CoreMinimal.h"
 #include "Modules/ModuleManager.h"
 
+VIS4EARTH_API DECLARE_LOG_CATEGORY_EXTERN(LogVIS4Earth, Log, All);
+
 class FVIS4EarthModule : public IModuleInterface {
   public:
     /** IModuleInterface implementation */
@@ -21,6 +21,12 @@ class VIS4EARTH_API UVolumeDataComponent : public UActorComponent {
     EVolumeSmoothType VolumeSmoothType = EVolumeSmoothType::Max;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth|Smooth")
     EVolumeSmoothDimension VolumeSmoothDimension = EVolumeSmoothDimension::XYZ;
+    // Radius along lon, lat and height for Average, Maximum and Median
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Smooth")
+    FIntVector VolumeSmoothRadius = VolumeData::SmoothFromFlatArrayDesc::DefRadius;
+    // Sigma in voxels along lon, lat and height for Gaussian
+    UPROPERTY(EditAnywhere, Category = "VIS4Earth|Smooth")
+    FVector3f VolumeSmoothSigma = VolumeData::SmoothFromFlatArrayDesc::DefSigma;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
     ESupportedVoxelType ImportVoxelType = VolumeData::LoadFromFileDesc::DefVoxTy;
     UPROPERTY(EditAnywhere, Category = "VIS4Earth")
@@ -51,6 +57,8 @@ class VIS4EARTH_API UVolumeDataComponent : public UActorComponent {
 
     UFUNCTION(CallInEditor, Category = "VIS4Earth")
     void LoadRAWVolume();
+    UFUNCTION(BlueprintCallable, Category = "VIS4Earth")
+    TArray<float> GetInterestingIsoValues(int32 MaxNum = 4) const;
     UFUNCTION(CallInEditor, Category = "VIS4Earth")
     void LoadTF();
     UFUNCTION(CallInEditor, Category = "VIS4Earth")
@@ -68,21 +76,56 @@ class VIS4EARTH_API UVolumeDataComponent : public UActorComponent {
 
     UUserWidget *GetUI() const { return ui.Get(); }
 
+    // Shows ErrMsg as a failed notification, shared by the actors loading volume data
+    static void ProcessError(const FString &ErrMsg);
+
     void SetKeepVolumeInCPU(bool Keep) {
         keepVolumeInCPU = Keep;
         generateSmoothedVolume();
     }
+    void SetKeepVolumeInGPU(bool Keep) {
+        if (keepVolumeInGPU == Keep)
+            return;
+        keepVolumeInGPU = Keep;
+        syncVolumeTexture();
+        generateSmoothedVolume();
+    }
     void SetKeepSmoothedVolume(bool Keep) {
         keepSmoothedVolume = Keep;
         generateSmoothedVolume();
     }
+    // Gradients of the smoothed volume if kept, or of the volume otherwise, along with their
+    // joint histogram with scalars
+    void SetKeepGradientVolume(bool Keep) {
+        if (keepGradientVolume == Keep && (!Keep || gradientVolume->IsValid()))
+            return;
+        keepGradientVolume = Keep;
+        generateGradientVolume();
+    }
 
-    const TArray<uint8> &GetVolumeCPUData() const { return volumeCPUData; }
+    const TArray<uint8> &GetVolumeCPUData() const { return *volumeCPUData; }
+    const TArray<float> &GetVolumeCPUDataSmoothed() const { return volumeCPUDataSmoothed; }
+    const VolumeStatistics &GetVolumeStatistics() const { return volumeStatistics; }
+    const ContourSpectrum &GetContourSpectrum() const { return contourSpectrum; }
+    const GradientVolume &GetGradientVolume() const { return *gradientVolume; }
+    // Voxels and gradients are replaced as a whole, never modified in place, so that these
+    // snapshots can be held and read by other threads while the component moves on
+    TSharedRef<const TArray<uint8>> GetVolumeCPUDataSnapshot() const { return volumeCPUData; }
+    TSharedRef<const GradientVolume> GetGradientVolumeSnapshot() const { return gradientVolume; }
+    const JointHistogram &GetJointHistogram() const { return jointHistogram; }
+    // Returns the real value range of the loaded volume, or the range of its voxel type
+    // before any volume is loaded
+    TTuple<float, float> GetVolumeValueRange() const {
+        if (volumeStatistics.IsValid())
+            return MakeTuple(volumeStatistics.Volume.Min, volumeStatistics.Volume.Max);
+        auto [vxMin, vxMax, vxExt] = VolumeData::GetVoxelMinMaxExtent(GetVolumeVoxelType());
+        return MakeTuple(vxMin, vxMax);
+    }
     ESupportedVoxelType GetVolumeVoxelType() const { return prevVolumeDataDesc.VoxTy; }
     FIntVector GetVoxelPerVolume() const { return prevVolumeDataDesc.Dimension; }
 
     template <SupportedVoxelType T> T SampleVolumeCPUData(const FIntVector &Pos) {
-        return *(reinterpret_cast<const T *>(volumeCPUData.GetData()) + Pos.Z * voxPerVolYxX +
+        return *(reinterpret_cast<const T *>(volumeCPUData->GetData()) + Pos.Z * voxPerVolYxX +
                  Pos.Y * VolumeTexture->GetSizeX() + Pos.X);
     }
     float SampleVolumeCPUDataSmoothed(const FIntVector &Pos) {
@@ -101,21 +144,31 @@ class VIS4EARTH_API UVolumeDataComponent : public UActorComponent {
   private:
     size_t voxPerVolYxX;
     bool keepVolumeInCPU = false;
+    bool keepVolumeInGPU = true;
     bool keepSmoothedVolume = false;
+    bool keepGradientVolume = false;
     VolumeData::LoadFromFileDesc prevVolumeDataDesc;
 
     TObjectPtr<UUserWidget> ui;
 
-    TArray<uint8> volumeCPUData;
+    TSharedRef<const TArray<uint8>> volumeCPUData = MakeShared<TArray<uint8>>();
     TArray<float> volumeCPUDataSmoothed;
+    VolumeStatistics volumeStatistics;
+    ContourSpectrum contourSpectrum;
+    TSharedRef<const GradientVolume> gradientVolume = MakeShared<GradientVolume>();
+    JointHistogram jointHistogram;
     TMap<float, FVector4f> tfPnts;
 
+    // Releases or uploads the GPU resource of VolumeTexture as keepVolumeInGPU requires. The
+    // upload needs the volume kept in the CPU, otherwise it waits for the next load.
+    void syncVolumeTexture();
     void generateSmoothedVolume();
+    // Recomputes from cached voxels of VoxTy, or from the kept smoothed or raw volume if empty
+    void generateGradientVolume(TConstArrayView<uint8> VolDat = {},
+                                ESupportedVoxelType VoxTy = ESupportedVoxelType::None);
     void generatePreIntegratedTF();
     void createDefaultTFTexture();
 
-    static void processError(const FString &ErrMsg);
-
 #if WITH_EDITOR
   public:
     virtual void PostEditChangeProperty(struct FPropertyChangedEvent &PropChngedEv) {
@@ -126,7 +179,9 @@ class VIS4EARTH_API UVolumeDataComponent : public UActorComponent {
 
         auto name = PropChngedEv.MemberProperty->GetFName();
         if (name == GET_MEMBER_NAME_CHECKED(UVolumeDataComponent, VolumeSmoothType) ||
-            name == GET_MEMBER_NAME_CHECKED(UVolumeDataComponent, VolumeSmoothDimension)) {
+            name == GET_MEMBER_NAME_CHECKED(UVolumeDataComponent, VolumeSmoothDimension) ||
+            name == GET_MEMBER_NAME_CHECKED(UVolumeDataComponent, VolumeSmoothRadius) ||
+            name == GET_MEMBER_NAME_CHECKED(UVolumeDataComponent, VolumeSmoothSigma)) {
             generateSmoothedVolume();
             return;
         }